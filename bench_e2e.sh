@@ -0,0 +1,118 @@
+#!/bin/sh
+# End-to-end benchmark of read_cont (reader -> filter -> print -> SQLite)
+# against the simulated reader, at increasing offered loads.
+#
+# Each step runs read_cont on sim:// in realtime mode for the given time,
+# with a tag population large enough that few reads merge in the tag
+# buffer, and reports committed rows/s, dropped reads and the latency from
+# tag timestamp to commit. The first step that drops reads or commits less
+# than the -s fraction of the offered rate is the saturation point.
+#
+# Usage: ./bench_e2e.sh [-b read_cont] [-t seconds] [-r "rate rate ..."]
+#                       [-s fraction] [-g rate] [-o results.json]
+#                       [-- extra read_cont arguments]
+#   -g rate   exit 1 if the pipeline saturates at or below this rate
+# e.g. ./bench_e2e.sh -t 5 -r "1000 5000 20000" -g 5000 -- --async 250,0
+
+BIN=./read_cont
+SECONDS_PER_STEP=10
+RATES="100 500 1000 2000 5000 10000 20000 50000"
+SUSTAIN=0.8
+GATE=0
+OUT=bench-e2e.json
+
+while getopts b:t:r:s:g:o: opt
+do
+  case $opt in
+    b) BIN=$OPTARG ;;
+    t) SECONDS_PER_STEP=$OPTARG ;;
+    r) RATES=$OPTARG ;;
+    s) SUSTAIN=$OPTARG ;;
+    g) GATE=$OPTARG ;;
+    o) OUT=$OPTARG ;;
+    *) sed -n '2,16p' "$0" >&2; exit 2 ;;
+  esac
+done
+shift $((OPTIND - 1))
+
+if [ ! -x "$BIN" ]
+then
+  echo "read_cont not found: $BIN (use -b)" >&2
+  exit 2
+fi
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT INT TERM
+
+# read_cont stops on a key press; give it a stdin that is never readable
+mkfifo "$WORK/stdin"
+exec 3<>"$WORK/stdin"
+
+SATURATED=0
+FIRST=1
+printf '%8s %10s %10s %8s %9s %9s %9s %9s\n' offered reads/s rows/s dropped p50_ms p99_ms p999_ms max_ms
+{
+  printf '{\n  "machine": "%s",\n  "seconds": %s,\n  "args": "%s",\n  "steps": [\n' \
+         "$(uname -m)" "$SECONDS_PER_STEP" "$*"
+} > "$OUT"
+
+for RATE in $RATES
+do
+  # Twice as many tags as reads per second: one 500 ms TMR_read sees each
+  # tag a quarter of a time on average, so most reads stay separate rows
+  TAGS=$((RATE * 2))
+  URI="sim://?seed=1&tags=$TAGS&rate=$RATE&realtime=1&threshold=0,0"
+  rm -f "$WORK/e2e.db"
+  "$BIN" "$URI" --time "$SECONDS_PER_STEP" --file "$WORK/e2e.db" --pow 3000 "$@" <&3 > "$WORK/out.txt" 2> "$WORK/err.txt"
+  STATUS=$?
+
+  # Summary lines printed by read_cont at exit
+  LINE=$(awk -v rate="$RATE" -v sustain="$SUSTAIN" -v status="$STATUS" '
+    /^Reads: / { reads = $2; seconds = $4 }
+    /^Stored / { rows = $2 }
+    /^Queue: / { dropped = $4 }
+    /^Read to commit: / { p50 = $5; p99 = $8; p999 = $11; max = $14 }
+    END {
+      if (seconds <= 0) { seconds = 1 }
+      readRate = reads / seconds
+      rowRate = rows / seconds
+      saturated = (0 != status || dropped > 0 || rowRate < sustain * rate) ? 1 : 0
+      printf "%d %.1f %.1f %d %s %s %s %s %d %d\n", rate, readRate, rowRate, dropped + 0,
+             p50 + 0, p99 + 0, p999 + 0, max + 0, saturated, status
+    }' "$WORK/out.txt")
+  read -r OFFERED READS ROWS DROPPED P50 P99 P999 MAX STEP_SATURATED STEP_STATUS <<EOF
+$LINE
+EOF
+  printf '%8s %10s %10s %8s %9s %9s %9s %9s%s\n' "$OFFERED" "$READS" "$ROWS" "$DROPPED" "$P50" "$P99" "$P999" "$MAX" \
+         "$([ "$STEP_SATURATED" = 1 ] && echo '  saturated')"
+  if [ "$FIRST" = 0 ]
+  then
+    printf ',\n' >> "$OUT"
+  fi
+  FIRST=0
+  printf '    {"offered": %s, "reads_per_s": %s, "rows_per_s": %s, "dropped": %s, "p50_ms": %s, "p99_ms": %s, "p999_ms": %s, "max_ms": %s, "saturated": %s, "exit": %s}' \
+         "$OFFERED" "$READS" "$ROWS" "$DROPPED" "$P50" "$P99" "$P999" "$MAX" \
+         "$([ "$STEP_SATURATED" = 1 ] && echo true || echo false)" "$STEP_STATUS" >> "$OUT"
+  if [ "$STEP_SATURATED" = 1 ] && [ "$SATURATED" = 0 ]
+  then
+    SATURATED=$RATE
+    if [ "$STEP_STATUS" != 0 ]
+    then
+      echo "read_cont exited with $STEP_STATUS at $RATE reads/s:" >&2
+      tail -5 "$WORK/err.txt" >&2
+    fi
+  fi
+done
+
+printf '\n  ],\n  "saturation": %s\n}\n' "$SATURATED" >> "$OUT"
+if [ "$SATURATED" = 0 ]
+then
+  echo "Not saturated up to the highest rate; results in $OUT"
+else
+  echo "Saturation at $SATURATED offered reads/s; results in $OUT"
+fi
+if [ "$GATE" != 0 ] && [ "$SATURATED" != 0 ] && [ "$SATURATED" -le "$GATE" ]
+then
+  exit 1
+fi
+exit 0
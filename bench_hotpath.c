@@ -0,0 +1,572 @@
+/**
+ * Microbenchmarks for the host work done per tag read, in read_cont.c and
+ * the sweeps, fed with synthetic TMR_TagReadData.
+ *
+ * Each benchmark is calibrated to run for about --time ms, then repeated
+ * --runs times; the median and fastest run are reported in ns/op, with
+ * heap allocations and bytes per op counted by wrapping malloc. Results go
+ * to stdout as JSON so runs on different hosts can be compared.
+ * @file bench_hotpath.c
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/utsname.h>
+#include <tm_reader.h>
+#include "db_sink.h"
+#include "epc_match.h"
+#include "epc_table.h"
+#include "hot_stats.h"
+#include "read_queue.h"
+#include "time_util.h"
+
+#define usage() {fprintf(stderr, "Usage: bench_hotpath [--time ms] [--runs n] [--filter name] [--seed n]\n"\
+                         "[--time ms] : e.g, '--time 200 (target duration of one run)'\n"\
+                         "[--runs n] : e.g, '--runs 5 (runs per benchmark, median reported)'\n"\
+                         "[--filter name] : e.g, '--filter db_ (only benchmarks containing name)'\n"\
+                         "[--seed n] : e.g, '--seed 1 (synthetic tag population)'\n"); exit(1);}
+
+/* Synthetic reads cycled through by every benchmark */
+#define BENCH_READS (1024)
+/* Distinct tags among them, as in a busy portal */
+#define BENCH_TAGS (200)
+/* Allowlist size for the prefix match, half of them matching */
+#define BENCH_PREFIXES (64)
+#define BENCH_MAX_RUNS (31)
+
+/* Heap use, counted by the malloc wrappers below */
+static uint64_t allocs;
+static uint64_t allocBytes;
+
+#ifdef __GLIBC__
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *p, size_t size);
+extern void __libc_free(void *p);
+
+void *malloc(size_t size)
+{
+  allocs++;
+  allocBytes += size;
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size)
+{
+  allocs++;
+  allocBytes += n * size;
+  return __libc_calloc(n, size);
+}
+
+void *realloc(void *p, size_t size)
+{
+  allocs++;
+  allocBytes += size;
+  return __libc_realloc(p, size);
+}
+
+void free(void *p)
+{
+  __libc_free(p);
+}
+#define BENCH_COUNTS_ALLOCS (1)
+#else
+#define BENCH_COUNTS_ALLOCS (0)
+#endif /* __GLIBC__ */
+
+typedef struct Bench
+{
+  TMR_TagReadData reads[BENCH_READS];
+  ReadRecord records[BENCH_READS];
+  EpcPrefixSet prefixes;
+  EpcTable unique;
+  ReadQueue queue;
+  HotHistogram histogram;
+  DbSink sink;
+  FILE *devNull;
+  char dbPath[64];
+  uint64_t dbPasses;     /* passes over the reads inserted so far */
+  uint64_t checksum;    /* results folded in here so nothing is optimised out */
+} Bench;
+
+typedef void (*BenchFn)(Bench *b, uint64_t iters);
+
+typedef struct BenchCase
+{
+  const char *name;
+  BenchFn fn;
+  int (*setup)(Bench *b);
+  void (*teardown)(Bench *b);
+} BenchCase;
+
+/* xorshift64, so the tag population only depends on --seed */
+static uint64_t nextRandom(uint64_t *state)
+{
+  *state ^= *state << 13;
+  *state ^= *state >> 7;
+  *state ^= *state << 17;
+  return *state;
+}
+
+static void makeReads(Bench *b, uint64_t seed)
+{
+  uint8_t epcs[BENCH_TAGS][12];
+  uint64_t state = seed ? seed : 1;
+  uint64_t ms = 1700000000000ULL;
+  uint32_t i;
+  uint32_t j;
+
+  for (i = 0; i < BENCH_TAGS; i++)
+  {
+    /* Same 4-byte vendor header as real Gen2 inlays, random serial */
+    epcs[i][0] = 0xE2;
+    epcs[i][1] = 0x00;
+    epcs[i][2] = 0x49;
+    epcs[i][3] = (uint8_t)(i % 4);
+    for (j = 4; j < 12; j++)
+    {
+      epcs[i][j] = (uint8_t)nextRandom(&state);
+    }
+  }
+  memset(b->reads, 0, sizeof(b->reads));
+  for (i = 0; i < BENCH_READS; i++)
+  {
+    TMR_TagReadData *trd = &b->reads[i];
+    uint64_t r = nextRandom(&state);
+
+    ms += 1 + r % 5;
+    trd->tag.protocol = TMR_TAG_PROTOCOL_GEN2;
+    trd->tag.epcByteCount = 12;
+    memcpy(trd->tag.epc, epcs[r % BENCH_TAGS], 12);
+    trd->readCount = 1 + (uint32_t)(r >> 8) % 3;
+    trd->antenna = 1;
+    trd->rssi = -40 - (int32_t)((r >> 16) % 40);
+    trd->phase = (int32_t)((r >> 24) % 180);
+    trd->frequency = 902750 + 500 * (uint32_t)((r >> 32) % 50);
+    trd->timestampLow = (uint32_t)ms;
+    trd->timestampHigh = (uint32_t)(ms >> 32);
+  }
+}
+
+/* Same conversion as fillRecord() in read_cont.c */
+static void toRecord(ReadRecord *rec, const TMR_TagReadData *trd)
+{
+  rec->tsMs = ((uint64_t)trd->timestampHigh<<32) | trd->timestampLow;
+  rec->readCount = trd->readCount;
+  rec->frequency = trd->frequency;
+  rec->rssi = trd->rssi;
+  rec->phase = trd->phase;
+  rec->power = 3000;
+  rec->antenna = trd->antenna;
+  rec->protocol = trd->tag.protocol;
+  rec->epcLen = trd->tag.epcByteCount;
+  memcpy(rec->epc, trd->tag.epc, trd->tag.epcByteCount);
+}
+
+static void benchBytesToHex(Bench *b, uint64_t iters)
+{
+  char hex[2 * TMR_MAX_EPC_BYTE_COUNT + 1];
+  uint64_t i;
+
+  for (i = 0; i < iters; i++)
+  {
+    const TMR_TagReadData *trd = &b->reads[i % BENCH_READS];
+
+    TMR_bytesToHex(trd->tag.epc, trd->tag.epcByteCount, hex);
+    b->checksum += (uint8_t)hex[5];
+  }
+}
+
+static int setupPrefixes(Bench *b)
+{
+  char path[] = "/tmp/bench_hotpathXXXXXX";
+  int fd = mkstemp(path);
+  FILE *fp;
+  uint32_t i;
+  int rc;
+
+  if (fd < 0 || NULL == (fp = fdopen(fd, "w")))
+  {
+    return -1;
+  }
+  /* Half the prefixes cover the synthetic tags, half never match */
+  for (i = 0; i < BENCH_PREFIXES; i++)
+  {
+    fprintf(fp, "%s%02X%04X\n", i % 2 ? "E20049" : "E28011", i % 4, i * 2654435761u >> 16);
+  }
+  fprintf(fp, "E2004900\n");
+  fclose(fp);
+  rc = epcPrefixSetLoad(&b->prefixes, path);
+  unlink(path);
+  return rc;
+}
+
+static void teardownPrefixes(Bench *b)
+{
+  epcPrefixSetFree(&b->prefixes);
+}
+
+static void benchPrefixMatch(Bench *b, uint64_t iters)
+{
+  uint64_t i;
+
+  for (i = 0; i < iters; i++)
+  {
+    const TMR_TagReadData *trd = &b->reads[i % BENCH_READS];
+
+    b->checksum += epcPrefixSetMatch(&b->prefixes, trd->tag.epc, trd->tag.epcByteCount);
+  }
+}
+
+/* localtime + strftime, as getTimeStamp() and printRecord() do per tag */
+static void benchTimeString(Bench *b, uint64_t iters)
+{
+  char timeStr[32];
+  uint64_t i;
+
+  for (i = 0; i < iters; i++)
+  {
+    const TMR_TagReadData *trd = &b->reads[i % BENCH_READS];
+    time_t seconds = ((((uint64_t)trd->timestampHigh<<32) | trd->timestampLow) / 1000);
+
+    strftime(timeStr, sizeof(timeStr), "%H:%M:%S", localtime(&seconds));
+    b->checksum += (uint8_t)timeStr[7];
+  }
+}
+
+/* getSeconds() in read_cont.c */
+static void benchSeconds(Bench *b, uint64_t iters)
+{
+  uint64_t i;
+
+  for (i = 0; i < iters; i++)
+  {
+    const TMR_TagReadData *trd = &b->reads[i % BENCH_READS];
+    uint64_t timestamp = ((uint64_t)trd->timestampHigh<<32) | trd->timestampLow;
+
+    b->checksum += (time_t)(timestamp / 1000);
+  }
+}
+
+static int setupDevNull(Bench *b)
+{
+  b->devNull = fopen("/dev/null", "w");
+  return NULL == b->devNull ? -1 : 0;
+}
+
+static void teardownDevNull(Bench *b)
+{
+  fclose(b->devNull);
+}
+
+/* The line printRecord() writes, without the time string */
+static void benchPrintf(Bench *b, uint64_t iters)
+{
+  char idStr[128];
+  uint64_t i;
+
+  for (i = 0; i < iters; i++)
+  {
+    const TMR_TagReadData *trd = &b->reads[i % BENCH_READS];
+
+    TMR_bytesToHex(trd->tag.epc, trd->tag.epcByteCount, idStr);
+    fprintf(b->devNull, "%s | %d | %d | %d | %d | %d | %s\n", idStr, 3000, trd->rssi, trd->phase,
+            trd->frequency, trd->antenna, "12:00:00");
+  }
+}
+
+static void benchFillRecord(Bench *b, uint64_t iters)
+{
+  uint64_t i;
+
+  for (i = 0; i < iters; i++)
+  {
+    toRecord(&b->records[i % BENCH_READS], &b->reads[i % BENCH_READS]);
+  }
+  b->checksum += b->records[0].tsMs;
+}
+
+static int setupUnique(Bench *b)
+{
+  return epcTableInit(&b->unique, 1024, 0);
+}
+
+static void teardownUnique(Bench *b)
+{
+  epcTableFree(&b->unique);
+}
+
+static void benchUnique(Bench *b, uint64_t iters)
+{
+  uint64_t i;
+  bool created;
+
+  for (i = 0; i < iters; i++)
+  {
+    const TMR_TagReadData *trd = &b->reads[i % BENCH_READS];
+
+    epcTableInsert(&b->unique, trd->tag.epc, trd->tag.epcByteCount, &created);
+    b->checksum += created;
+  }
+}
+
+static int setupQueue(Bench *b)
+{
+  return readQueueInit(&b->queue, READ_QUEUE_CAPACITY);
+}
+
+static void teardownQueue(Bench *b)
+{
+  readQueueFree(&b->queue);
+}
+
+/* One push and one pop, both sides on this thread */
+static void benchQueue(Bench *b, uint64_t iters)
+{
+  ReadRecord rec;
+  uint64_t i;
+
+  for (i = 0; i < iters; i++)
+  {
+    readQueuePush(&b->queue, &b->records[i % BENCH_READS]);
+    readQueuePop(&b->queue, &rec);
+    b->checksum += rec.epc[11];
+  }
+}
+
+static void benchHistogram(Bench *b, uint64_t iters)
+{
+  uint64_t i;
+
+  for (i = 0; i < iters; i++)
+  {
+    hotRecord(&b->histogram, b->reads[i % BENCH_READS].timestampLow & 0xFFFFF);
+  }
+}
+
+static void benchClock(Bench *b, uint64_t iters)
+{
+  uint64_t i;
+
+  for (i = 0; i < iters; i++)
+  {
+    b->checksum += hotNowNs();
+  }
+}
+
+static int setupDb(Bench *b, const char *path)
+{
+  uint32_t i;
+
+  for (i = 0; i < BENCH_READS; i++)
+  {
+    toRecord(&b->records[i], &b->reads[i]);
+  }
+  snprintf(b->dbPath, sizeof(b->dbPath), "%s", path);
+  b->dbPasses = 0;
+  return SQLITE_OK == dbSinkOpen(&b->sink, b->dbPath, false, DB_SINK_BATCH_ROWS, DB_SINK_BATCH_MS) ? 0 : -1;
+}
+
+static int setupDbFile(Bench *b)
+{
+  char path[] = "/tmp/bench_hotpathXXXXXX";
+  int fd = mkstemp(path);
+
+  if (fd < 0)
+  {
+    return -1;
+  }
+  close(fd);
+  return setupDb(b, path);
+}
+
+static int setupDbMemory(Bench *b)
+{
+  return setupDb(b, ":memory:");
+}
+
+static void teardownDb(Bench *b)
+{
+  dbSinkClose(&b->sink);
+  if (0 != strcmp(":memory:", b->dbPath))
+  {
+    unlink(b->dbPath);
+  }
+}
+
+/* dbSinkInsert, with its share of the batched commits */
+static void benchDbInsert(Bench *b, uint64_t iters)
+{
+  uint64_t span = b->records[BENCH_READS - 1].tsMs - b->records[0].tsMs + 1;
+  uint64_t i;
+
+  for (i = 0; i < iters; i++)
+  {
+    ReadRecord rec = b->records[i % BENCH_READS];
+
+    /* Time keeps moving forward across passes, as in a real capture */
+    rec.tsMs += (b->dbPasses + i / BENCH_READS) * span;
+    dbSinkInsert(&b->sink, &rec);
+  }
+  b->dbPasses += iters / BENCH_READS + 1;
+  dbSinkFlush(&b->sink);
+}
+
+static const BenchCase cases[] =
+{
+  { "bytes_to_hex", benchBytesToHex, NULL, NULL },
+  { "prefix_match", benchPrefixMatch, setupPrefixes, teardownPrefixes },
+  { "time_string", benchTimeString, NULL, NULL },
+  { "get_seconds", benchSeconds, NULL, NULL },
+  { "print_record", benchPrintf, setupDevNull, teardownDevNull },
+  { "fill_record", benchFillRecord, NULL, NULL },
+  { "unique_insert", benchUnique, setupUnique, teardownUnique },
+  { "queue_push_pop", benchQueue, setupQueue, teardownQueue },
+  { "histogram_record", benchHistogram, NULL, NULL },
+  { "clock_read", benchClock, NULL, NULL },
+  { "db_insert_memory", benchDbInsert, setupDbMemory, teardownDb },
+  { "db_insert_file", benchDbInsert, setupDbFile, teardownDb },
+};
+
+static int compareDouble(const void *a, const void *b)
+{
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+
+  return (x > y) - (x < y);
+}
+
+/* Returns whether the case printed its entry, false if it could not be set up */
+static bool runCase(Bench *b, const BenchCase *c, uint32_t timeMs, uint32_t runs, bool first)
+{
+  double nsPerOp[BENCH_MAX_RUNS];
+  uint64_t target = (uint64_t)timeMs * 1000000;
+  uint64_t iters = 1;
+  uint64_t elapsed = 0;
+  uint64_t allocsBefore;
+  uint64_t bytesBefore;
+  double allocsPerOp;
+  double bytesPerOp;
+  uint32_t r;
+
+  if (NULL != c->setup && 0 != c->setup(b))
+  {
+    fprintf(stderr, "Cannot set up %s\n", c->name);
+    return false;
+  }
+  /* Grow the iteration count until one run takes about the target time */
+  while (elapsed < target / 10)
+  {
+    uint64_t start;
+
+    iters *= 10;
+    start = monotonicNs();
+    c->fn(b, iters);
+    elapsed = monotonicNs() - start;
+  }
+  iters = iters * target / (elapsed ? elapsed : 1) + 1;
+
+  allocsBefore = allocs;
+  bytesBefore = allocBytes;
+  for (r = 0; r < runs; r++)
+  {
+    uint64_t start = monotonicNs();
+
+    c->fn(b, iters);
+    nsPerOp[r] = (double)(monotonicNs() - start) / iters;
+  }
+  allocsPerOp = (double)(allocs - allocsBefore) / ((double)iters * runs);
+  bytesPerOp = (double)(allocBytes - bytesBefore) / ((double)iters * runs);
+  if (NULL != c->teardown)
+  {
+    c->teardown(b);
+  }
+
+  qsort(nsPerOp, runs, sizeof(nsPerOp[0]), compareDouble);
+  printf("%s    {\"name\": \"%s\", \"iterations\": %" PRIu64 ", \"runs\": %u, "
+         "\"ns_per_op\": %.2f, \"min_ns_per_op\": %.2f, \"max_ns_per_op\": %.2f, ",
+         first ? "" : ",\n", c->name, iters, runs, nsPerOp[runs / 2], nsPerOp[0], nsPerOp[runs - 1]);
+  if (BENCH_COUNTS_ALLOCS)
+  {
+    printf("\"allocs_per_op\": %.3f, \"bytes_per_op\": %.1f}", allocsPerOp, bytesPerOp);
+  }
+  else
+  {
+    printf("\"allocs_per_op\": null, \"bytes_per_op\": null}");
+  }
+  fflush(stdout);
+  return true;
+}
+
+int main(int argc, char *argv[])
+{
+  static Bench bench;
+  struct utsname host;
+  const char *filter = NULL;
+  uint32_t timeMs = 200;
+  uint32_t runs = 5;
+  uint64_t seed = 1;
+  bool first = true;
+  size_t i;
+
+  for (i = 1; i < (size_t)argc; i += 2)
+  {
+    if (i + 1 >= (size_t)argc)
+    {
+      usage();
+    }
+    if (0 == strcmp("--time", argv[i]))
+    {
+      timeMs = strtoul(argv[i+1], NULL, 0);
+    }
+    else if (0 == strcmp("--runs", argv[i]))
+    {
+      runs = strtoul(argv[i+1], NULL, 0);
+    }
+    else if (0 == strcmp("--filter", argv[i]))
+    {
+      filter = argv[i+1];
+    }
+    else if (0 == strcmp("--seed", argv[i]))
+    {
+      seed = strtoull(argv[i+1], NULL, 0);
+    }
+    else
+    {
+      fprintf(stderr, "Argument %s is not recognized\n", argv[i]);
+      usage();
+    }
+  }
+  if (0 == timeMs || 0 == runs || runs > BENCH_MAX_RUNS)
+  {
+    usage();
+  }
+
+  makeReads(&bench, seed);
+  for (i = 0; i < BENCH_READS; i++)
+  {
+    toRecord(&bench.records[i], &bench.reads[i]);
+  }
+  uname(&host);
+
+  printf("{\n  \"machine\": \"%s\",\n  \"system\": \"%s %s\",\n  \"compiler\": \"%s\",\n"
+         "  \"seed\": %" PRIu64 ",\n  \"time_ms\": %u,\n  \"benchmarks\": [\n",
+         host.machine, host.sysname, host.release, __VERSION__, seed, timeMs);
+  for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+  {
+    if (NULL != filter && NULL == strstr(cases[i].name, filter))
+    {
+      continue;
+    }
+    if (runCase(&bench, &cases[i], timeMs, runs, first))
+    {
+      first = false;
+    }
+  }
+  printf("\n  ],\n  \"checksum\": %" PRIu64 "\n}\n", bench.checksum);
+  return 0;
+}
@@ -0,0 +1,208 @@
+/**
+ * Binary capture of reader serial traffic.
+ * @file capture.c
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "capture.h"
+#include "time_util.h"
+
+/* Frame length is stored in 16 bits */
+#define CAPTURE_FRAME_MAX (0xFFFF)
+
+static void put16(uint8_t *p, uint16_t v)
+{
+  p[0] = (uint8_t)v;
+  p[1] = (uint8_t)(v >> 8);
+}
+
+static void put32(uint8_t *p, uint32_t v)
+{
+  put16(p, (uint16_t)v);
+  put16(p + 2, (uint16_t)(v >> 16));
+}
+
+static void put64(uint8_t *p, uint64_t v)
+{
+  put32(p, (uint32_t)v);
+  put32(p + 4, (uint32_t)(v >> 32));
+}
+
+static uint16_t get16(const uint8_t *p)
+{
+  return (uint16_t)(p[0] | p[1] << 8);
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+  return get16(p) | (uint32_t)get16(p + 2) << 16;
+}
+
+static uint64_t get64(const uint8_t *p)
+{
+  return get32(p) | (uint64_t)get32(p + 4) << 32;
+}
+
+uint64_t captureNowUs(void)
+{
+  return monotonicUs();
+}
+
+int captureOpen(CaptureWriter *w, const char *path)
+{
+  return captureOpenAt(w, path, captureNowUs());
+}
+
+int captureOpenAt(CaptureWriter *w, const char *path, uint64_t startUs)
+{
+  uint8_t header[CAPTURE_HEADER_SIZE];
+
+  memset(w, 0, sizeof(*w));
+  w->fp = fopen(path, "wb");
+  if (NULL == w->fp)
+  {
+    fprintf(stderr, "Cannot create capture: %s\n", path);
+    return -1;
+  }
+  setvbuf(w->fp, NULL, _IOFBF, 1 << 16);
+
+  w->startUs = startUs;
+  w->lastUs = startUs;
+  memset(header, 0, sizeof(header));
+  memcpy(header, CAPTURE_MAGIC, 6);
+  header[6] = CAPTURE_VERSION;
+  put64(header + 8, wallUs() - (captureNowUs() - startUs));
+  if (1 != fwrite(header, sizeof(header), 1, w->fp))
+  {
+    fclose(w->fp);
+    w->fp = NULL;
+    return -1;
+  }
+  return 0;
+}
+
+int captureWrite(CaptureWriter *w, uint8_t dir, uint64_t tsUs, const uint8_t *data, uint32_t len)
+{
+  uint8_t header[CAPTURE_FRAME_HEADER_SIZE];
+  uint64_t delta = tsUs > w->lastUs ? tsUs - w->lastUs : 0;
+
+  if (NULL == w->fp)
+  {
+    return -1;
+  }
+  if (len > CAPTURE_FRAME_MAX)
+  {
+    len = CAPTURE_FRAME_MAX;
+  }
+  if (delta > UINT32_MAX)
+  {
+    delta = UINT32_MAX;
+  }
+  put32(header, (uint32_t)delta);
+  put16(header + 4, (uint16_t)len);
+  header[6] = dir;
+  header[7] = 0;
+  if (1 != fwrite(header, sizeof(header), 1, w->fp) || len != fwrite(data, 1, len, w->fp))
+  {
+    return -1;
+  }
+  w->lastUs += delta;
+  w->frames++;
+  w->bytes += len;
+  return 0;
+}
+
+void captureListener(bool tx, uint32_t dataLen, const uint8_t data[], uint32_t timeout, void *cookie)
+{
+  (void)timeout;
+  captureWrite(cookie, tx ? CAPTURE_TX : CAPTURE_RX, captureNowUs(), data, dataLen);
+}
+
+void captureClose(CaptureWriter *w)
+{
+  if (NULL != w->fp)
+  {
+    fclose(w->fp);
+    w->fp = NULL;
+  }
+}
+
+int captureLoad(Capture *c, const char *path)
+{
+  FILE *fp;
+  long size;
+  size_t pos;
+  uint32_t max = 0;
+  uint64_t tsUs = 0;
+
+  memset(c, 0, sizeof(*c));
+  fp = fopen(path, "rb");
+  if (NULL == fp)
+  {
+    fprintf(stderr, "Cannot open capture: %s\n", path);
+    return -1;
+  }
+  if (0 != fseek(fp, 0, SEEK_END) || (size = ftell(fp)) < CAPTURE_HEADER_SIZE || 0 != fseek(fp, 0, SEEK_SET))
+  {
+    fprintf(stderr, "Not a capture: %s\n", path);
+    fclose(fp);
+    return -1;
+  }
+  c->size = (size_t)size;
+  c->data = malloc(c->size);
+  if (NULL == c->data || 1 != fread(c->data, c->size, 1, fp))
+  {
+    fclose(fp);
+    captureFree(c);
+    return -1;
+  }
+  fclose(fp);
+  if (0 != memcmp(c->data, CAPTURE_MAGIC, 6) || CAPTURE_VERSION != c->data[6])
+  {
+    fprintf(stderr, "Not a capture: %s\n", path);
+    captureFree(c);
+    return -1;
+  }
+  c->startUs = get64(c->data + 8);
+
+  for (pos = CAPTURE_HEADER_SIZE; pos + CAPTURE_FRAME_HEADER_SIZE <= c->size; )
+  {
+    CaptureFrame *frame;
+    uint16_t len = get16(c->data + pos + 4);
+
+    if (pos + CAPTURE_FRAME_HEADER_SIZE + len > c->size)
+    {
+      /* Cut short, e.g. by a crash while capturing */
+      break;
+    }
+    if (c->count == max)
+    {
+      CaptureFrame *frames;
+
+      max = max ? 2 * max : 1024;
+      frames = realloc(c->frames, max * sizeof(*frames));
+      if (NULL == frames)
+      {
+        captureFree(c);
+        return -1;
+      }
+      c->frames = frames;
+    }
+    tsUs += get32(c->data + pos);
+    frame = &c->frames[c->count++];
+    frame->tsUs = tsUs;
+    frame->len = len;
+    frame->dir = c->data[pos + 6];
+    frame->data = c->data + pos + CAPTURE_FRAME_HEADER_SIZE;
+    pos += CAPTURE_FRAME_HEADER_SIZE + len;
+  }
+  return 0;
+}
+
+void captureFree(Capture *c)
+{
+  free(c->data);
+  free(c->frames);
+  memset(c, 0, sizeof(*c));
+}
@@ -0,0 +1,83 @@
+/**
+ * Binary capture of reader serial traffic.
+ *
+ * A capture is a header followed by timestamped frames, one per message
+ * passed to a transport listener. All fields are little-endian:
+ *   header: magic "M6ECAP" (6), version (1), reserved (1),
+ *           wall clock at start in us (8)
+ *   frame:  us since the previous frame (4), length (2),
+ *           direction (1, 0 host to reader, 1 reader to host),
+ *           reserved (1), message bytes
+ * @file capture.h
+ */
+
+#ifndef _CAPTURE_H
+#define _CAPTURE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#define CAPTURE_MAGIC "M6ECAP"
+#define CAPTURE_VERSION (1)
+#define CAPTURE_HEADER_SIZE (16)
+#define CAPTURE_FRAME_HEADER_SIZE (8)
+
+#define CAPTURE_TX (0)
+#define CAPTURE_RX (1)
+
+typedef struct CaptureWriter
+{
+  FILE *fp;
+  uint64_t startUs;     /* monotonic clock at open */
+  uint64_t lastUs;      /* monotonic time of the last frame */
+  uint64_t frames;
+  uint64_t bytes;
+} CaptureWriter;
+
+typedef struct CaptureFrame
+{
+  uint64_t tsUs;        /* since the start of the capture */
+  const uint8_t *data;
+  uint16_t len;
+  uint8_t dir;
+} CaptureFrame;
+
+/* A capture loaded in memory, frames pointing into data */
+typedef struct Capture
+{
+  uint8_t *data;
+  size_t size;
+  uint64_t startUs;     /* wall clock */
+  CaptureFrame *frames;
+  uint32_t count;
+} Capture;
+
+/** Monotonic clock in microseconds, the time base of the frames. */
+uint64_t captureNowUs(void);
+
+/** Create the file and write the header. Returns 0 or -1. */
+int captureOpen(CaptureWriter *w, const char *path);
+
+/** Same, for frames taken since monotonic time startUs (e.g. from a trace). */
+int captureOpenAt(CaptureWriter *w, const char *path, uint64_t startUs);
+
+/**
+ * Append one frame taken at monotonic time tsUs. Frames must be written
+ * in time order; a frame older than the last one is stored as
+ * simultaneous with it.
+ */
+int captureWrite(CaptureWriter *w, uint8_t dir, uint64_t tsUs, const uint8_t *data, uint32_t len);
+
+/** TMR_TransportListener that appends each message; cookie is the writer. */
+void captureListener(bool tx, uint32_t dataLen, const uint8_t data[], uint32_t timeout, void *cookie);
+
+/** Flush and close. Safe to call twice. */
+void captureClose(CaptureWriter *w);
+
+/** Read a whole capture into memory. Returns 0 or -1. */
+int captureLoad(Capture *c, const char *path);
+void captureFree(Capture *c);
+
+#endif /* _CAPTURE_H */
@@ -0,0 +1,228 @@
+/**
+ * Copy a ToP table written with the old text schema (hex EPC text, ts in
+ * seconds) into a new database with the typed schema of db_sink.h.
+ *
+ * Works on the tables of read_cont and of power_ramp; columns the old
+ * table lacks are stored as 0 (read_count as 1). Rows are copied in rowid
+ * order, so they keep their order within a second.
+ *
+ * Usage: db_migrate old.db new.db [--batch rows]
+ * @file db_migrate.c
+ */
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sqlite3.h>
+#include "db_sink.h"
+#include "epc_match.h"
+
+#define usage() {fprintf(stderr, "Usage: db_migrate old.db new.db [--batch rows]\n"\
+                         "old.db : database with a text-schema ToP table (read_cont or power_ramp)\n"\
+                         "new.db : database to create with the typed schema (recreated if present)\n"\
+                         "[--batch rows] : e.g, '--batch 10000 (rows per transaction)'\n"); exit(1);}
+
+#define MIGRATE_BATCH_ROWS (10000)
+
+/* Old columns, in the order they are selected after epc */
+static const char *const columns[] = { "rssi", "phase", "freq", "pow", "ant", "ts", "read_count", "protocol" };
+#define COLUMN_COUNT (sizeof(columns) / sizeof(columns[0]))
+
+static bool hasColumn(sqlite3 *db, const char *name)
+{
+  sqlite3_stmt *stmt;
+  bool found = false;
+
+  if (SQLITE_OK != sqlite3_prepare_v2(db, "SELECT name FROM pragma_table_info('ToP');", -1, &stmt, NULL))
+  {
+    return false;
+  }
+  while (!found && SQLITE_ROW == sqlite3_step(stmt))
+  {
+    found = 0 == sqlite3_stricmp(name, (const char *)sqlite3_column_text(stmt, 0));
+  }
+  sqlite3_finalize(stmt);
+  return found;
+}
+
+/**
+ * EPC of an old row. The epc column had INT affinity, so an EPC of only
+ * decimal digits that fits 64 bits was stored as a number, losing any
+ * leading zeros; those are restored to a whole number of bytes and
+ * counted. Returns false if the value can't be an EPC.
+ */
+static bool oldEpc(sqlite3_stmt *stmt, int col, ReadRecord *rec, bool *guessed)
+{
+  char hex[2 * READ_RECORD_EPC_MAX + 2];
+  EpcValue value;
+
+  *guessed = false;
+  switch (sqlite3_column_type(stmt, col))
+  {
+  case SQLITE_TEXT:
+    snprintf(hex, sizeof(hex), "%s", (const char *)sqlite3_column_text(stmt, col));
+    break;
+  case SQLITE_INTEGER:
+  {
+    char digits[24];
+    int n = snprintf(digits, sizeof(digits), "%" PRId64, (int64_t)sqlite3_column_int64(stmt, col));
+
+    snprintf(hex, sizeof(hex), "%s%s", (n & 1) ? "0" : "", digits);
+    *guessed = true;
+    break;
+  }
+  case SQLITE_BLOB:
+    if (sqlite3_column_bytes(stmt, col) > READ_RECORD_EPC_MAX)
+    {
+      return false;
+    }
+    rec->epcLen = (uint8_t)sqlite3_column_bytes(stmt, col);
+    memcpy(rec->epc, sqlite3_column_blob(stmt, col), rec->epcLen);
+    return true;
+  default:
+    return false;
+  }
+  if (0 != epcParse(hex, &value) || value.len > READ_RECORD_EPC_MAX)
+  {
+    return false;
+  }
+  rec->epcLen = value.len;
+  memcpy(rec->epc, value.bytes, value.len);
+  return true;
+}
+
+int main(int argc, char *argv[])
+{
+  sqlite3 *old;
+  sqlite3_stmt *select;
+  DbSink sink;
+  char sql[512];
+  size_t len;
+  size_t i;
+  uint32_t batchRows = MIGRATE_BATCH_ROWS;
+  uint64_t rows = 0;
+  uint64_t guessed = 0;
+  uint64_t skipped = 0;
+  uint64_t tags = 0;
+  int step;
+  int rc;
+
+  if (argc != 3 && !(argc == 5 && 0 == strcmp("--batch", argv[3])))
+  {
+    usage();
+  }
+  if (argc == 5 && 0 == (batchRows = strtoul(argv[4], NULL, 0)))
+  {
+    usage();
+  }
+  if (0 == strcmp(argv[1], argv[2]))
+  {
+    fprintf(stderr, "Old and new database must be different files\n");
+    return 1;
+  }
+
+  if (SQLITE_OK != sqlite3_open_v2(argv[1], &old, SQLITE_OPEN_READONLY, NULL))
+  {
+    fprintf(stderr, "Cannot open database: %s\n", sqlite3_errmsg(old));
+    sqlite3_close(old);
+    return 1;
+  }
+  if (hasColumn(old, "tag"))
+  {
+    fprintf(stderr, "%s already has the typed schema\n", argv[1]);
+    sqlite3_close(old);
+    return 1;
+  }
+  if (!hasColumn(old, "epc"))
+  {
+    fprintf(stderr, "%s has no ToP table with an epc column\n", argv[1]);
+    sqlite3_close(old);
+    return 1;
+  }
+
+  len = snprintf(sql, sizeof(sql), "SELECT epc");
+  for (i = 0; i < COLUMN_COUNT; i++)
+  {
+    bool present = hasColumn(old, columns[i]);
+    const char *missing = 0 == strcmp("read_count", columns[i]) ? "1" : "0";
+
+    len += snprintf(sql + len, sizeof(sql) - len, ", %s", present ? columns[i] : missing);
+  }
+  snprintf(sql + len, sizeof(sql) - len, " FROM ToP ORDER BY rowid;");
+  if (SQLITE_OK != sqlite3_prepare_v2(old, sql, -1, &select, NULL))
+  {
+    fprintf(stderr, "Error preparing sql statement: %s\n", sqlite3_errmsg(old));
+    sqlite3_close(old);
+    return 1;
+  }
+
+  /* No time limit on batches, only the row count */
+  if (SQLITE_OK != dbSinkOpen(&sink, argv[2], false, batchRows, UINT32_MAX))
+  {
+    sqlite3_finalize(select);
+    sqlite3_close(old);
+    return 1;
+  }
+
+  rc = SQLITE_OK;
+  step = SQLITE_ROW;
+  while (SQLITE_OK == rc && SQLITE_ROW == (step = sqlite3_step(select)))
+  {
+    ReadRecord rec;
+    bool guess;
+
+    memset(&rec, 0, sizeof(rec));
+    if (!oldEpc(select, 0, &rec, &guess))
+    {
+      skipped++;
+      continue;
+    }
+    guessed += guess;
+    rec.rssi = sqlite3_column_int(select, 1);
+    rec.phase = sqlite3_column_int(select, 2);
+    rec.frequency = sqlite3_column_int(select, 3);
+    rec.power = sqlite3_column_int(select, 4);
+    rec.antenna = sqlite3_column_int(select, 5);
+    rec.tsMs = (uint64_t)sqlite3_column_int64(select, 6) * 1000;
+    rec.readCount = sqlite3_column_int(select, 7);
+    rec.protocol = sqlite3_column_int(select, 8);
+    rc = dbSinkInsert(&sink, &rec);
+    rows++;
+  }
+  /* A read error ends the loop like the last row does */
+  if (SQLITE_OK == rc && SQLITE_DONE != step)
+  {
+    fprintf(stderr, "Error reading %s: %s\n", argv[1], sqlite3_errmsg(old));
+    rc = step;
+  }
+  if (SQLITE_OK == rc)
+  {
+    rc = dbSinkFlush(&sink);
+  }
+  sqlite3_finalize(select);
+  sqlite3_close(old);
+  if (SQLITE_OK != rc)
+  {
+    /* Batches already committed hold part of the table only: drop it all */
+    dbSinkRollback(&sink);
+    dbSinkClose(&sink);
+    remove(argv[2]);
+    fprintf(stderr, "Migration failed after %" PRIu64 " rows, %s removed\n", rows, argv[2]);
+    return 1;
+  }
+  if (SQLITE_OK == sqlite3_prepare_v2(sink.db, "SELECT count(*) FROM tags;", -1, &select, NULL))
+  {
+    if (SQLITE_ROW == sqlite3_step(select))
+    {
+      tags = sqlite3_column_int64(select, 0);
+    }
+    sqlite3_finalize(select);
+  }
+  dbSinkClose(&sink);
+
+  printf("Migrated %" PRIu64 " rows, %" PRIu64 " tags", rows, tags);
+  printf(", %" PRIu64 " skipped (not an EPC), %" PRIu64 " with leading zeros guessed\n", skipped, guessed);
+  return 0;
+}
@@ -0,0 +1,563 @@
+/**
+ * Batched SQLite sink for the ToP table.
+ * @file db_sink.c
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "db_sink.h"
+#include "time_util.h"
+
+#define DB_SINK_DROP \
+  "DROP VIEW IF EXISTS ToP_text;" \
+  "DROP VIEW IF EXISTS events_text;" \
+  "DROP TABLE IF EXISTS ToP;" \
+  "DROP TABLE IF EXISTS events;" \
+  "DROP TABLE IF EXISTS summaries;" \
+  "DROP TABLE IF EXISTS tags;" \
+  "DROP TABLE IF EXISTS sessions;"
+
+#define DB_SINK_SCHEMA \
+  DB_SESSION_SCHEMA \
+  "CREATE TABLE IF NOT EXISTS tags(id INTEGER PRIMARY KEY, epc BLOB NOT NULL UNIQUE);" \
+  "CREATE TABLE IF NOT EXISTS ToP(tag INTEGER NOT NULL REFERENCES tags(id), ts_ms INTEGER NOT NULL," \
+  " rssi INTEGER, phase INTEGER, freq INTEGER, pow INTEGER, ant INTEGER, read_count INTEGER, protocol INTEGER," \
+  " session INTEGER REFERENCES sessions(id));" \
+  "CREATE TABLE IF NOT EXISTS summaries(tag INTEGER NOT NULL REFERENCES tags(id), window_ms INTEGER NOT NULL," \
+  " first_ms INTEGER, last_ms INTEGER, reads INTEGER, read_count INTEGER, rssi_min INTEGER, rssi_max INTEGER," \
+  " rssi_mean REAL, antennas INTEGER, freq INTEGER, pow INTEGER, protocol INTEGER, session INTEGER REFERENCES sessions(id));" \
+  "CREATE TABLE IF NOT EXISTS events(tag INTEGER NOT NULL REFERENCES tags(id), ts_ms INTEGER NOT NULL," \
+  " kind INTEGER NOT NULL, antenna INTEGER, from_antenna INTEGER, rssi REAL, last_ms INTEGER," \
+  " session INTEGER REFERENCES sessions(id));"
+
+/* After the session column is known to exist */
+#define DB_SINK_VIEW \
+  "DROP VIEW IF EXISTS ToP_text;" \
+  "CREATE VIEW ToP_text AS SELECT hex(tags.epc) AS epc, rssi, phase, freq, pow, ant, ts_ms / 1000 AS ts," \
+  " read_count, protocol, session FROM ToP JOIN tags ON tags.id = ToP.tag;" \
+  "DROP VIEW IF EXISTS events_text;" \
+  "CREATE VIEW events_text AS SELECT hex(tags.epc) AS epc, ts_ms, CASE kind WHEN 0 THEN 'ARRIVE' WHEN 1 THEN 'DEPART'" \
+  " ELSE 'MOVE' END AS kind, antenna, from_antenna, rssi, last_ms, session FROM events JOIN tags ON tags.id = events.tag;"
+
+/* Built once on close: kept up to date per row it makes inserts 2-5x slower */
+#define DB_SINK_INDEX "CREATE INDEX IF NOT EXISTS ToP_tag_ts ON ToP(tag, ts_ms);" \
+                      "CREATE INDEX IF NOT EXISTS ToP_session_ts ON ToP(session, ts_ms);" \
+                      "CREATE INDEX IF NOT EXISTS summaries_tag_window ON summaries(tag, window_ms);" \
+                      "CREATE INDEX IF NOT EXISTS summaries_session_window ON summaries(session, window_ms);" \
+                      "CREATE INDEX IF NOT EXISTS events_tag_ts ON events(tag, ts_ms);" \
+                      "CREATE INDEX IF NOT EXISTS events_session_ts ON events(session, ts_ms);"
+
+/* Tags seen in a typical run; the cache grows past this as needed */
+#define DB_SINK_TAG_CACHE (1024)
+
+static int prepare(DbSink *sink, const char *sql, sqlite3_stmt **stmt)
+{
+  int rc = sqlite3_prepare_v2(sink->db, sql, -1, stmt, NULL);
+
+  if (rc != SQLITE_OK)
+  {
+    fprintf(stderr, "Error preparing sql statement: %s\n", sqlite3_errmsg(sink->db));
+  }
+  return rc;
+}
+
+static int exec(sqlite3 *db, const char *sql)
+{
+  char *err_msg = 0;
+  int rc;
+
+  rc = sqlite3_exec(db, sql, 0, 0, &err_msg);
+  if (rc != SQLITE_OK)
+  {
+    fprintf(stderr, "SQL error: %s\n", err_msg);
+    sqlite3_free(err_msg);
+  }
+  return rc;
+}
+
+/* Empty strings and -1 are stored as NULL */
+static void bindText(sqlite3_stmt *stmt, int index, const char *text)
+{
+  if ('\0' == text[0])
+  {
+    sqlite3_bind_null(stmt, index);
+  }
+  else
+  {
+    sqlite3_bind_text(stmt, index, text, -1, SQLITE_STATIC);
+  }
+}
+
+static void bindKnown(sqlite3_stmt *stmt, int index, int32_t value)
+{
+  if (value < 0)
+  {
+    sqlite3_bind_null(stmt, index);
+  }
+  else
+  {
+    sqlite3_bind_int(stmt, index, value);
+  }
+}
+
+static bool hasColumn(sqlite3 *db, const char *table, const char *column)
+{
+  sqlite3_stmt *stmt;
+  bool found = false;
+
+  if (SQLITE_OK == sqlite3_prepare_v2(db, "SELECT 1 FROM pragma_table_info(?) WHERE name = ?;", -1, &stmt, NULL))
+  {
+    sqlite3_bind_text(stmt, 1, table, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 2, column, -1, SQLITE_STATIC);
+    found = SQLITE_ROW == sqlite3_step(stmt);
+  }
+  sqlite3_finalize(stmt);
+  return found;
+}
+
+void dbSessionInit(DbSession *session, int argc, char *argv[])
+{
+  const char *slash = argc > 0 ? strrchr(argv[0], '/') : NULL;
+  size_t used = 0;
+  int i;
+
+  memset(session, 0, sizeof(*session));
+  session->startedMs = wallMs();
+  session->region = -1;
+  session->readPower = -1;
+  if (argc > 0)
+  {
+    snprintf(session->program, sizeof(session->program), "%s", NULL == slash ? argv[0] : slash + 1);
+  }
+  if (argc > 1)
+  {
+    snprintf(session->reader, sizeof(session->reader), "%s", argv[1]);
+  }
+  for (i = 0; i < argc && used < sizeof(session->config); i++)
+  {
+    used += snprintf(session->config + used, sizeof(session->config) - used, "%s%s", i ? " " : "", argv[i]);
+  }
+}
+
+int dbSessionBegin(sqlite3 *db, const DbSession *session, sqlite3_int64 *id)
+{
+  sqlite3_stmt *stmt;
+  int rc;
+
+  rc = sqlite3_prepare_v2(db, "INSERT INTO sessions(started_ms, program, reader, model, firmware, region, antennas,"
+                              " read_power, config) VALUES(?, ?, ?, ?, ?, ?, ?, ?, ?);", -1, &stmt, NULL);
+  if (rc != SQLITE_OK)
+  {
+    fprintf(stderr, "Error preparing sql statement: %s\n", sqlite3_errmsg(db));
+    return rc;
+  }
+  sqlite3_bind_int64(stmt, 1, (sqlite3_int64)session->startedMs);
+  bindText(stmt, 2, session->program);
+  bindText(stmt, 3, session->reader);
+  bindText(stmt, 4, session->model);
+  bindText(stmt, 5, session->firmware);
+  bindKnown(stmt, 6, session->region);
+  bindText(stmt, 7, session->antennas);
+  bindKnown(stmt, 8, session->readPower);
+  bindText(stmt, 9, session->config);
+  rc = sqlite3_step(stmt);
+  sqlite3_finalize(stmt);
+  if (rc != SQLITE_DONE)
+  {
+    fprintf(stderr, "Error adding session: %s\n", sqlite3_errmsg(db));
+    return rc;
+  }
+  *id = sqlite3_last_insert_rowid(db);
+  return SQLITE_OK;
+}
+
+int dbSessionEnd(sqlite3 *db, sqlite3_int64 id, uint64_t rows)
+{
+  sqlite3_stmt *stmt;
+  int rc;
+
+  rc = sqlite3_prepare_v2(db, "UPDATE sessions SET ended_ms = ?, rows = ? WHERE id = ?;", -1, &stmt, NULL);
+  if (rc != SQLITE_OK)
+  {
+    fprintf(stderr, "Error preparing sql statement: %s\n", sqlite3_errmsg(db));
+    return rc;
+  }
+  sqlite3_bind_int64(stmt, 1, (sqlite3_int64)wallMs());
+  sqlite3_bind_int64(stmt, 2, (sqlite3_int64)rows);
+  sqlite3_bind_int64(stmt, 3, id);
+  rc = sqlite3_step(stmt);
+  sqlite3_finalize(stmt);
+  if (rc != SQLITE_DONE)
+  {
+    fprintf(stderr, "Error ending session: %s\n", sqlite3_errmsg(db));
+    return rc;
+  }
+  return SQLITE_OK;
+}
+
+int dbSessionColumn(sqlite3 *db, const char *table)
+{
+  char *sql;
+  int rc;
+
+  if (hasColumn(db, table, "session"))
+  {
+    return SQLITE_OK;
+  }
+  sql = sqlite3_mprintf("ALTER TABLE \"%w\" ADD COLUMN session INTEGER REFERENCES sessions(id);", table);
+  if (NULL == sql)
+  {
+    return SQLITE_NOMEM;
+  }
+  rc = exec(db, sql);
+  sqlite3_free(sql);
+  return rc;
+}
+
+int dbSinkOpen(DbSink *sink, const char *path, bool append, uint32_t batchRows, uint32_t batchMs)
+{
+  int rc;
+
+  memset(sink, 0, sizeof(*sink));
+  sink->batchRows = batchRows ? batchRows : 1;
+  sink->batchMs = batchMs;
+
+  rc = sqlite3_open(path, &sink->db);
+  if (rc != SQLITE_OK)
+  {
+    fprintf(stderr, "Cannot open database: %s\n", sqlite3_errmsg(sink->db));
+    sqlite3_close(sink->db);
+    sink->db = NULL;
+    return rc;
+  }
+
+  /*
+   * WAL keeps readers out of the writer's way and, with synchronous=NORMAL,
+   * only syncs at checkpoints instead of on every commit.
+   */
+  rc = exec(sink->db, "PRAGMA journal_mode=WAL;"
+                      "PRAGMA synchronous=NORMAL;");
+  if (rc == SQLITE_OK && !append)
+  {
+    rc = exec(sink->db, DB_SINK_DROP);
+  }
+  if (rc == SQLITE_OK && hasColumn(sink->db, "ToP", "epc"))
+  {
+    fprintf(stderr, "%s has the old text ToP table, convert it with db_migrate before appending\n", path);
+    rc = SQLITE_MISMATCH;
+  }
+  if (rc == SQLITE_OK)
+  {
+    rc = exec(sink->db, DB_SINK_SCHEMA);
+  }
+  /* Databases from before sessions were recorded */
+  if (rc == SQLITE_OK)
+  {
+    rc = dbSessionColumn(sink->db, "ToP");
+  }
+  if (rc == SQLITE_OK)
+  {
+    rc = exec(sink->db, DB_SINK_VIEW);
+  }
+  if (rc == SQLITE_OK)
+  {
+    rc = prepare(sink, "INSERT INTO ToP(tag, ts_ms, rssi, phase, freq, pow, ant, read_count, protocol, session)"
+                       " VALUES(?, ?, ?, ?, ?, ?, ?, ?, ?, ?);", &sink->insert);
+  }
+  if (rc == SQLITE_OK)
+  {
+    rc = prepare(sink, "INSERT INTO summaries(tag, window_ms, first_ms, last_ms, reads, read_count, rssi_min, rssi_max,"
+                       " rssi_mean, antennas, freq, pow, protocol, session)"
+                       " VALUES(?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?);", &sink->insertSummary);
+  }
+  if (rc == SQLITE_OK)
+  {
+    rc = prepare(sink, "INSERT INTO events(tag, ts_ms, kind, antenna, from_antenna, rssi, last_ms, session)"
+                       " VALUES(?, ?, ?, ?, ?, ?, ?, ?);", &sink->insertEvent);
+  }
+  if (rc == SQLITE_OK)
+  {
+    rc = prepare(sink, "INSERT OR IGNORE INTO tags(epc) VALUES(?);", &sink->insertTag);
+  }
+  if (rc == SQLITE_OK)
+  {
+    rc = prepare(sink, "SELECT id FROM tags WHERE epc = ?;", &sink->findTag);
+  }
+  if (rc == SQLITE_OK && 0 != epcTableInit(&sink->tagIds, DB_SINK_TAG_CACHE, sizeof(sqlite3_int64)))
+  {
+    fprintf(stderr, "Cannot allocate tag id cache\n");
+    rc = SQLITE_NOMEM;
+  }
+  if (rc != SQLITE_OK)
+  {
+    sqlite3_finalize(sink->insert);
+    sqlite3_finalize(sink->insertSummary);
+    sqlite3_finalize(sink->insertEvent);
+    sqlite3_finalize(sink->insertTag);
+    sqlite3_finalize(sink->findTag);
+    sqlite3_close(sink->db);
+    memset(sink, 0, sizeof(*sink));
+  }
+  return rc;
+}
+
+int dbSinkBeginSession(DbSink *sink, const DbSession *session)
+{
+  int rc = dbSessionBegin(sink->db, session, &sink->session);
+
+  /* Bindings outlive sqlite3_reset(), so every later row gets the id */
+  if (rc == SQLITE_OK)
+  {
+    sqlite3_bind_int64(sink->insert, 10, sink->session);
+    sqlite3_bind_int64(sink->insertSummary, 14, sink->session);
+    sqlite3_bind_int64(sink->insertEvent, 8, sink->session);
+  }
+  return rc;
+}
+
+/* Id of the EPC in the tags dictionary, adding it the first time */
+static int tagId(DbSink *sink, const uint8_t *epc, uint8_t len, sqlite3_int64 *id)
+{
+  sqlite3_int64 *cached = NULL;
+  bool created = true;
+  int rc;
+
+  /* Longer EPCs share a cache key with others of the same first bytes */
+  if (len <= EPC_TABLE_KEY_MAX)
+  {
+    cached = epcTableInsert(&sink->tagIds, epc, len, &created);
+    if (NULL != cached && !created && 0 != *cached)
+    {
+      *id = *cached;
+      return SQLITE_OK;
+    }
+  }
+
+  sqlite3_bind_blob(sink->insertTag, 1, epc, len, SQLITE_STATIC);
+  rc = sqlite3_step(sink->insertTag);
+  sqlite3_reset(sink->insertTag);
+  if (rc != SQLITE_DONE)
+  {
+    fprintf(stderr, "Error adding tag: %s\n", sqlite3_errmsg(sink->db));
+    return rc;
+  }
+  if (sqlite3_changes(sink->db) > 0)
+  {
+    *id = sqlite3_last_insert_rowid(sink->db);
+  }
+  else
+  {
+    sqlite3_bind_blob(sink->findTag, 1, epc, len, SQLITE_STATIC);
+    rc = sqlite3_step(sink->findTag);
+    if (rc == SQLITE_ROW)
+    {
+      *id = sqlite3_column_int64(sink->findTag, 0);
+    }
+    sqlite3_reset(sink->findTag);
+    if (rc != SQLITE_ROW)
+    {
+      fprintf(stderr, "Error finding tag: %s\n", sqlite3_errmsg(sink->db));
+      return SQLITE_ERROR;
+    }
+  }
+  if (NULL != cached)
+  {
+    *cached = *id;
+  }
+  return SQLITE_OK;
+}
+
+/* Open a transaction before the first row of a batch */
+static int begin(DbSink *sink)
+{
+  int rc;
+
+  if (0 != sink->pending)
+  {
+    return SQLITE_OK;
+  }
+  rc = exec(sink->db, "BEGIN;");
+  if (rc == SQLITE_OK)
+  {
+    sink->txStartMs = monotonicMs();
+  }
+  return rc;
+}
+
+/* Run an INSERT, count the row and commit when the batch is full */
+static int stepRow(DbSink *sink, sqlite3_stmt *stmt)
+{
+  int rc = sqlite3_step(stmt);
+
+  sqlite3_reset(stmt);
+  if (rc != SQLITE_DONE)
+  {
+    fprintf(stderr, "Error inserting row: %s\n", sqlite3_errmsg(sink->db));
+    return rc;
+  }
+  sink->pending++;
+
+  if (sink->pending >= sink->batchRows)
+  {
+    return dbSinkFlush(sink);
+  }
+  return SQLITE_OK;
+}
+
+int dbSinkInsert(DbSink *sink, const ReadRecord *rec)
+{
+  sqlite3_int64 tag = 0;
+  int rc;
+
+  rc = begin(sink);
+  if (rc != SQLITE_OK)
+  {
+    return rc;
+  }
+
+  /* Inside the transaction, so a new tag commits with its first row */
+  rc = tagId(sink, rec->epc, rec->epcLen, &tag);
+  if (rc != SQLITE_OK)
+  {
+    return rc;
+  }
+  sqlite3_bind_int64(sink->insert, 1, tag);
+  sqlite3_bind_int64(sink->insert, 2, (sqlite3_int64)rec->tsMs);
+  sqlite3_bind_int (sink->insert, 3, rec->rssi);
+  sqlite3_bind_int (sink->insert, 4, rec->phase);
+  sqlite3_bind_int (sink->insert, 5, rec->frequency);
+  sqlite3_bind_int (sink->insert, 6, rec->power);
+  sqlite3_bind_int (sink->insert, 7, rec->antenna);
+  sqlite3_bind_int (sink->insert, 8, rec->readCount);
+  sqlite3_bind_int (sink->insert, 9, rec->protocol);
+  return stepRow(sink, sink->insert);
+}
+
+int dbSinkInsertSummary(DbSink *sink, const ReadSummary *sum)
+{
+  sqlite3_stmt *stmt = sink->insertSummary;
+  sqlite3_int64 tag = 0;
+  int rc;
+
+  rc = begin(sink);
+  if (rc != SQLITE_OK)
+  {
+    return rc;
+  }
+  rc = tagId(sink, sum->epc, sum->epcLen, &tag);
+  if (rc != SQLITE_OK)
+  {
+    return rc;
+  }
+  sqlite3_bind_int64(stmt, 1, tag);
+  sqlite3_bind_int64(stmt, 2, (sqlite3_int64)sum->windowMs);
+  sqlite3_bind_int64(stmt, 3, (sqlite3_int64)sum->firstMs);
+  sqlite3_bind_int64(stmt, 4, (sqlite3_int64)sum->lastMs);
+  sqlite3_bind_int (stmt, 5, sum->reads);
+  sqlite3_bind_int64(stmt, 6, sum->readCount);
+  sqlite3_bind_int (stmt, 7, sum->rssiMin);
+  sqlite3_bind_int (stmt, 8, sum->rssiMax);
+  sqlite3_bind_double(stmt, 9, sum->rssiMean);
+  sqlite3_bind_int64(stmt, 10, sum->antennas);
+  sqlite3_bind_int (stmt, 11, sum->frequency);
+  sqlite3_bind_int (stmt, 12, sum->power);
+  sqlite3_bind_int (stmt, 13, sum->protocol);
+  return stepRow(sink, stmt);
+}
+
+int dbSinkInsertEvent(DbSink *sink, const PresenceEvent *ev)
+{
+  sqlite3_stmt *stmt = sink->insertEvent;
+  sqlite3_int64 tag = 0;
+  int rc;
+
+  rc = begin(sink);
+  if (rc != SQLITE_OK)
+  {
+    return rc;
+  }
+  rc = tagId(sink, ev->epc, ev->epcLen, &tag);
+  if (rc != SQLITE_OK)
+  {
+    return rc;
+  }
+  sqlite3_bind_int64(stmt, 1, tag);
+  sqlite3_bind_int64(stmt, 2, (sqlite3_int64)ev->tsMs);
+  sqlite3_bind_int (stmt, 3, ev->kind);
+  sqlite3_bind_int (stmt, 4, ev->antenna);
+  if (PRESENCE_MOVE == ev->kind)
+  {
+    sqlite3_bind_int(stmt, 5, ev->fromAntenna);
+  }
+  else
+  {
+    sqlite3_bind_null(stmt, 5);
+  }
+  sqlite3_bind_double(stmt, 6, ev->rssi);
+  sqlite3_bind_int64(stmt, 7, (sqlite3_int64)ev->lastMs);
+  return stepRow(sink, stmt);
+}
+
+int dbSinkPoll(DbSink *sink)
+{
+  if (0 != sink->pending && monotonicMs() - sink->txStartMs >= sink->batchMs)
+  {
+    return dbSinkFlush(sink);
+  }
+  return SQLITE_OK;
+}
+
+int dbSinkFlush(DbSink *sink)
+{
+  int rc;
+
+  if (0 == sink->pending)
+  {
+    return SQLITE_OK;
+  }
+  rc = exec(sink->db, "COMMIT;");
+  if (rc == SQLITE_OK)
+  {
+    sink->rows += sink->pending;
+    sink->commits++;
+    sink->pending = 0;
+  }
+  return rc;
+}
+
+void dbSinkRollback(DbSink *sink)
+{
+  if (0 == sink->pending)
+  {
+    return;
+  }
+  exec(sink->db, "ROLLBACK;");
+  sink->pending = 0;
+}
+
+void dbSinkClose(DbSink *sink)
+{
+  if (NULL == sink->db)
+  {
+    return;
+  }
+  dbSinkFlush(sink);
+  if (0 != sink->session)
+  {
+    dbSessionEnd(sink->db, sink->session, sink->rows);
+  }
+  exec(sink->db, DB_SINK_INDEX);
+  sqlite3_finalize(sink->insert);
+  sqlite3_finalize(sink->insertSummary);
+  sqlite3_finalize(sink->insertEvent);
+  sqlite3_finalize(sink->insertTag);
+  sqlite3_finalize(sink->findTag);
+  sink->insert = NULL;
+  sink->insertSummary = NULL;
+  sink->insertEvent = NULL;
+  sink->insertTag = NULL;
+  sink->findTag = NULL;
+  epcTableFree(&sink->tagIds);
+  sqlite3_close(sink->db);
+  sink->db = NULL;
+}
@@ -0,0 +1,137 @@
+/**
+ * Batched SQLite sink for the ToP table.
+ *
+ * EPCs are stored once, as BLOBs, in a tags dictionary, and ToP rows refer
+ * to them by integer id, with integer columns and ms timestamps:
+ *   tags(id INTEGER PRIMARY KEY, epc BLOB NOT NULL UNIQUE)
+ *   ToP(tag, ts_ms, rssi, phase, freq, pow, ant, read_count, protocol, session)
+ *   sessions(id INTEGER PRIMARY KEY, started_ms, ended_ms, program, reader,
+ *            model, firmware, region, antennas, read_power, config, rows)
+ *   summaries(tag, window_ms, first_ms, last_ms, reads, read_count, rssi_min,
+ *             rssi_max, rssi_mean, antennas, freq, pow, protocol, session)
+ *   events(tag, ts_ms, kind, antenna, from_antenna, rssi, last_ms, session)
+ * ToP is appended to in arrival order; the (tag, ts_ms) index for queries
+ * by EPC and the (session, ts_ms) index for queries by run are built when
+ * the sink is closed, as are the matching indexes on summaries, which
+ * holds one row per tag and window when reads are aggregated (read_agg.h),
+ * and on events, the tag arrivals, moves and departures of presence.h
+ * (kind 0, 1, 2 for ARRIVE, DEPART, MOVE; events_text shows the names).
+ * The ToP_text view shows rows with hex EPCs and second timestamps, as
+ * the old text schema did.
+ *
+ * A sink opened for append keeps the tables it finds and adds to them, so
+ * one database can hold many runs, each with its sessions row. The indexes
+ * then already exist and are kept up to date per row, which makes inserts
+ * into a large database slower than into a fresh one.
+ *
+ * The INSERT statement is prepared once and rows are grouped into explicit
+ * transactions that are committed after a number of rows or after a time
+ * limit, whichever comes first. Tag ids are cached in memory, so the
+ * dictionary is only touched the first time a tag is seen.
+ * @file db_sink.h
+ */
+
+#ifndef _DB_SINK_H
+#define _DB_SINK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sqlite3.h>
+#include "epc_table.h"
+#include "read_record.h"
+
+#define DB_SINK_BATCH_ROWS (500)
+#define DB_SINK_BATCH_MS   (1000)
+
+/* Shared with programs that keep their own ToP, such as power_ramp */
+#define DB_SESSION_SCHEMA \
+  "CREATE TABLE IF NOT EXISTS sessions(id INTEGER PRIMARY KEY, started_ms INTEGER NOT NULL, ended_ms INTEGER," \
+  " program TEXT, reader TEXT, model TEXT, firmware TEXT, region INTEGER, antennas TEXT, read_power INTEGER," \
+  " config TEXT, rows INTEGER);"
+
+/* How a run was set up, recorded once per database it writes to */
+typedef struct DbSession
+{
+  uint64_t startedMs;   /* wall clock */
+  char program[32];
+  char reader[256];     /* URI */
+  char model[64];       /* as reported by the reader */
+  char firmware[64];
+  int32_t region;       /* TMR_Region, -1: not known */
+  char antennas[64];    /* e.g. "1,2" */
+  int32_t readPower;    /* cdBm, -1: not known */
+  char config[1024];    /* the full command line */
+} DbSession;
+
+typedef struct DbSink
+{
+  sqlite3 *db;
+  sqlite3_stmt *insert;
+  sqlite3_stmt *insertSummary;
+  sqlite3_stmt *insertEvent;
+  sqlite3_stmt *insertTag;
+  sqlite3_stmt *findTag;
+  EpcTable tagIds;      /* EPC -> tags.id */
+  uint32_t batchRows;   /* commit after this many rows ... */
+  uint32_t batchMs;     /* ... or this many ms after BEGIN */
+  uint32_t pending;     /* rows in the open transaction */
+  uint64_t txStartMs;
+  uint64_t rows;        /* rows committed so far */
+  uint64_t commits;
+  sqlite3_int64 session; /* sessions.id of new rows, 0: none */
+} DbSink;
+
+/**
+ * Start a session description from the command line: program, reader URI
+ * (argv[1]), config and the start time. The rest is filled in by the
+ * caller once the reader is connected.
+ */
+void dbSessionInit(DbSession *session, int argc, char *argv[]);
+
+/** Insert a sessions row and return its id. Returns SQLITE_OK on success. */
+int dbSessionBegin(sqlite3 *db, const DbSession *session, sqlite3_int64 *id);
+
+/** Record the end time and row count of a session. */
+int dbSessionEnd(sqlite3 *db, sqlite3_int64 id, uint64_t rows);
+
+/**
+ * Add the session column to a table created before sessions were
+ * recorded. Returns SQLITE_OK if the column is there.
+ */
+int dbSessionColumn(sqlite3 *db, const char *table);
+
+/**
+ * Open (or create) the database and prepare the statements. The tags,
+ * ToP and sessions tables are recreated, or with append kept and created
+ * only if missing. Returns SQLITE_OK on success.
+ */
+int dbSinkOpen(DbSink *sink, const char *path, bool append, uint32_t batchRows, uint32_t batchMs);
+
+/** Record a session; rows inserted from now on refer to it. */
+int dbSinkBeginSession(DbSink *sink, const DbSession *session);
+
+/** Queue one row; commits when the row limit is reached. */
+int dbSinkInsert(DbSink *sink, const ReadRecord *rec);
+
+/** Queue one summaries row, batched with the ToP rows. */
+int dbSinkInsertSummary(DbSink *sink, const ReadSummary *sum);
+
+/** Queue one events row, batched with the ToP rows. */
+int dbSinkInsertEvent(DbSink *sink, const PresenceEvent *ev);
+
+/** Commit the open transaction if it is older than batchMs. */
+int dbSinkPoll(DbSink *sink);
+
+/** Commit the open transaction, if any. */
+int dbSinkFlush(DbSink *sink);
+
+/** Drop the rows of the open transaction, if any. */
+void dbSinkRollback(DbSink *sink);
+
+/**
+ * Flush, end the session, build the query indexes, finalize the statements
+ * and close the database. Safe to call twice.
+ */
+void dbSinkClose(DbSink *sink);
+
+#endif /* _DB_SINK_H */
@@ -0,0 +1,210 @@
+/**
+ * Binary EPC matching against an allowlist of hex prefixes.
+ * @file epc_match.c
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "epc_match.h"
+
+static int hexNibble(char c)
+{
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  return -1;
+}
+
+int epcParseHex(const char *hex, uint8_t *bytes, size_t max)
+{
+  size_t nibbles = 0;
+
+  memset(bytes, 0, max);
+  for (; *hex; hex++)
+  {
+    int nibble = hexNibble(*hex);
+
+    if (nibble < 0 || nibbles >= 2 * max)
+    {
+      return -1;
+    }
+    bytes[nibbles / 2] |= (nibbles & 1) ? nibble : nibble << 4;
+    nibbles++;
+  }
+  return (int)nibbles;
+}
+
+int epcParse(const char *hex, EpcValue *value)
+{
+  int nibbles = epcParseHex(hex, value->bytes, EPC_MATCH_EPC_MAX);
+
+  if (nibbles <= 0 || (nibbles & 1))
+  {
+    value->len = 0;
+    return -1;
+  }
+  value->len = nibbles / 2;
+  return 0;
+}
+
+static int comparePrefix(const void *a, const void *b)
+{
+  const EpcPrefix *pa = a;
+  const EpcPrefix *pb = b;
+
+  if (pa->nibbles != pb->nibbles)
+  {
+    return (int)pa->nibbles - (int)pb->nibbles;
+  }
+  return memcmp(pa->bytes, pb->bytes, (pa->nibbles + 1) / 2);
+}
+
+void epcPrefixSetInit(EpcPrefixSet *set)
+{
+  memset(set, 0, sizeof(*set));
+  set->matchAll = true;
+}
+
+int epcPrefixSetLoad(EpcPrefixSet *set, const char *file)
+{
+  FILE *fp;
+  char *line = NULL;
+  size_t len = 0;
+  uint32_t max = 0;
+  uint32_t i;
+
+  epcPrefixSetInit(set);
+  fp = fopen(file, "r");
+  if (NULL == fp)
+  {
+    return -1;
+  }
+  set->matchAll = false;
+
+  while (-1 != getline(&line, &len, fp))
+  {
+    EpcPrefix prefix;
+    int nibbles;
+
+    line[strcspn(line, "\r\n")] = 0;
+    if ('\0' == line[0] || '#' == line[0])
+    {
+      continue;
+    }
+    nibbles = epcParseHex(line, prefix.bytes, EPC_PREFIX_MAX);
+    if (nibbles < 0)
+    {
+      fprintf(stderr, "Ignoring tag prefix '%s': not a hex EPC prefix\n", line);
+      continue;
+    }
+    prefix.nibbles = nibbles;
+
+    if (set->count == max)
+    {
+      EpcPrefix *grown;
+
+      max = max ? 2 * max : 256;
+      grown = realloc(set->prefixes, (size_t)max * sizeof(EpcPrefix));
+      if (NULL == grown)
+      {
+        free(line);
+        fclose(fp);
+        return -1;
+      }
+      set->prefixes = grown;
+    }
+    set->prefixes[set->count++] = prefix;
+  }
+  free(line);
+  fclose(fp);
+
+  qsort(set->prefixes, set->count, sizeof(EpcPrefix), comparePrefix);
+  for (i = 0; i < set->count; i++)
+  {
+    EpcPrefixGroup *g = set->groupCount ? &set->groups[set->groupCount - 1] : NULL;
+
+    if (NULL == g || g->nibbles != set->prefixes[i].nibbles)
+    {
+      g = &set->groups[set->groupCount++];
+      g->nibbles = set->prefixes[i].nibbles;
+      g->start = i;
+      g->count = 0;
+    }
+    g->count++;
+  }
+  return 0;
+}
+
+uint32_t epcPrefixSetCount(const EpcPrefixSet *set, uint32_t minNibbles)
+{
+  uint32_t count = 0;
+  uint32_t g;
+
+  for (g = 0; g < set->groupCount; g++)
+  {
+    if (set->groups[g].nibbles >= minNibbles)
+    {
+      count += set->groups[g].count;
+    }
+  }
+  return count;
+}
+
+void epcPrefixSetFree(EpcPrefixSet *set)
+{
+  free(set->prefixes);
+  set->prefixes = NULL;
+  set->count = 0;
+  set->groupCount = 0;
+}
+
+bool epcPrefixSetMatch(const EpcPrefixSet *set, const uint8_t *epc, uint8_t epcLen)
+{
+  uint32_t g;
+
+  if (set->matchAll)
+  {
+    return true;
+  }
+  for (g = 0; g < set->groupCount; g++)
+  {
+    const EpcPrefixGroup *group = &set->groups[g];
+    const EpcPrefix *base = set->prefixes + group->start;
+    uint8_t key[EPC_PREFIX_MAX];
+    uint32_t keyLen = (group->nibbles + 1) / 2;
+    uint32_t lo = 0;
+    uint32_t hi = group->count;
+
+    if (group->nibbles > 2 * epcLen)
+    {
+      /* Groups are sorted by length, no longer prefix can match either */
+      break;
+    }
+    memcpy(key, epc, keyLen);
+    if (group->nibbles & 1)
+    {
+      key[keyLen - 1] &= 0xF0;
+    }
+
+    while (lo < hi)
+    {
+      uint32_t mid = lo + (hi - lo) / 2;
+      int cmp = memcmp(base[mid].bytes, key, keyLen);
+
+      if (0 == cmp)
+      {
+        return true;
+      }
+      if (cmp < 0)
+      {
+        lo = mid + 1;
+      }
+      else
+      {
+        hi = mid;
+      }
+    }
+  }
+  return false;
+}
@@ -0,0 +1,89 @@
+/**
+ * Binary EPC matching against an allowlist of hex prefixes.
+ *
+ * Prefixes are parsed once into left-aligned byte arrays, grouped by
+ * length (in nibbles) and sorted, so a lookup is one binary search per
+ * distinct prefix length, comparing raw EPC bytes only.
+ * @file epc_match.h
+ */
+
+#ifndef _EPC_MATCH_H
+#define _EPC_MATCH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+/* Longest prefix accepted: 32 bytes, i.e. 64 hex digits */
+#define EPC_PREFIX_MAX (32)
+/* Same as TMR_MAX_EPC_BYTE_COUNT */
+#define EPC_MATCH_EPC_MAX (62)
+/* A 96-bit EPC, the shortest in common use; shorter lines are prefixes */
+#define EPC_MATCH_FULL_NIBBLES (24)
+
+/** A complete EPC to match exactly, e.g. a sweep target. */
+typedef struct EpcValue
+{
+  uint8_t len;
+  uint8_t bytes[EPC_MATCH_EPC_MAX];
+} EpcValue;
+
+typedef struct EpcPrefix
+{
+  uint8_t nibbles;
+  uint8_t bytes[EPC_PREFIX_MAX];  /* unused trailing nibbles are zero */
+} EpcPrefix;
+
+typedef struct EpcPrefixGroup
+{
+  uint8_t nibbles;
+  uint32_t start;
+  uint32_t count;
+} EpcPrefixGroup;
+
+typedef struct EpcPrefixSet
+{
+  bool matchAll;          /* no allowlist given */
+  uint32_t count;
+  EpcPrefix *prefixes;    /* sorted by length, then bytes */
+  uint32_t groupCount;
+  EpcPrefixGroup groups[2 * EPC_PREFIX_MAX + 1];
+} EpcPrefixSet;
+
+/**
+ * Parse up to max bytes of hex into bytes, returning the number of nibbles
+ * or -1 if the string isn't hex or is too long. An odd last nibble is left
+ * aligned.
+ */
+int epcParseHex(const char *hex, uint8_t *bytes, size_t max);
+
+/**
+ * Parse a full hex EPC (whole bytes only). Returns 0, or -1 if invalid.
+ */
+int epcParse(const char *hex, EpcValue *value);
+
+/** True if the EPC read is exactly value. */
+static inline bool epcEqual(const EpcValue *value, const uint8_t *epc, uint8_t epcLen)
+{
+  return value->len == epcLen && 0 == memcmp(value->bytes, epc, epcLen);
+}
+
+/** Allowlist that accepts every EPC. */
+void epcPrefixSetInit(EpcPrefixSet *set);
+
+/**
+ * Load one hex prefix per line; blank lines and lines starting with '#'
+ * are ignored. Returns 0 on success, -1 if the file can't be read.
+ */
+int epcPrefixSetLoad(EpcPrefixSet *set, const char *file);
+
+void epcPrefixSetFree(EpcPrefixSet *set);
+
+/** Number of prefixes at least minNibbles long, e.g. whole EPCs rather than ranges. */
+uint32_t epcPrefixSetCount(const EpcPrefixSet *set, uint32_t minNibbles);
+
+/** True if the EPC starts with any prefix of the set. */
+bool epcPrefixSetMatch(const EpcPrefixSet *set, const uint8_t *epc, uint8_t epcLen);
+
+#endif /* _EPC_MATCH_H */
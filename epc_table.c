@@ -0,0 +1,194 @@
+/**
+ * Open-addressing hash table keyed by binary EPC.
+ * @file epc_table.c
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "epc_table.h"
+
+#define SLOT(t, i) ((EpcKey *)((t)->slots + (size_t)(i) * (t)->stride))
+#define VALUE(k) ((void *)((uint8_t *)(k) + sizeof(EpcKey)))
+
+static uint32_t hashEpc(const uint8_t *epc, uint8_t len)
+{
+  /* FNV-1a */
+  uint32_t h = 2166136261u;
+  uint8_t i;
+
+  for (i = 0; i < len; i++)
+  {
+    h ^= epc[i];
+    h *= 16777619u;
+  }
+  return h;
+}
+
+static uint8_t keyLen(uint8_t len)
+{
+  return len < EPC_TABLE_KEY_MAX ? len : EPC_TABLE_KEY_MAX;
+}
+
+static EpcKey *probe(EpcTable *t, uint32_t hash, const uint8_t *epc, uint8_t len)
+{
+  uint32_t i = hash & t->mask;
+  uint8_t klen = keyLen(len);
+
+  for (;;)
+  {
+    EpcKey *k = SLOT(t, i);
+
+    if (!k->used || (k->hash == hash && k->len == len && 0 == memcmp(k->epc, epc, klen)))
+    {
+      return k;
+    }
+    i = (i + 1) & t->mask;
+  }
+}
+
+static int allocate(EpcTable *t, uint32_t size)
+{
+  t->slots = calloc(size, t->stride);
+  if (NULL == t->slots)
+  {
+    return -1;
+  }
+  t->mask = size - 1;
+  t->count = 0;
+  return 0;
+}
+
+static int grow(EpcTable *t)
+{
+  EpcTable old = *t;
+  uint32_t i;
+
+  if (0 != allocate(t, (old.mask + 1) * 2))
+  {
+    *t = old;
+    return -1;
+  }
+  for (i = 0; i <= old.mask; i++)
+  {
+    EpcKey *k = SLOT(&old, i);
+
+    if (k->used)
+    {
+      EpcKey *dst = probe(t, k->hash, k->epc, k->len);
+
+      memcpy(dst, k, t->stride);
+      t->count++;
+    }
+  }
+  free(old.slots);
+  return 0;
+}
+
+int epcTableInit(EpcTable *t, uint32_t capacity, size_t valueSize)
+{
+  uint32_t size = 16;
+
+  while (size < capacity + capacity / 2)
+  {
+    size <<= 1;
+  }
+  t->valueSize = valueSize;
+  t->stride = (sizeof(EpcKey) + valueSize + 7) & ~(size_t)7;
+  return allocate(t, size);
+}
+
+void epcTableFree(EpcTable *t)
+{
+  free(t->slots);
+  t->slots = NULL;
+}
+
+void *epcTableFind(EpcTable *t, const uint8_t *epc, uint8_t len)
+{
+  EpcKey *k = probe(t, hashEpc(epc, keyLen(len)), epc, len);
+
+  return k->used ? VALUE(k) : NULL;
+}
+
+void *epcTableInsert(EpcTable *t, const uint8_t *epc, uint8_t len, bool *created)
+{
+  uint32_t hash = hashEpc(epc, keyLen(len));
+  EpcKey *k = probe(t, hash, epc, len);
+
+  if (k->used)
+  {
+    *created = false;
+    return VALUE(k);
+  }
+
+  /* Keep the load factor under 70% */
+  if ((t->count + 1) * 10 > (t->mask + 1) * 7)
+  {
+    if (0 != grow(t))
+    {
+      return NULL;
+    }
+    k = probe(t, hash, epc, len);
+  }
+
+  memset(k, 0, t->stride);
+  k->used = 1;
+  k->hash = hash;
+  k->len = len;
+  memcpy(k->epc, epc, keyLen(len));
+  t->count++;
+  *created = true;
+  return VALUE(k);
+}
+
+void epcTableRemove(EpcTable *t, void *value)
+{
+  uint32_t hole = (uint32_t)(((uint8_t *)value - sizeof(EpcKey) - t->slots) / t->stride);
+  uint32_t i = hole;
+
+  /* Backward shift: pull later entries of the run into the hole, unless that would put them before their home slot */
+  for (;;)
+  {
+    EpcKey *k;
+
+    i = (i + 1) & t->mask;
+    k = SLOT(t, i);
+    if (!k->used)
+    {
+      break;
+    }
+    if (((i - (k->hash & t->mask)) & t->mask) >= ((i - hole) & t->mask))
+    {
+      memcpy(SLOT(t, hole), k, t->stride);
+      hole = i;
+    }
+  }
+  memset(SLOT(t, hole), 0, t->stride);
+  t->count--;
+}
+
+const EpcKey *epcTableKey(const EpcTable *t, const void *value)
+{
+  return (const EpcKey *)((const uint8_t *)value - sizeof(EpcKey));
+}
+
+void *epcTableNext(EpcTable *t, uint32_t *pos)
+{
+  while (*pos <= t->mask)
+  {
+    EpcKey *k = SLOT(t, *pos);
+
+    (*pos)++;
+    if (k->used)
+    {
+      return VALUE(k);
+    }
+  }
+  return NULL;
+}
+
+void epcTableClear(EpcTable *t)
+{
+  memset(t->slots, 0, (size_t)(t->mask + 1) * t->stride);
+  t->count = 0;
+}
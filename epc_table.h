@@ -0,0 +1,67 @@
+/**
+ * Open-addressing hash table keyed by binary EPC.
+ *
+ * Entries are fixed-size and stored inline (key followed by a caller
+ * defined value), so a lookup touches one or two cache lines. EPCs longer
+ * than EPC_TABLE_KEY_MAX bytes are keyed by their first EPC_TABLE_KEY_MAX
+ * bytes and their length.
+ * @file epc_table.h
+ */
+
+#ifndef _EPC_TABLE_H
+#define _EPC_TABLE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define EPC_TABLE_KEY_MAX (32)
+
+typedef struct EpcKey
+{
+  uint32_t hash;
+  uint8_t used;
+  uint8_t len;
+  uint8_t epc[EPC_TABLE_KEY_MAX];
+} EpcKey;
+
+typedef struct EpcTable
+{
+  uint8_t *slots;
+  size_t stride;        /* sizeof(EpcKey) + value size, rounded up */
+  size_t valueSize;
+  uint32_t mask;
+  uint32_t count;
+} EpcTable;
+
+int epcTableInit(EpcTable *t, uint32_t capacity, size_t valueSize);
+void epcTableFree(EpcTable *t);
+
+/** Value of the entry for this EPC, or NULL. */
+void *epcTableFind(EpcTable *t, const uint8_t *epc, uint8_t len);
+
+/**
+ * Value of the entry for this EPC, creating a zeroed one if needed
+ * (*created tells which). Returns NULL if the table can't grow.
+ * Pointers previously returned are invalidated when the table grows.
+ */
+void *epcTableInsert(EpcTable *t, const uint8_t *epc, uint8_t len, bool *created);
+
+/**
+ * Remove the entry owning a value returned by find/insert. Entries after
+ * it in its probe run move back, so this too invalidates pointers.
+ */
+void epcTableRemove(EpcTable *t, void *value);
+
+/** Key of the entry owning a value returned by find/insert. */
+const EpcKey *epcTableKey(const EpcTable *t, const void *value);
+
+/**
+ * Iterate: start with *pos = 0, returns the next value or NULL at the end.
+ */
+void *epcTableNext(EpcTable *t, uint32_t *pos);
+
+/** Remove every entry, keeping the allocation. */
+void epcTableClear(EpcTable *t);
+
+#endif /* _EPC_TABLE_H */
@@ -0,0 +1,204 @@
+/**
+ * Low-overhead counters and histograms for the read path.
+ * @file hot_stats.c
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "hot_stats.h"
+#include "time_util.h"
+
+/* How often the exporter thread checks whether it should stop */
+#define HOT_POLL_MS (100)
+
+uint64_t hotNowNs(void)
+{
+  return monotonicNs();
+}
+
+/* Smallest value falling in bucket i */
+static uint64_t bucketLow(uint32_t i)
+{
+  uint32_t shift;
+
+  if (i < HOT_SUB)
+  {
+    return i;
+  }
+  shift = i / HOT_SUB - 1;
+  return (uint64_t)(HOT_SUB + i % HOT_SUB) << shift;
+}
+
+static uint64_t bucketHigh(uint32_t i)
+{
+  return i < HOT_SUB ? i : bucketLow(i) + ((uint64_t)1 << (i / HOT_SUB - 1)) - 1;
+}
+
+uint64_t hotQuantile(HotHistogram *h, double q)
+{
+  uint64_t counts[HOT_BUCKETS];
+  uint64_t total = 0;
+  uint64_t rank;
+  uint64_t seen = 0;
+  uint64_t max = atomic_load_explicit(&h->max, memory_order_relaxed);
+  uint32_t i;
+
+  for (i = 0; i < HOT_BUCKETS; i++)
+  {
+    counts[i] = atomic_load_explicit(&h->buckets[i], memory_order_relaxed);
+    total += counts[i];
+  }
+  if (0 == total)
+  {
+    return 0;
+  }
+  rank = (uint64_t)(q * total + 0.5);
+  if (rank < 1)
+  {
+    rank = 1;
+  }
+  for (i = 0; i < HOT_BUCKETS; i++)
+  {
+    seen += counts[i];
+    if (seen >= rank)
+    {
+      break;
+    }
+  }
+  return bucketHigh(i) < max ? bucketHigh(i) : max;
+}
+
+void hotWriteCounter(FILE *fp, const char *name, const char *help, uint64_t value)
+{
+  fprintf(fp, "# HELP %s %s\n# TYPE %s counter\n%s %" PRIu64 "\n", name, help, name, name, value);
+}
+
+void hotWriteGauge(FILE *fp, const char *name, const char *help, double value)
+{
+  fprintf(fp, "# HELP %s %s\n# TYPE %s gauge\n%s %.9g\n", name, help, name, name, value);
+}
+
+void hotWriteHistogram(FILE *fp, const char *name, const char *help, HotHistogram *h,
+                       double scale, uint32_t minShift, uint32_t maxShift)
+{
+  uint64_t cumulative = 0;
+  uint32_t i = 0;
+  uint32_t shift;
+
+  fprintf(fp, "# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+  for (shift = minShift; shift <= maxShift && shift < 64; shift++)
+  {
+    uint32_t end = hotIndex((uint64_t)1 << shift);
+
+    for (; i < end; i++)
+    {
+      cumulative += atomic_load_explicit(&h->buckets[i], memory_order_relaxed);
+    }
+    /* Values are whole units, so below 2^shift is at most 2^shift - 1 */
+    fprintf(fp, "%s_bucket{le=\"%.9g\"} %" PRIu64 "\n", name, (double)(((uint64_t)1 << shift) - 1) * scale, cumulative);
+  }
+  for (; i < HOT_BUCKETS; i++)
+  {
+    cumulative += atomic_load_explicit(&h->buckets[i], memory_order_relaxed);
+  }
+  /* _count is taken from the buckets so it always matches +Inf */
+  fprintf(fp, "%s_bucket{le=\"+Inf\"} %" PRIu64 "\n", name, cumulative);
+  fprintf(fp, "%s_sum %.9g\n", name, atomic_load_explicit(&h->sum, memory_order_relaxed) * scale);
+  fprintf(fp, "%s_count %" PRIu64 "\n", name, cumulative);
+}
+
+int hotExportNow(HotExporter *e)
+{
+  FILE *fp = fopen(e->tmpPath, "w");
+  int rc = 0;
+
+  if (NULL == fp)
+  {
+    rc = -1;
+  }
+  else
+  {
+    e->write(fp, e->cookie);
+    if (0 != ferror(fp))
+    {
+      rc = -1;
+    }
+    if (0 != fclose(fp))
+    {
+      rc = -1;
+    }
+    if (0 == rc && 0 != rename(e->tmpPath, e->path))
+    {
+      rc = -1;
+    }
+  }
+  if (0 != rc && !e->warned)
+  {
+    fprintf(stderr, "Cannot write stats file %s: %s\n", e->path, strerror(errno));
+    e->warned = true;
+  }
+  if (0 == rc)
+  {
+    e->exports++;
+  }
+  return rc;
+}
+
+static void *exportMain(void *arg)
+{
+  HotExporter *e = arg;
+  struct timespec poll = { 0, HOT_POLL_MS * 1000000L };
+  uint64_t next = hotNowNs() + (uint64_t)e->periodMs * 1000000;
+
+  while (atomic_load(&e->running))
+  {
+    if (hotNowNs() >= next)
+    {
+      hotExportNow(e);
+      next += (uint64_t)e->periodMs * 1000000;
+    }
+    nanosleep(&poll, NULL);
+  }
+  return NULL;
+}
+
+int hotExporterStart(HotExporter *e, const char *dir, const char *name, uint32_t periodMs,
+                     HotWriteFn write, void *cookie)
+{
+  memset(e, 0, sizeof(*e));
+  if ((size_t)snprintf(e->path, sizeof(e->path), "%s/%s", dir, name) >= sizeof(e->path))
+  {
+    return -1;
+  }
+  /* The textfile collector only reads *.prom, so it skips the temporary */
+  snprintf(e->tmpPath, sizeof(e->tmpPath), "%s.tmp", e->path);
+  e->periodMs = periodMs ? periodMs : HOT_EXPORT_MS;
+  e->write = write;
+  e->cookie = cookie;
+  if (0 != hotExportNow(e))
+  {
+    return -1;
+  }
+  atomic_store(&e->running, true);
+  if (0 != pthread_create(&e->thread, NULL, exportMain, e))
+  {
+    return -1;
+  }
+  e->started = true;
+  return 0;
+}
+
+void hotExporterStop(HotExporter *e)
+{
+  if (!e->started)
+  {
+    return;
+  }
+  atomic_store(&e->running, false);
+  pthread_join(e->thread, NULL);
+  e->started = false;
+  hotExportNow(e);
+}
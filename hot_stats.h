@@ -0,0 +1,121 @@
+/**
+ * Low-overhead counters and histograms for the read path, exported as a
+ * Prometheus text file.
+ *
+ * Histograms are log-linear, HDR style: values below 8 get a bucket each,
+ * above that every power of two is split into 8 buckets, so any value is
+ * known to within 12.5% over the full 64-bit range. Recording is a bucket
+ * index from the leading zero count and a few relaxed atomic stores; each
+ * histogram and counter has a single writer thread, so no locked
+ * instructions are needed, and any thread may read them.
+ *
+ * The exporter thread rewrites one file every period, through a temporary
+ * file and rename(), so a node_exporter textfile collector pointed at the
+ * directory never sees a partial file.
+ * @file hot_stats.h
+ */
+
+#ifndef _HOT_STATS_H
+#define _HOT_STATS_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define HOT_SUB_BITS (3)
+#define HOT_SUB (1 << HOT_SUB_BITS)
+#define HOT_BUCKETS ((64 - HOT_SUB_BITS + 1) * HOT_SUB)
+
+#define HOT_EXPORT_MS (10000)
+
+typedef _Atomic uint64_t HotCounter;
+
+typedef struct HotHistogram
+{
+  HotCounter count;
+  HotCounter sum;
+  HotCounter max;
+  HotCounter buckets[HOT_BUCKETS];
+} HotHistogram;
+
+/* Writes the metrics of one export; cookie is the one given to the exporter */
+typedef void (*HotWriteFn)(FILE *fp, void *cookie);
+
+typedef struct HotExporter
+{
+  char path[512];
+  char tmpPath[520];
+  uint32_t periodMs;
+  HotWriteFn write;
+  void *cookie;
+  atomic_bool running;
+  bool started;
+  bool warned;          /* a failed write was reported already */
+  pthread_t thread;
+  uint64_t exports;
+} HotExporter;
+
+/** Monotonic clock in nanoseconds. */
+uint64_t hotNowNs(void);
+
+/** Single writer only: add n without a locked instruction. */
+static inline void hotAdd(HotCounter *c, uint64_t n)
+{
+  atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+static inline uint32_t hotIndex(uint64_t v)
+{
+  uint32_t shift;
+
+  if (v < HOT_SUB)
+  {
+    return (uint32_t)v;
+  }
+  shift = 63 - __builtin_clzll(v) - HOT_SUB_BITS;
+  return (shift + 1) * HOT_SUB + (uint32_t)((v >> shift) & (HOT_SUB - 1));
+}
+
+/** Single writer only. */
+static inline void hotRecord(HotHistogram *h, uint64_t v)
+{
+  hotAdd(&h->buckets[hotIndex(v)], 1);
+  hotAdd(&h->count, 1);
+  hotAdd(&h->sum, v);
+  if (v > atomic_load_explicit(&h->max, memory_order_relaxed))
+  {
+    atomic_store_explicit(&h->max, v, memory_order_relaxed);
+  }
+}
+
+/** Highest value in the bucket holding quantile q (0 to 1), or 0 if empty. */
+uint64_t hotQuantile(HotHistogram *h, double q);
+
+/** Plain counter or gauge, with its HELP and TYPE lines. */
+void hotWriteCounter(FILE *fp, const char *name, const char *help, uint64_t value);
+void hotWriteGauge(FILE *fp, const char *name, const char *help, double value);
+
+/**
+ * Prometheus histogram with buckets up to 2^minShift - 1 .. 2^maxShift - 1
+ * recorded units inclusive, multiplied by scale on output (e.g. 1e-9 for
+ * ns to seconds).
+ */
+void hotWriteHistogram(FILE *fp, const char *name, const char *help, HotHistogram *h,
+                       double scale, uint32_t minShift, uint32_t maxShift);
+
+/**
+ * Start a thread that writes dir/name every periodMs through write().
+ * Returns 0 or -1.
+ */
+int hotExporterStart(HotExporter *e, const char *dir, const char *name, uint32_t periodMs,
+                     HotWriteFn write, void *cookie);
+
+/** Write the file now, from any thread. Returns 0 or -1. */
+int hotExportNow(HotExporter *e);
+
+/** Stop the thread after one last export. Safe to call twice. */
+void hotExporterStop(HotExporter *e);
+
+#endif /* _HOT_STATS_H */
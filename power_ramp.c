@@ -1,10 +1,11 @@
 /**
- * Sample program that reads tags for a fixed period of time (500ms)
- * and prints the tags found.
- * @file read.c
+ * Frequency/power sweep that finds, at every frequency, the lowest read
+ * power at which each of a list of target tags responds.
+ * @file power_ramp.c
  */
 
 #include <tm_reader.h>
+#include "sim_reader.h"
 #include <time.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -12,6 +13,11 @@
 #include <string.h>
 #include <inttypes.h>
 #include <sqlite3.h>
+#include "db_sink.h"
+#include "epc_match.h"
+#include "epc_table.h"
+#include "rotate.h"
+#include "time_util.h"
 #ifdef TMR_ENABLE_HF_LF
 #include <tmr_utils.h>
 #endif /* TMR_ENABLE_HF_LF */
@@ -30,13 +36,125 @@
 #define numberof(x) (sizeof((x))/sizeof((x)[0]))
 
 #define usage() {errx(1, "Please provide valid reader URL, such as: reader-uri [--ant n] [--pow read_power]\n"\
-                         "reader-uri : e.g., 'tmr:///COM1' or 'tmr:///dev/ttyS0/' or 'tmr://readerIP'\n"\
+                         "reader-uri : e.g., 'tmr:///COM1' or 'tmr:///dev/ttyS0/' or 'tmr://readerIP' or 'sim://?tags=50&rate=2000' (simulated)\n"\
                          "[--ant n] : e.g., '--ant 1'\n"\
-                         "[--epc epc] : e.g., '--epc E20063993234ADF11A586EB7'\n"\
+                         "[--epc epc[,epc...]] : e.g., '--epc E20063993234ADF11A586EB7,E200493F3185AD7126ACF6B5'\n"\
+                         "[--epcs file_name] : e.g., '--epcs wristband1 (one EPC per line)'\n"\
+                         "[--file file_name] : e.g., '--file sweep.db' or '--file sweeps/' (a new sweep-<UTC time>.db per run)\n"\
+                         "[--append 0|1] : e.g., '--append 1' (add to --file and its sessions table instead of recreating it)\n"\
                          "[--pow read_power] : e.g, '--pow 2300'\n"\
+                         "[--minfreq kHz] [--maxfreq kHz] [--freqstep MHz] [--minpow cdBm] [--maxpow cdBm] [--powstep cdBm]\n"\
+                         "[--mode linear|bisect|band] : e.g., '--mode bisect (binary search for the threshold)'\n"\
+                         "[--dwell ms] [--cycle ms] : band mode time per power level (default: hop time per channel) and per read (default 100)\n"\
+                         "[--maxdwell ms] [--settle ms] : longest read per step (default 500) and pause after each step (default 500, 0 for none)\n"\
+                         "[--confirm k/m] : e.g., '--confirm 2/3 (seen in k of m reads counts as a response; linear and bisect modes)'\n"\
                          "Example for UHF modules: 'tmr:///com4' or 'tmr:///com4 --ant 1,2' or 'tmr:///com4 --ant 1,2 --pow 2300'\n"\
                          "Example for HF/LF modules: 'tmr:///com4' \n");}
 
+/* Row stored for targets that never responded at a frequency */
+#define NOT_FOUND_RSSI (-99)
+#define NOT_FOUND_POW (3200)
+#define READPOWER_UNSET (-12345)
+
+/**
+ * Read cycle for every mode. A step repeats cycles until the targets it
+ * waits for have all been seen or the maximum dwell has passed; in band
+ * mode the cycle is also kept under the hop time so a read is on one
+ * channel.
+ */
+#define READ_CYCLE_MS (100)
+#define MAX_DWELL_MS (500)
+#define SETTLE_MS (500)
+/* Used for the band dwell if the reader does not report its hop time */
+#define BAND_HOP_MS (400)
+
+typedef enum SweepMode
+{
+  SWEEP_LINEAR,
+  SWEEP_BISECT,
+  SWEEP_BAND,
+} SweepMode;
+
+/* Where the sweep spends its time, in microseconds */
+typedef struct SweepTiming
+{
+  uint64_t startUs;
+  uint64_t readUs;      /* TMR_read and fetching the tags */
+  uint64_t configUs;    /* setting power and hop table */
+  uint64_t settleUs;
+  uint64_t storeUs;     /* database rows */
+  uint64_t steps;       /* dwells at one power */
+  uint64_t earlyExits;  /* steps ended before the maximum dwell */
+  uint64_t stepUs;
+  uint64_t maxStepUs;
+} SweepTiming;
+
+/* Last metadata seen for a target */
+typedef struct SweepHit
+{
+  int32_t rssi;
+  int32_t phase;
+} SweepHit;
+
+/**
+ * Targets of the sweep and their per-frequency state. Targets are
+ * numbered in the order given and tracked with bitsets, so the ramp at a
+ * frequency can stop as soon as every one of them has responded.
+ */
+typedef struct Sweep
+{
+  TMR_Reader *rp;
+  SweepMode mode;
+  int minPow;
+  int maxPow;
+  int powStep;
+  uint32_t levels;      /* power levels from minPow to maxPow */
+  uint32_t confirmK;    /* a target responds at a power if seen in */
+  uint32_t confirmM;    /* confirmK out of up to confirmM reads */
+  uint64_t reads;
+  uint32_t cycleMs;
+  uint32_t maxDwellMs;
+  uint32_t settleMs;
+  int curPow;           /* READPOWER_UNSET until the first step */
+  SweepTiming timing;
+
+  uint32_t count;
+  uint32_t max;
+  EpcValue *targets;
+  char (*targetHex)[2 * EPC_MATCH_EPC_MAX + 1];
+  EpcTable index;       /* EPC -> target number */
+
+  uint32_t words;
+  uint64_t *seen;       /* targets read in the last step */
+  uint64_t *done;       /* targets already stored at this frequency */
+  uint64_t *wanted;     /* targets the current step waits for */
+  uint64_t *confirmed;  /* targets that met the k of m rule in the last probe */
+  SweepHit *hits;
+  uint16_t *votes;      /* reads a target was seen in during a probe */
+  uint32_t *lo;         /* bisection: threshold level is in [lo, hi], */
+  uint32_t *hi;         /* hi == levels meaning not found */
+  SweepHit *best;       /* metadata at level hi */
+
+  /* band mode: the freq x target matrix of stored results */
+  uint32_t *freqs;      /* ascending */
+  uint32_t freqCount;
+  uint32_t freqWords;
+  uint64_t *found;      /* freqCount rows of words: target stored at freq */
+  uint64_t *hopped;     /* channels in the current hop table */
+  uint64_t *visited;    /* channels that produced a read in the dwell */
+  uint32_t *hopList;
+  uint32_t dwellMs;     /* 0: one hop time per channel in the table */
+  uint32_t bandReads;   /* tag reads bucketed at the current power */
+  int bandPow;
+
+  sqlite3 *db;
+  sqlite3_stmt *insert;
+  bool append;          /* --append: keep the ToP and sessions already in --file */
+  DbSession session;
+  sqlite3_int64 sessionId;
+  uint64_t rows;        /* stored by this sweep */
+} Sweep;
+
 void errx(int exitval, const char *fmt, ...)
 {
   va_list ap;
@@ -123,6 +241,649 @@ void parseAntennaList(uint8_t *antenna, uint8_t *antennaCount, char *args)
 }
 #endif /* BARE_METAL */
 
+static inline void bitSet(uint64_t *bits, uint32_t n)
+{
+  bits[n >> 6] |= 1ULL << (n & 63);
+}
+
+static inline void bitClear(uint64_t *bits, uint32_t n)
+{
+  bits[n >> 6] &= ~(1ULL << (n & 63));
+}
+
+static inline bool bitTest(const uint64_t *bits, uint32_t n)
+{
+  return 0 != (bits[n >> 6] & (1ULL << (n & 63)));
+}
+
+uint32_t bitCount(const uint64_t *bits, uint32_t words)
+{
+  uint32_t count = 0;
+  uint32_t w;
+
+  for (w = 0; w < words; w++)
+  {
+    count += __builtin_popcountll(bits[w]);
+  }
+  return count;
+}
+
+/* True if every bit of want is also set in have */
+bool bitCovers(const uint64_t *have, const uint64_t *want, uint32_t words)
+{
+  uint32_t w;
+
+  for (w = 0; w < words; w++)
+  {
+    if (0 != (want[w] & ~have[w]))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+/* Add one target EPC; duplicates are ignored. Returns -1 if not a valid EPC. */
+int addTarget(Sweep *sw, const char *hex)
+{
+  EpcValue value;
+  uint32_t *number;
+  bool created;
+
+  if (0 != epcParse(hex, &value))
+  {
+    fprintf(stdout, "Can't parse EPC: %s\n", hex);
+    return -1;
+  }
+  number = epcTableInsert(&sw->index, value.bytes, value.len, &created);
+  if (NULL == number)
+  {
+    return -1;
+  }
+  if (!created)
+  {
+    return 0;
+  }
+  if (sw->count == sw->max)
+  {
+    sw->max = sw->max ? 2 * sw->max : 16;
+    sw->targets = realloc(sw->targets, sw->max * sizeof(*sw->targets));
+    sw->targetHex = realloc(sw->targetHex, sw->max * sizeof(*sw->targetHex));
+    if (NULL == sw->targets || NULL == sw->targetHex)
+    {
+      return -1;
+    }
+  }
+  *number = sw->count;
+  sw->targets[sw->count] = value;
+  TMR_bytesToHex(value.bytes, value.len, sw->targetHex[sw->count]);
+  sw->count++;
+  return 0;
+}
+
+/* Comma separated list of EPCs */
+int addTargetList(Sweep *sw, char *list)
+{
+  char *token;
+
+  if (NULL == list)
+  {
+    return -1;
+  }
+  for (token = strtok(list, ","); NULL != token; token = strtok(NULL, ","))
+  {
+    if (0 != addTarget(sw, token))
+    {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/* One EPC per line, blank lines and '#' comments ignored */
+int loadTargets(Sweep *sw, const char *file)
+{
+  FILE *fp;
+  char *line = NULL;
+  size_t len = 0;
+  int rc = 0;
+
+  fp = fopen(file, "r");
+  if (NULL == fp)
+  {
+    fprintf(stdout, "Can't open EPC file: %s\n", file);
+    return -1;
+  }
+  while (0 == rc && -1 != getline(&line, &len, fp))
+  {
+    line[strcspn(line, "\r\n")] = 0;
+    if ('\0' != line[0] && '#' != line[0])
+    {
+      rc = addTarget(sw, line);
+    }
+  }
+  free(line);
+  fclose(fp);
+  return rc;
+}
+
+int openDatabase(Sweep *sw, const char *database)
+{
+  char *err_msg = 0;
+  int rc = sqlite3_open(database, &sw->db);
+  if (rc != SQLITE_OK) {
+      fprintf(stderr, "Cannot open database: %s\n", sqlite3_errmsg(sw->db));
+      sqlite3_close(sw->db);
+      return rc;
+  }
+  char *sql = DB_SESSION_SCHEMA
+              "CREATE TABLE IF NOT EXISTS ToP(epc INT, rssi INT, phase INT, freq INT, pow INT, session INT);";
+  if (!sw->append)
+  {
+    rc = sqlite3_exec(sw->db, "DROP TABLE IF EXISTS ToP; DROP TABLE IF EXISTS sessions;", 0, 0, &err_msg);
+  }
+  if (rc == SQLITE_OK)
+  {
+    rc = sqlite3_exec(sw->db, sql, 0, 0, &err_msg);
+  }
+  if (rc != SQLITE_OK ) {
+      fprintf(stderr, "SQL error: %s\n", err_msg);
+      sqlite3_free(err_msg);
+      sqlite3_close(sw->db);
+      return rc;
+  }
+  /* Sweeps from before sessions were recorded */
+  rc = dbSessionColumn(sw->db, "ToP");
+  if (rc != SQLITE_OK) {
+      sqlite3_close(sw->db);
+      return rc;
+  }
+  rc = sqlite3_prepare_v2(sw->db, "INSERT INTO ToP(epc, rssi, phase, freq, pow, session) VALUES(?, ?, ?, ?, ?, ?)", -1, &sw->insert, NULL);
+  if (rc != SQLITE_OK) {
+      fprintf(stderr, "Error preparing sql statement: %s\n", sqlite3_errmsg(sw->db));
+      sqlite3_close(sw->db);
+  }
+  return rc;
+}
+
+void storeRow(Sweep *sw, uint32_t t, int rssi, int phase, uint32_t freq, int pow)
+{
+  uint64_t start = monotonicUs();
+
+  printf("%s : %d - %d - %u - %d\n", sw->targetHex[t], rssi, phase, freq, pow);
+  sqlite3_bind_text(sw->insert, 1, sw->targetHex[t], -1, SQLITE_STATIC);
+  sqlite3_bind_int (sw->insert, 2, rssi);
+  sqlite3_bind_int (sw->insert, 3, phase);
+  sqlite3_bind_int (sw->insert, 4, freq);
+  sqlite3_bind_int (sw->insert, 5, pow);
+  if (SQLITE_DONE != sqlite3_step(sw->insert))
+  {
+    printf("Error executing sql statement\n");
+    sqlite3_close(sw->db);
+    exit(-1);
+  }
+  sqlite3_reset(sw->insert);
+  sw->rows++;
+  sw->timing.storeUs += monotonicUs() - start;
+}
+
+int setHopTable(Sweep *sw, uint32_t *list, uint32_t len)
+{
+  TMR_uint32List value;
+  TMR_Status ret;
+  uint64_t start = monotonicUs();
+
+  value.max = len;
+  value.len = len;
+  value.list = list;
+  ret = TMR_paramSet(sw->rp, TMR_PARAM_REGION_HOPTABLE, &value);
+  sw->timing.configUs += monotonicUs() - start;
+  return ret;
+}
+
+/* Index of a hop table frequency in sw->freqs, or -1 */
+int findChannel(const Sweep *sw, uint32_t freq)
+{
+  uint32_t lo = 0;
+  uint32_t hi = sw->freqCount;
+
+  while (lo < hi)
+  {
+    uint32_t mid = lo + (hi - lo) / 2;
+
+    if (sw->freqs[mid] < freq)
+    {
+      lo = mid + 1;
+    }
+    else
+    {
+      hi = mid;
+    }
+  }
+  return (lo < sw->freqCount && sw->freqs[lo] == freq) ? (int) lo : -1;
+}
+
+/**
+ * Band mode: file one read under the channel it was made on. Any tag
+ * marks the channel as visited; a target not yet stored there gets its
+ * row at the current power.
+ */
+void bucketRead(Sweep *sw, const TMR_TagReadData *trd, const uint32_t *t)
+{
+  int f = findChannel(sw, trd->frequency);
+  uint64_t *row;
+
+  if (f < 0)
+  {
+    return;
+  }
+  bitSet(sw->visited, f);
+  sw->bandReads++;
+  row = sw->found + (size_t) f * sw->words;
+  if (NULL != t && !bitTest(row, *t))
+  {
+    storeRow(sw, *t, trd->rssi, trd->phase, sw->freqs[f], sw->bandPow);
+    bitSet(row, *t);
+  }
+}
+
+void setPower(Sweep *sw, int pow)
+{
+  TMR_Status ret;
+  uint64_t start;
+
+  if (pow == sw->curPow)
+  {
+    return;
+  }
+  start = monotonicUs();
+  ret = TMR_paramSet(sw->rp, TMR_PARAM_RADIO_READPOWER, &pow);
+  checkerr(sw->rp, ret, 1, "setting read power");
+  sw->curPow = pow;
+  sw->timing.configUs += monotonicUs() - start;
+}
+
+void settle(Sweep *sw)
+{
+  uint64_t start;
+
+  if (0 == sw->settleMs)
+  {
+    return;
+  }
+  start = monotonicUs();
+  tmr_sleep(sw->settleMs);
+  sw->timing.settleUs += monotonicUs() - start;
+}
+
+/* One TMR_read; targets read are added to sw->seen */
+void readCycle(Sweep *sw, uint32_t timeout)
+{
+  TMR_Reader *rp = sw->rp;
+  TMR_Status ret;
+  uint64_t start = monotonicUs();
+
+  sw->reads++;
+  ret = TMR_read(rp, timeout, NULL);
+  if (TMR_ERROR_TAG_ID_BUFFER_FULL == ret)
+  {
+    /* In case of TAG ID Buffer Full, extract the tags present
+    * in buffer.
+    */
+  #ifndef BARE_METAL
+    fprintf(stdout, "reading tags:%s\n", TMR_strerr(rp, ret));
+  #endif /* BARE_METAL */
+  }
+  else
+  {
+    checkerr(rp, ret, 1, "reading tags");
+  }
+
+  while (TMR_SUCCESS == TMR_hasMoreTags(rp))
+  {
+    TMR_TagReadData trd;
+    uint32_t *t;
+
+    ret = TMR_getNextTag(rp, &trd);
+    checkerr(rp, ret, 1, "fetching tag");
+
+    t = epcTableFind(&sw->index, trd.tag.epc, trd.tag.epcByteCount);
+    if (NULL != t)
+    {
+      bitSet(sw->seen, *t);
+      sw->hits[*t].rssi = trd.rssi;
+      sw->hits[*t].phase = trd.phase;
+    }
+    if (SWEEP_BAND == sw->mode)
+    {
+      bucketRead(sw, &trd, t);
+    }
+  }
+  sw->timing.readUs += monotonicUs() - start;
+}
+
+/**
+ * Read at the given power and note which targets responded. Reads in
+ * cycles of cycleMs and stops as soon as every target in sw->wanted has
+ * been seen, or after maxDwellMs for targets that do not answer. The
+ * dwell counts the read time asked of the reader rather than the clock,
+ * which is the same on a module and lets a simulated one run at host
+ * speed.
+ */
+void readStep(Sweep *sw, int pow)
+{
+  uint64_t start;
+  uint64_t elapsed;
+  uint32_t dwelt = 0;
+
+  setPower(sw, pow);
+  memset(sw->seen, 0, sw->words * sizeof(uint64_t));
+  start = monotonicUs();
+  sw->timing.steps++;
+  for (;;)
+  {
+    readCycle(sw, sw->cycleMs);
+    dwelt += sw->cycleMs;
+    if (bitCovers(sw->seen, sw->wanted, sw->words))
+    {
+      if (dwelt < sw->maxDwellMs)
+      {
+        sw->timing.earlyExits++;
+      }
+      break;
+    }
+    if (dwelt >= sw->maxDwellMs)
+    {
+      break;
+    }
+  }
+  elapsed = monotonicUs() - start;
+  sw->timing.stepUs += elapsed;
+  if (elapsed > sw->timing.maxStepUs)
+  {
+    sw->timing.maxStepUs = elapsed;
+  }
+}
+
+/**
+ * Read up to confirmM times at one power and set sw->confirmed for the
+ * targets seen in at least confirmK of them. The caller puts the targets
+ * it needs an answer for in sw->wanted; each one is dropped from it once
+ * confirmed or once it can no longer make it, and probing stops when
+ * none are left.
+ */
+void probe(Sweep *sw, int pow)
+{
+  uint32_t r;
+  uint32_t t;
+
+  memset(sw->confirmed, 0, sw->words * sizeof(uint64_t));
+  memset(sw->votes, 0, sw->count * sizeof(uint16_t));
+  for (r = 0; r < sw->confirmM && 0 != bitCount(sw->wanted, sw->words); r++)
+  {
+    uint32_t left = sw->confirmM - r - 1;
+
+    readStep(sw, pow);
+    for (t = 0; t < sw->count; t++)
+    {
+      if (bitTest(sw->seen, t))
+      {
+        sw->votes[t]++;
+      }
+      if (sw->votes[t] >= sw->confirmK)
+      {
+        bitSet(sw->confirmed, t);
+      }
+      if (sw->votes[t] >= sw->confirmK || sw->votes[t] + left < sw->confirmK)
+      {
+        bitClear(sw->wanted, t);
+      }
+    }
+  }
+}
+
+/* Ramp power up until every target has responded or MAX_POW is reached */
+void sweepLinear(Sweep *sw, uint32_t freq)
+{
+  int pow;
+  uint32_t t;
+
+  for (pow = sw->minPow; pow <= sw->maxPow && bitCount(sw->done, sw->words) < sw->count; pow += sw->powStep)
+  {
+    printf("%u : %d\n", freq, pow);
+    for (t = 0; t < sw->words; t++)
+    {
+      sw->wanted[t] = ~sw->done[t];
+    }
+    if (0 != (sw->count & 63))
+    {
+      sw->wanted[sw->words - 1] &= (1ULL << (sw->count & 63)) - 1;
+    }
+    probe(sw, pow);
+    for (t = 0; t < sw->count; t++)
+    {
+      if (bitTest(sw->confirmed, t) && !bitTest(sw->done, t))
+      {
+        storeRow(sw, t, sw->hits[t].rssi, sw->hits[t].phase, freq, pow);
+        bitSet(sw->done, t);
+      }
+    }
+    settle(sw);
+  }
+}
+
+/**
+ * Binary search for each target's threshold level, assuming a target
+ * that responds at a power also responds above it. Every probe serves all
+ * targets whose interval contains it; the next probe bisects the widest
+ * remaining interval, so N targets cost about log2(levels) probes each at
+ * worst and far fewer when their thresholds are close.
+ */
+void sweepBisect(Sweep *sw, uint32_t freq)
+{
+  uint32_t t;
+
+  for (t = 0; t < sw->count; t++)
+  {
+    sw->lo[t] = 0;
+    sw->hi[t] = sw->levels;
+  }
+
+  for (;;)
+  {
+    uint32_t widest = 0;
+    uint32_t mid = 0;
+    int pow;
+
+    for (t = 0; t < sw->count; t++)
+    {
+      if (sw->hi[t] - sw->lo[t] > widest)
+      {
+        widest = sw->hi[t] - sw->lo[t];
+        mid = sw->lo[t] + widest / 2;
+      }
+    }
+    if (0 == widest)
+    {
+      break;
+    }
+
+    pow = sw->minPow + mid * sw->powStep;
+    printf("%u : %d\n", freq, pow);
+    memset(sw->wanted, 0, sw->words * sizeof(uint64_t));
+    for (t = 0; t < sw->count; t++)
+    {
+      if (mid >= sw->lo[t] && mid < sw->hi[t])
+      {
+        bitSet(sw->wanted, t);
+      }
+    }
+    probe(sw, pow);
+    for (t = 0; t < sw->count; t++)
+    {
+      /* Results outside a target's interval would contradict earlier probes */
+      if (mid < sw->lo[t] || mid >= sw->hi[t])
+      {
+        continue;
+      }
+      if (bitTest(sw->confirmed, t))
+      {
+        sw->hi[t] = mid;
+        sw->best[t] = sw->hits[t];
+      }
+      else
+      {
+        sw->lo[t] = mid + 1;
+      }
+    }
+    settle(sw);
+  }
+
+  for (t = 0; t < sw->count; t++)
+  {
+    if (sw->hi[t] < sw->levels)
+    {
+      storeRow(sw, t, sw->best[t].rssi, sw->best[t].phase, freq, sw->minPow + sw->hi[t] * sw->powStep);
+      bitSet(sw->done, t);
+    }
+  }
+}
+
+/**
+ * Ramp power with the whole band in the hop table instead of one
+ * frequency at a time. At each power the reader hops over every channel
+ * that still has targets missing, in short read cycles so the tag buffer
+ * does not merge reads made on different channels, and each read is
+ * bucketed by trd.frequency. If the dwell produced reads but skipped some
+ * channels, those are read on their own; a dwell with no reads at all
+ * means nothing answers at this power. Channels drop out of the hop table
+ * once every target has been found on them, and the dwell ends early
+ * when that empties it.
+ */
+void sweepBand(Sweep *sw)
+{
+  TMR_Status ret;
+  uint32_t hopTime;
+  uint32_t f;
+  uint32_t t;
+  int pow;
+
+  ret = TMR_paramGet(sw->rp, TMR_PARAM_REGION_HOPTIME, &hopTime);
+  if (TMR_SUCCESS != ret || 0 == hopTime)
+  {
+    hopTime = BAND_HOP_MS;
+  }
+
+  for (pow = sw->minPow; pow <= sw->maxPow; pow += sw->powStep)
+  {
+    uint64_t start;
+    uint64_t elapsed;
+    uint32_t dwell;
+    uint32_t dwelt = 0;
+    uint32_t len = 0;
+
+    memset(sw->hopped, 0, sw->freqWords * sizeof(uint64_t));
+    memset(sw->visited, 0, sw->freqWords * sizeof(uint64_t));
+    for (f = 0; f < sw->freqCount; f++)
+    {
+      if (bitCount(sw->found + (size_t) f * sw->words, sw->words) < sw->count)
+      {
+        bitSet(sw->hopped, f);
+        sw->hopList[len++] = sw->freqs[f];
+      }
+    }
+    if (0 == len)
+    {
+      break;
+    }
+
+    dwell = sw->dwellMs ? sw->dwellMs : hopTime * len;
+    printf("band (%u channels) : %d\n", len, pow);
+    ret = setHopTable(sw, sw->hopList, len);
+    checkerr(sw->rp, ret, 1, "Setting Hoptable");
+    sw->bandPow = pow;
+    sw->bandReads = 0;
+    setPower(sw, pow);
+
+    /* One transaction per power level */
+    sqlite3_exec(sw->db, "BEGIN;", 0, 0, NULL);
+    start = monotonicUs();
+    sw->timing.steps++;
+    do
+    {
+      readCycle(sw, sw->cycleMs);
+      dwelt += sw->cycleMs;
+      for (f = 0; f < sw->freqCount; f++)
+      {
+        if (bitTest(sw->hopped, f) && bitCount(sw->found + (size_t) f * sw->words, sw->words) < sw->count)
+        {
+          break;
+        }
+      }
+      if (f == sw->freqCount)
+      {
+        sw->timing.earlyExits++;
+        break;
+      }
+    } while (dwelt < dwell);
+    elapsed = monotonicUs() - start;
+    sw->timing.stepUs += elapsed;
+    if (elapsed > sw->timing.maxStepUs)
+    {
+      sw->timing.maxStepUs = elapsed;
+    }
+
+    for (f = 0; f < sw->freqCount && 0 != sw->bandReads; f++)
+    {
+      uint64_t *row = sw->found + (size_t) f * sw->words;
+
+      if (bitTest(sw->hopped, f) && !bitTest(sw->visited, f))
+      {
+        printf("%u : %d\n", sw->freqs[f], pow);
+        ret = setHopTable(sw, &sw->freqs[f], 1);
+        checkerr(sw->rp, ret, 1, "Setting Hoptable");
+        memset(sw->wanted, 0, sw->words * sizeof(uint64_t));
+        for (t = 0; t < sw->count; t++)
+        {
+          if (!bitTest(row, t))
+          {
+            bitSet(sw->wanted, t);
+          }
+        }
+        readStep(sw, pow);
+      }
+    }
+    sqlite3_exec(sw->db, "COMMIT;", 0, 0, NULL);
+    settle(sw);
+  }
+
+  sqlite3_exec(sw->db, "BEGIN;", 0, 0, NULL);
+  for (f = 0; f < sw->freqCount; f++)
+  {
+    for (t = 0; t < sw->count; t++)
+    {
+      if (!bitTest(sw->found + (size_t) f * sw->words, t))
+      {
+        storeRow(sw, t, NOT_FOUND_RSSI, 0, sw->freqs[f], NOT_FOUND_POW);
+      }
+    }
+  }
+  sqlite3_exec(sw->db, "COMMIT;", 0, 0, NULL);
+}
+
+void printTiming(const Sweep *sw)
+{
+  const SweepTiming *tm = &sw->timing;
+  uint64_t totalUs = monotonicUs() - tm->startUs;
+  uint64_t otherUs = totalUs - tm->readUs - tm->configUs - tm->settleUs - tm->storeUs;
+
+  printf("Steps: %" PRIu64 " (%" PRIu64 " ended early), mean %.1f ms, max %.1f ms\n",
+         tm->steps, tm->earlyExits, tm->steps ? tm->stepUs / 1000.0 / tm->steps : 0.0, tm->maxStepUs / 1000.0);
+  printf("Time: %.1f s total, read %.1f s, configure %.1f s, settle %.1f s, store %.1f s, other %.1f s\n",
+         totalUs / 1e6, tm->readUs / 1e6, tm->configUs / 1e6, tm->settleUs / 1e6, tm->storeUs / 1e6,
+         (int64_t) otherUs > 0 ? otherUs / 1e6 : 0.0);
+}
+
 int main(int argc, char *argv[])
 {
   TMR_Reader r, *rp;
@@ -141,9 +902,7 @@ int main(int argc, char *argv[])
   char string[100];
   TMR_String model;
 
-  bool saved = false;
-  
-  int pow;
+  Sweep sw;
   double FREQ_STEP = 5;
   int POW_STEP = 100;
   int MIN_FREQ = 840000;
@@ -151,36 +910,32 @@ int main(int argc, char *argv[])
   int MIN_POW = 3150;
   int MAX_POW = 3150;
   int NUM_FREQS;
-  TMR_uint32List value;
+  uint32_t *freqs;
 
   TMR_PortValue portvalueList[4];
   TMR_PortValueList portvalue;
 
-  sqlite3 *db;
-  sqlite3_stmt *stmt;
-  char *err_msg = 0;
-  char database [15];
-  printf("Enter database file name: ");
-  scanf("%s", database);
-  int rc = sqlite3_open(database, &db);
-  if (rc != SQLITE_OK) {
-      fprintf(stderr, "Cannot open database: %s\n", sqlite3_errmsg(db));
-      sqlite3_close(db);
-      return 1;
+  char *database = NULL;
+  char databaseName[256];
+  char dir[256];
+  char prefix[64];
+  uint32_t t;
+
+  memset(&sw, 0, sizeof(sw));
+  sw.mode = SWEEP_LINEAR;
+  sw.confirmK = 1;
+  sw.confirmM = 1;
+  sw.cycleMs = READ_CYCLE_MS;
+  sw.maxDwellMs = MAX_DWELL_MS;
+  sw.settleMs = SETTLE_MS;
+  sw.curPow = READPOWER_UNSET;
+  if (0 != epcTableInit(&sw.index, 64, sizeof(uint32_t)))
+  {
+    fprintf(stderr, "Cannot allocate target table\n");
+    return 1;
   }
-  char *sql = "DROP TABLE IF EXISTS ToP;"
-              "CREATE TABLE ToP(epc INT, rssi INT, phase INT, freq INT, pow INT);";
-  rc = sqlite3_exec(db, sql, 0, 0, &err_msg);
-  if (rc != SQLITE_OK ) {
-      fprintf(stderr, "SQL error: %s\n", err_msg);
-      sqlite3_free(err_msg);        
-      sqlite3_close(db);
-      return 1;
-  } 
-  char *epc;
-  int rssi;
-  int phase;
-  int freq;
+  /* Before the options are parsed, as --ant splits its argument in place */
+  dbSessionInit(&sw.session, argc, argv);
     
 #if USE_TRANSPORT_LISTENER
   TMR_TransportListenerBlock tb;
@@ -223,11 +978,89 @@ int main(int argc, char *argv[])
         fprintf(stdout, "Can't parse read power: %s\n", argv[i+1]);
       }
     }
-    else if (0 == strcmp("--epc", argv[i]))
+    else if (0 == strcmp("--epc", argv[i]) || 0 == strcmp("--epc1", argv[i]) || 0 == strcmp("--epc2", argv[i]))
     {
-      epc = argv[i+1];
+      if (0 != addTargetList(&sw, argv[i+1]))
+      {
+        usage();
+      }
+    }
+    else if (0 == strcmp("--epcs", argv[i]))
+    {
+      if (0 != loadTargets(&sw, argv[i+1]))
+      {
+        usage();
+      }
+    }
+    else if (0 == strcmp("--file", argv[i]))
+    {
+      database = argv[i+1];
+    }
+    else if (0 == strcmp("--append", argv[i]))
+    {
+      sw.append = (NULL != argv[i+1] && 0 != atoi(argv[i+1]));
+    }
+    else if (0 == strcmp("--mode", argv[i]))
+    {
+      if (NULL != argv[i+1] && 0 == strcmp("bisect", argv[i+1]))
+      {
+        sw.mode = SWEEP_BISECT;
+      }
+      else if (NULL != argv[i+1] && 0 == strcmp("band", argv[i+1]))
+      {
+        sw.mode = SWEEP_BAND;
+      }
+      else if (NULL != argv[i+1] && 0 == strcmp("linear", argv[i+1]))
+      {
+        sw.mode = SWEEP_LINEAR;
+      }
+      else
+      {
+        fprintf(stdout, "Unknown sweep mode: %s\n", argv[i+1]);
+        usage();
+      }
+    }
+    else if (0 == strcmp("--confirm", argv[i]))
+    {
+      if (NULL == argv[i+1] || 2 != sscanf(argv[i+1], "%"SCNu32"/%"SCNu32, &sw.confirmK, &sw.confirmM)
+          || 0 == sw.confirmK || sw.confirmK > sw.confirmM || sw.confirmM > UINT16_MAX)
+      {
+        fprintf(stdout, "Can't parse confirmation rule (k/m): %s\n", argv[i+1]);
+        usage();
+      }
+    }
+    else if (0 == strcmp("--dwell", argv[i]))
+    {
+      if (NULL == argv[i+1] || 1 != sscanf(argv[i+1], "%"SCNu32, &sw.dwellMs) || 0 == sw.dwellMs)
+      {
+        fprintf(stdout, "Can't parse dwell time: %s\n", argv[i+1]);
+        usage();
+      }
+    }
+    else if (0 == strcmp("--cycle", argv[i]))
+    {
+      if (NULL == argv[i+1] || 1 != sscanf(argv[i+1], "%"SCNu32, &sw.cycleMs) || 0 == sw.cycleMs)
+      {
+        fprintf(stdout, "Can't parse cycle time: %s\n", argv[i+1]);
+        usage();
+      }
+    }
+    else if (0 == strcmp("--maxdwell", argv[i]))
+    {
+      if (NULL == argv[i+1] || 1 != sscanf(argv[i+1], "%"SCNu32, &sw.maxDwellMs) || 0 == sw.maxDwellMs)
+      {
+        fprintf(stdout, "Can't parse maximum dwell time: %s\n", argv[i+1]);
+        usage();
+      }
+    }
+    else if (0 == strcmp("--settle", argv[i]))
+    {
+      if (NULL == argv[i+1] || 1 != sscanf(argv[i+1], "%"SCNu32, &sw.settleMs))
+      {
+        fprintf(stdout, "Can't parse settle time: %s\n", argv[i+1]);
+        usage();
+      }
     }
-
     else if (0 == strcmp("--freqstep", argv[i]))
     {
       char *freqptr1 = argv[i+1];
@@ -270,8 +1103,81 @@ int main(int argc, char *argv[])
       usage();
     }
   }
+  if (0 == sw.count)
+  {
+    fprintf(stdout, "Please provide the target EPCs with --epc or --epcs\n");
+    usage();
+  }
+  /* Band mode counts a target found on a channel from a single read */
+  if (SWEEP_BAND == sw.mode && sw.confirmM > 1)
+  {
+    fprintf(stdout, "--confirm can't be used with --mode band\n");
+    usage();
+  }
+  if (NULL == database)
+  {
+    printf("Enter database file name: ");
+    if (1 != scanf("%255s", databaseName))
+    {
+      return 1;
+    }
+    database = databaseName;
+  }
+  /* Into a directory, every sweep gets its own timestamped database */
+  if (rotateSplit(database, "sweep", dir, sizeof(dir), prefix, sizeof(prefix)))
+  {
+    if (0 != rotateName(databaseName, sizeof(databaseName), dir, prefix, ".db"))
+    {
+      fprintf(stderr, "Database name too long: %s\n", database);
+      return 1;
+    }
+    database = databaseName;
+    printf("Writing sweep to %s\n", database);
+  }
+  if (SQLITE_OK != openDatabase(&sw, database))
+  {
+    return 1;
+  }
+  sw.minPow = MIN_POW;
+  sw.maxPow = MAX_POW;
+  sw.powStep = POW_STEP;
+  if (POW_STEP <= 0 || MAX_POW < MIN_POW)
+  {
+    fprintf(stdout, "Invalid power range\n");
+    usage();
+  }
+  sw.levels = (MAX_POW - MIN_POW) / POW_STEP + 1;
+  sw.words = (sw.count + 63) / 64;
+  sw.seen = calloc(sw.words, sizeof(uint64_t));
+  sw.done = calloc(sw.words, sizeof(uint64_t));
+  sw.confirmed = calloc(sw.words, sizeof(uint64_t));
+  sw.wanted = calloc(sw.words, sizeof(uint64_t));
+  sw.hits = calloc(sw.count, sizeof(SweepHit));
+  sw.votes = calloc(sw.count, sizeof(uint16_t));
+  sw.lo = calloc(sw.count, sizeof(uint32_t));
+  sw.hi = calloc(sw.count, sizeof(uint32_t));
+  sw.best = calloc(sw.count, sizeof(SweepHit));
   NUM_FREQS = (int) (MAX_FREQ-MIN_FREQ)/FREQ_STEP/1000;
-  int freqs[NUM_FREQS];
+  freqs = calloc(NUM_FREQS + 1, sizeof(uint32_t));
+  sw.freqs = freqs;
+  sw.freqCount = NUM_FREQS + 1;
+  sw.freqWords = (sw.freqCount + 63) / 64;
+  sw.found = calloc((size_t) sw.freqCount * sw.words, sizeof(uint64_t));
+  sw.hopped = calloc(sw.freqWords, sizeof(uint64_t));
+  sw.visited = calloc(sw.freqWords, sizeof(uint64_t));
+  sw.hopList = calloc(sw.freqCount, sizeof(uint32_t));
+  if (NULL == sw.found || NULL == sw.hopped || NULL == sw.visited || NULL == sw.hopList)
+  {
+    fprintf(stderr, "Cannot allocate band state\n");
+    return 1;
+  }
+  if (NULL == sw.seen || NULL == sw.done || NULL == sw.confirmed || NULL == sw.wanted || NULL == sw.hits || NULL == sw.votes
+      || NULL == sw.lo || NULL == sw.hi || NULL == sw.best || NULL == freqs)
+  {
+    fprintf(stderr, "Cannot allocate sweep state\n");
+    return 1;
+  }
+  fprintf(stdout, "Sweeping %u target(s)\n", sw.count);
   ret = TMR_create(rp, argv[1]);
   checkerr(rp, ret, 1, "creating reader");
 #else
@@ -408,18 +1314,51 @@ int main(int argc, char *argv[])
   ret = TMR_paramSet(rp, TMR_PARAM_READ_PLAN, &plan);
   checkerr(rp, ret, 1, "setting read plan");
 
+  {
+    TMR_String firmware;
+    int32_t value;
+    size_t used = 0;
+
+    snprintf(sw.session.model, sizeof(sw.session.model), "%s", model.value);
+    firmware.value = sw.session.firmware;
+    firmware.max = sizeof(sw.session.firmware);
+    if (TMR_SUCCESS != TMR_paramGet(rp, TMR_PARAM_VERSION_SOFTWARE, &firmware))
+    {
+      sw.session.firmware[0] = '\0';
+    }
+    if (TMR_SUCCESS == TMR_paramGet(rp, TMR_PARAM_REGION_ID, &region))
+    {
+      sw.session.region = region;
+    }
+    /* The sweep changes the power; the one set up front is recorded */
+    if (TMR_SUCCESS == TMR_paramGet(rp, TMR_PARAM_RADIO_READPOWER, &value))
+    {
+      sw.session.readPower = value;
+    }
+    for (t = 0; t < antennaCount && used < sizeof(sw.session.antennas); t++)
+    {
+      used += snprintf(sw.session.antennas + used, sizeof(sw.session.antennas) - used, "%s%u", t ? "," : "", antennaList[t]);
+    }
+    if (SQLITE_OK != dbSessionBegin(sw.db, &sw.session, &sw.sessionId))
+    {
+      return 1;
+    }
+    sqlite3_bind_int64(sw.insert, 6, sw.sessionId);
+  }
+
   for (int i = 0; i <= NUM_FREQS; i++){
     freqs[i] = MIN_FREQ + (int) i*1000*FREQ_STEP;
     // printf("%d = %d\n",i,freqs[i]);
   }
 
-  for (int i = 0; i <= NUM_FREQS; i++){
-    saved = false;
-    pow = MIN_POW;
-    value.max = 1;
-    value.len = 1;
-    value.list = &freqs[i];
-    ret = TMR_paramSet(rp, TMR_PARAM_REGION_HOPTABLE, &value);
+  sw.rp = rp;
+  sw.timing.startUs = monotonicUs();
+  if (SWEEP_BAND == sw.mode)
+  {
+    sweepBand(&sw);
+  }
+  for (int i = 0; SWEEP_BAND != sw.mode && i <= NUM_FREQS; i++){
+    ret = setHopTable(&sw, &freqs[i], 1);
     checkerr(rp, ret, 1, "Setting Hoptable");
 
     /* Get the antenna return loss value, this parameter is not the part of reader stats */
@@ -433,245 +1372,50 @@ int main(int argc, char *argv[])
     //   printf("Antenna %d | %d \n", portvalue.list[k].port, portvalue.list[k].value);
     // }
 
-    while (pow <= MAX_POW){
-      printf("%d : %d\n", freqs[i], pow);
-      ret = TMR_paramSet(rp, TMR_PARAM_RADIO_READPOWER, &pow);
-      checkerr(rp, ret, 1, "setting read power");
-      ret = TMR_read(rp, 500, NULL);
-        
-      if (TMR_ERROR_TAG_ID_BUFFER_FULL == ret)
-      {
-        /* In case of TAG ID Buffer Full, extract the tags present
-        * in buffer.
-        */
-      #ifndef BARE_METAL
-        fprintf(stdout, "reading tags:%s\n", TMR_strerr(rp, ret));
-      #endif /* BARE_METAL */
-      }
-      else
+    /* One transaction per frequency */
+    sqlite3_exec(sw.db, "BEGIN;", 0, 0, NULL);
+    memset(sw.done, 0, sw.words * sizeof(uint64_t));
+    if (SWEEP_BISECT == sw.mode)
+    {
+      sweepBisect(&sw, freqs[i]);
+    }
+    else
+    {
+      sweepLinear(&sw, freqs[i]);
+    }
+    for (t = 0; t < sw.count; t++)
+    {
+      if (!bitTest(sw.done, t))
       {
-        checkerr(rp, ret, 1, "reading tags");
+        storeRow(&sw, t, NOT_FOUND_RSSI, 0, freqs[i], NOT_FOUND_POW);
       }
-
-      while (TMR_SUCCESS == TMR_hasMoreTags(rp))
-        {
-          TMR_TagReadData trd;
-          char idStr[128];
-        #ifndef BARE_METAL
-          char timeStr[128];
-        #endif /* BARE_METAL */
-
-          ret = TMR_getNextTag(rp, &trd); 
-          checkerr(rp, ret, 1, "fetching tag");
-
-          TMR_bytesToHex(trd.tag.epc, trd.tag.epcByteCount, idStr);
-
-        #ifndef BARE_METAL
-        TMR_getTimeStamp(rp, &trd, timeStr);
-        // printf("Tag ID: %s ", idStr);
-
-        // Enable PRINT_TAG_METADATA Flags to print Metadata value
-        #if PRINT_TAG_METADATA
-        {
-        uint16_t j = 0;
-
-        printf("\n");
-        for (j=0; (1<<j) <= TMR_TRD_METADATA_FLAG_MAX; j++)
-        {
-          if ((TMR_TRD_MetadataFlag)trd.metadataFlags & (1<<j))
-          {
-            switch ((TMR_TRD_MetadataFlag)trd.metadataFlags & (1<<j))
-            {
-              case TMR_TRD_METADATA_FLAG_READCOUNT:
-                printf("Read Count: %d\n", trd.readCount);
-                break;
-              case TMR_TRD_METADATA_FLAG_ANTENNAID:
-                printf("Antenna ID: %d\n", trd.antenna);
-                break;
-              case TMR_TRD_METADATA_FLAG_TIMESTAMP:
-                printf("Timestamp: %s\n", timeStr);
-                break;
-              case TMR_TRD_METADATA_FLAG_PROTOCOL:
-                printf("Protocol: %d\n", trd.tag.protocol);
-                break;
-        #ifdef TMR_ENABLE_UHF
-              case TMR_TRD_METADATA_FLAG_RSSI:
-                printf("RSSI: %d\n", trd.rssi);
-                break;
-              case TMR_TRD_METADATA_FLAG_FREQUENCY:
-                printf("Frequency: %d\n", trd.frequency);
-                break;
-              case TMR_TRD_METADATA_FLAG_PHASE:
-                printf("Phase: %d\n", trd.phase);
-                break;
-        #endif /* TMR_ENABLE_UHF */
-              case TMR_TRD_METADATA_FLAG_DATA:
-              {
-                //TODO : Initialize Read Data
-                if (0 < trd.data.len)
-                {
-        #ifdef TMR_ENABLE_HF_LF
-                  if (0x8000 == trd.data.len)
-                  {
-                    ret = TMR_translateErrorCode(GETU16AT(trd.data.list, 0));
-                    checkerr(rp, ret, 0, "Embedded tagOp failed:");
-                  }
-                  else
-        #endif /* TMR_ENABLE_HF_LF */
-                  {
-                    char dataStr[255];
-                    uint32_t dataLen = trd.data.len;
-
-                    //Convert data len from bits to byte(For M3e only).
-                    if (0 == strcmp("M3e", model.value))
-                    {
-                      dataLen = tm_u8s_per_bits(trd.data.len);
-                    }
-
-                    TMR_bytesToHex(trd.data.list, dataLen, dataStr);
-                    printf("Data(%d): %s\n", trd.data.len, dataStr);
-                  }
-                }
-              }
-              break;
-        #ifdef TMR_ENABLE_UHF
-              case TMR_TRD_METADATA_FLAG_GPIO_STATUS:
-              {
-                if (rp->readerType == TMR_READER_TYPE_SERIAL)
-                {
-                  printf("GPI status:\n");
-                  for (i = 0 ; i < trd.gpioCount ; i++)
-                  {
-                    printf("Pin %d: %s\n", trd.gpio[i].id, trd.gpio[i].bGPIStsTagRdMeta ? "High" : "Low");
-                  }
-                  printf("GPO status:\n");
-                  for (i = 0 ; i < trd.gpioCount ; i++)
-                  {
-                    printf("Pin %d: %s\n", trd.gpio[i].id, trd.gpio[i].high ? "High" : "Low");
-                  }
-                }
-                else
-                {
-                  printf("GPI status:\n");
-                  for (i = 0 ; i < trd.gpioCount/2 ; i++)
-                  {
-                    printf("Pin %d: %s\n", trd.gpio[i].id, trd.gpio[i].high ? "High" : "Low");
-                  }
-                  printf("GPO status:\n");
-                  for (i = trd.gpioCount/2 ; i < trd.gpioCount ; i++)
-                  {
-                    printf("Pin %d: %s\n", trd.gpio[i].id, trd.gpio[i].high ? "High" : "Low");
-                  }
-                }
-              }
-              break;
-              if (TMR_TAG_PROTOCOL_GEN2 == trd.tag.protocol)
-              {
-                case TMR_TRD_METADATA_FLAG_GEN2_Q:
-                  printf("Gen2Q: %d\n", trd.u.gen2.q.u.staticQ.initialQ);
-                  break;
-                case TMR_TRD_METADATA_FLAG_GEN2_LF:
-                {
-                  printf("Gen2Linkfrequency: ");
-                  switch(trd.u.gen2.lf)
-                  {
-                    case TMR_GEN2_LINKFREQUENCY_250KHZ:
-                      printf("250(khz)\n");
-                      break;
-                    case TMR_GEN2_LINKFREQUENCY_320KHZ:
-                      printf("320(khz)\n");
-                      break;
-                    case TMR_GEN2_LINKFREQUENCY_640KHZ:
-                      printf("640(khz)\n"); 
-                      break;
-                    default:
-                      printf("Unknown value(%d)\n",trd.u.gen2.lf);
-                      break;
-                  }
-                  break;
-                }
-                case TMR_TRD_METADATA_FLAG_GEN2_TARGET:
-                {
-                  printf("Gen2Target: ");
-                  switch(trd.u.gen2.target)
-                  {
-                    case TMR_GEN2_TARGET_A:
-                      printf("A\n");
-                      break;
-                    case TMR_GEN2_TARGET_B:
-                      printf("B\n");
-                      break;
-                    default:
-                      printf("Unknown Value(%d)\n",trd.u.gen2.target);
-                      break;
-                  }
-                  break;
-                }
-              }
-        #endif /* TMR_ENABLE_UHF */
-        #ifdef TMR_ENABLE_HF_LF
-              case TMR_TRD_METADATA_FLAG_TAGTYPE:
-              {
-                printf("TagType: 0x%08lx\n", trd.tagType);
-                break;
-              }
-        #endif /* TMR_ENABLE_HF_LF */
-              default:
-                break;
-              }
-            }
-          }
-        }
-        #endif
-        // printf ("\n");
-        #endif
-        // printf("input: %s\n", epc);
-        // printf("reading: %s\n", idStr);
-        // printf("String compare = %d\n", strncmp(epc, idStr, sizeof(idStr)));
-        if (0 == strcmp(epc, idStr)){
-          saved = true;
-          rssi = trd.rssi;
-          freq = freqs[i];
-          phase = trd.phase;
-          printf("%s : %d - %d - %d - %d\n", epc, rssi, phase, freq, pow);
-          if (sqlite3_prepare_v2(db, "INSERT INTO ToP(epc, rssi, phase, freq, pow) VALUES(?, ?, ?, ?, ?)", -1, &stmt, NULL)) {
-              printf("Error executing sql statement\n");
-              sqlite3_close(db);
-              exit(-1);
-          }
-          sqlite3_bind_text(stmt, 1, epc, -1, NULL);
-          sqlite3_bind_int (stmt, 2, rssi);
-          sqlite3_bind_int (stmt, 3, phase);
-          sqlite3_bind_int (stmt, 4, freq);
-          sqlite3_bind_int (stmt, 5, pow);    
-          sqlite3_step(stmt);
-          sqlite3_reset(stmt);
-          pow = MAX_POW;
-        } 
-      }
-      pow = pow + POW_STEP;
-      tmr_sleep(500);
-    }
-    if (saved == false){
-      freq = freqs[i];
-      if (sqlite3_prepare_v2(db, "INSERT INTO ToP(epc, rssi, phase, freq, pow) VALUES(?, ?, ?, ?, ?)", -1, &stmt, NULL)) {
-        printf("Error executing sql statement\n");
-        sqlite3_close(db);
-        exit(-1);
-      }
-      sqlite3_bind_text(stmt, 1, epc, -1, NULL);
-      sqlite3_bind_int (stmt, 2, -99);
-      sqlite3_bind_int (stmt, 3, 0);
-      sqlite3_bind_int (stmt, 4, freq);
-      sqlite3_bind_int (stmt, 5, 3200);    
-      sqlite3_step(stmt);
-      sqlite3_reset(stmt);
-    }
-  }
-  printf("Closing database\n");
-  // sqlite3_finalize(stmt);
-  tmr_sleep(500);
-  sqlite3_close(db);
+    }
+    sqlite3_exec(sw.db, "COMMIT;", 0, 0, NULL);
+  }
+  printf("Total reads: %" PRIu64 "\n", sw.reads);
+  printTiming(&sw);
+  printf("Closing database, session %lld\n", (long long)sw.sessionId);
+  dbSessionEnd(sw.db, sw.sessionId, sw.rows);
+  sqlite3_exec(sw.db, "CREATE INDEX IF NOT EXISTS ToP_session ON ToP(session);", 0, 0, NULL);
+  sqlite3_finalize(sw.insert);
+  sqlite3_close(sw.db);
+  epcTableFree(&sw.index);
+  free(sw.targets);
+  free(sw.targetHex);
+  free(sw.seen);
+  free(sw.done);
+  free(sw.confirmed);
+  free(sw.wanted);
+  free(sw.hits);
+  free(sw.votes);
+  free(sw.lo);
+  free(sw.hi);
+  free(sw.best);
+  free(sw.found);
+  free(sw.hopped);
+  free(sw.visited);
+  free(sw.hopList);
+  free(freqs);
   TMR_destroy(rp);
   return 0;
 }
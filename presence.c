@@ -0,0 +1,363 @@
+/**
+ * Online presence engine turning reads into tag events.
+ * @file presence.c
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "presence.h"
+#include "time_util.h"
+
+/* End of a wheel slot or of the free list */
+#define PRESENCE_NIL (UINT32_MAX)
+
+/* Chain tags first..capacity-1 into the free list */
+static void freeTags(Presence *p, uint32_t first)
+{
+  uint32_t i;
+
+  for (i = p->capacity; i > first; i--)
+  {
+    p->tags[i - 1].next = p->freeList;
+    p->freeList = i - 1;
+  }
+}
+
+int presenceInit(Presence *p, uint32_t timeoutMs, int32_t arriveRssi, int32_t departRssi, int32_t moveDb,
+                 PresenceEmitFn emit, void *cookie)
+{
+  uint32_t i;
+
+  memset(p, 0, sizeof(*p));
+  p->timeoutMs = timeoutMs ? timeoutMs : 1;
+  p->arriveRssi = arriveRssi;
+  p->departRssi = departRssi;
+  p->moveDb = moveDb;
+  p->tickMs = p->timeoutMs / PRESENCE_SPAN ? p->timeoutMs / PRESENCE_SPAN : 1;
+  p->emit = emit;
+  p->cookie = cookie;
+  for (i = 0; i < PRESENCE_SLOTS; i++)
+  {
+    p->wheel[i] = PRESENCE_NIL;
+  }
+  p->tags = malloc(PRESENCE_CAPACITY * sizeof(*p->tags));
+  if (NULL == p->tags || 0 != epcTableInit(&p->index, PRESENCE_CAPACITY, sizeof(uint32_t)))
+  {
+    free(p->tags);
+    p->tags = NULL;
+    return -1;
+  }
+  p->capacity = PRESENCE_CAPACITY;
+  p->freeList = PRESENCE_NIL;
+  freeTags(p, 0);
+  return 0;
+}
+
+void presenceFree(Presence *p)
+{
+  epcTableFree(&p->index);
+  free(p->tags);
+  p->tags = NULL;
+}
+
+const char *presenceKindName(PresenceKind kind)
+{
+  switch (kind)
+  {
+  case PRESENCE_ARRIVE:
+    return "ARRIVE";
+  case PRESENCE_DEPART:
+    return "DEPART";
+  default:
+    return "MOVE";
+  }
+}
+
+/* A free tag number, growing the pool if needed; tag pointers move then */
+static uint32_t allocTag(Presence *p)
+{
+  uint32_t id;
+
+  if (PRESENCE_NIL == p->freeList)
+  {
+    uint32_t old = p->capacity;
+    PresenceTag *more = realloc(p->tags, 2 * (size_t)old * sizeof(*p->tags));
+
+    if (NULL == more)
+    {
+      return PRESENCE_NIL;
+    }
+    p->tags = more;
+    p->capacity = 2 * old;
+    freeTags(p, old);
+  }
+  id = p->freeList;
+  p->freeList = p->tags[id].next;
+  return id;
+}
+
+/* Put a tag in the slot of the tick its timeout falls in */
+static void schedule(Presence *p, uint32_t id)
+{
+  PresenceTag *t = &p->tags[id];
+  uint64_t due = (t->lastMs + p->timeoutMs) / p->tickMs;
+  uint32_t slot;
+
+  if (due <= p->tick)
+  {
+    due = p->tick + 1;
+  }
+  /* Reader clock ahead of ours: look again within a turn of the wheel */
+  if (due >= p->tick + PRESENCE_SLOTS)
+  {
+    due = p->tick + PRESENCE_SLOTS - 1;
+  }
+  slot = due & (PRESENCE_SLOTS - 1);
+  t->next = p->wheel[slot];
+  p->wheel[slot] = id;
+}
+
+static int emitEvent(Presence *p, PresenceKind kind, const PresenceTag *t, uint64_t tsMs, uint8_t fromAntenna)
+{
+  PresenceEvent ev;
+  uint32_t i;
+
+  memset(&ev, 0, sizeof(ev));
+  ev.tsMs = tsMs;
+  ev.lastMs = t->lastMs;
+  ev.kind = kind;
+  ev.antenna = t->antenna;
+  ev.fromAntenna = fromAntenna;
+  for (i = 0; i < PRESENCE_ANTENNAS; i++)
+  {
+    if (0 != t->antennas[i].lastMs && t->antennas[i].antenna == t->antenna)
+    {
+      ev.rssi = t->antennas[i].rssi;
+    }
+  }
+  ev.epcLen = t->epcLen;
+  memcpy(ev.epc, t->epc, t->epcLen);
+  return p->emit(p->cookie, &ev);
+}
+
+static PresenceAntenna *findAntenna(PresenceTag *t, uint8_t antenna)
+{
+  uint32_t i;
+
+  for (i = 0; i < PRESENCE_ANTENNAS; i++)
+  {
+    if (0 != t->antennas[i].lastMs && t->antennas[i].antenna == antenna)
+    {
+      return &t->antennas[i];
+    }
+  }
+  return NULL;
+}
+
+/* Smoothed RSSI of the tag on the read's antenna, including the read */
+static PresenceAntenna *smooth(PresenceTag *t, const ReadRecord *rec)
+{
+  PresenceAntenna *a = findAntenna(t, rec->antenna);
+  uint32_t i;
+
+  if (NULL == a)
+  {
+    a = &t->antennas[0];
+    for (i = 1; i < PRESENCE_ANTENNAS; i++)
+    {
+      if (t->antennas[i].lastMs < a->lastMs)
+      {
+        a = &t->antennas[i];
+      }
+    }
+    a->antenna = rec->antenna;
+    a->rssi = rec->rssi;
+  }
+  else
+  {
+    a->rssi += PRESENCE_ALPHA * (rec->rssi - a->rssi);
+  }
+  if (rec->tsMs > a->lastMs)
+  {
+    a->lastMs = rec->tsMs;
+  }
+  return a;
+}
+
+static int advance(Presence *p, uint64_t nowMs);
+
+int presenceRead(Presence *p, const ReadRecord *rec)
+{
+  PresenceTag *t;
+  PresenceAntenna *a;
+  PresenceAntenna *cur;
+  uint32_t *number;
+  uint32_t id;
+  bool created;
+
+  if (rec->epcLen > EPC_TABLE_KEY_MAX)
+  {
+    p->skipped++;
+    return 0;
+  }
+  if (rec->tsMs > p->latestMs)
+  {
+    p->latestMs = rec->tsMs;
+  }
+  if (0 == p->tick)
+  {
+    p->tick = rec->tsMs / p->tickMs;
+  }
+  /*
+   * A steady stream may never leave the caller idle enough to tick, so
+   * reads move the wheel along too, on reader time alone.
+   */
+  else if (p->latestMs / p->tickMs > p->tick && 0 != advance(p, p->latestMs))
+  {
+    return -1;
+  }
+  number = epcTableInsert(&p->index, rec->epc, rec->epcLen, &created);
+  if (NULL == number)
+  {
+    return -1;
+  }
+  if (created)
+  {
+    id = allocTag(p);
+    if (PRESENCE_NIL == id)
+    {
+      epcTableRemove(&p->index, number);
+      return -1;
+    }
+    *number = id;
+    t = &p->tags[id];
+    memset(t, 0, sizeof(*t));
+    t->epcLen = rec->epcLen;
+    memcpy(t->epc, rec->epc, rec->epcLen);
+    t->lastMs = rec->tsMs;
+    schedule(p, id);
+    if (++p->tracked > p->highWater)
+    {
+      p->highWater = p->tracked;
+    }
+  }
+  else
+  {
+    t = &p->tags[*number];
+  }
+  if (rec->tsMs > t->lastMs)
+  {
+    t->lastMs = rec->tsMs;
+  }
+  a = smooth(t, rec);
+
+  if (!t->present)
+  {
+    if (a->rssi < p->arriveRssi)
+    {
+      return 0;
+    }
+    t->present = true;
+    t->antenna = rec->antenna;
+    p->arrivals++;
+    return emitEvent(p, PRESENCE_ARRIVE, t, rec->tsMs, 0);
+  }
+  if (rec->antenna == t->antenna)
+  {
+    if (a->rssi >= p->departRssi)
+    {
+      return 0;
+    }
+    t->present = false;
+    p->departures++;
+    return emitEvent(p, PRESENCE_DEPART, t, rec->tsMs, 0);
+  }
+  cur = findAntenna(t, t->antenna);
+  if (NULL == cur || cur->lastMs + p->timeoutMs <= rec->tsMs || a->rssi >= cur->rssi + p->moveDb)
+  {
+    uint8_t from = t->antenna;
+
+    t->antenna = rec->antenna;
+    p->moves++;
+    return emitEvent(p, PRESENCE_MOVE, t, rec->tsMs, from);
+  }
+  return 0;
+}
+
+/* Not seen for the timeout: report a present tag gone and forget it */
+static int expire(Presence *p, uint32_t id, uint64_t nowMs)
+{
+  PresenceTag *t = &p->tags[id];
+  uint32_t *slot;
+  int rc = 0;
+
+  if (t->present)
+  {
+    p->departures++;
+    rc = emitEvent(p, PRESENCE_DEPART, t, nowMs, 0);
+  }
+  slot = epcTableFind(&p->index, t->epc, t->epcLen);
+  if (NULL != slot)
+  {
+    epcTableRemove(&p->index, slot);
+  }
+  t->next = p->freeList;
+  p->freeList = id;
+  p->tracked--;
+  return rc;
+}
+
+/* Run the wheel up to nowMs, timing tags out */
+static int advance(Presence *p, uint64_t nowMs)
+{
+  uint64_t target = nowMs / p->tickMs;
+  int rc = 0;
+
+  /* After a long pause one turn of the wheel visits every slot */
+  if (target > p->tick + PRESENCE_SLOTS)
+  {
+    p->tick = target - PRESENCE_SLOTS;
+  }
+  while (p->tick < target)
+  {
+    uint32_t slot;
+    uint32_t id;
+
+    p->tick++;
+    slot = p->tick & (PRESENCE_SLOTS - 1);
+    id = p->wheel[slot];
+    p->wheel[slot] = PRESENCE_NIL;
+    while (PRESENCE_NIL != id)
+    {
+      uint32_t next = p->tags[id].next;
+
+      if (p->tags[id].lastMs + p->timeoutMs > nowMs)
+      {
+        schedule(p, id);
+      }
+      else if (0 != expire(p, id, nowMs))
+      {
+        rc = -1;
+      }
+      id = next;
+    }
+  }
+  return rc;
+}
+
+int presenceTick(Presence *p)
+{
+  uint64_t mono = monotonicMs();
+
+  if (0 == p->tick)
+  {
+    return 0;
+  }
+  /* Reads move the clock; without them the host clock carries it on */
+  if (p->latestMs > p->anchorMs)
+  {
+    p->anchorMs = p->latestMs;
+    p->anchorMono = mono;
+  }
+  return advance(p, p->anchorMs + (mono - p->anchorMono));
+}
@@ -0,0 +1,109 @@
+/**
+ * Online presence engine turning reads into tag events.
+ *
+ * Per tag it keeps an EWMA of the RSSI on each antenna that saw it and
+ * when it was last seen, and emits:
+ *   ARRIVE  when the smoothed RSSI of an absent tag reaches arriveRssi
+ *   MOVE    when another antenna's smoothed RSSI beats the current one's
+ *           by moveDb, or the current antenna hasn't seen it for timeoutMs
+ *   DEPART  when the current antenna's smoothed RSSI falls below
+ *           departRssi, or the tag hasn't been seen for timeoutMs
+ * Setting departRssi below arriveRssi gives the hysteresis that keeps a
+ * tag at the edge of the field from flapping in and out.
+ *
+ * Timeouts are driven by a hashed timer wheel. A tag is put in the slot
+ * of its deadline once, and reads only update its last-seen time; when
+ * the wheel reaches the slot, a tag seen since is moved to the slot of its
+ * new deadline and any other is timed out. Reads are O(1), a tick is
+ * O(tags due in it), and a departure is reported at most one tick (a
+ * PRESENCE_SPAN-th of the timeout) after its deadline.
+ *
+ * Time is reader time: the latest read's timestamp, carried forward by
+ * the host clock while no reads arrive. Reads advance the wheel as reader
+ * time passes each tick, so timeouts fire under a steady stream of other
+ * tags' reads as well; presenceTick covers the quiet spells.
+ * @file presence.h
+ */
+
+#ifndef _PRESENCE_H
+#define _PRESENCE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "epc_table.h"
+#include "read_record.h"
+
+/* Smoothing factor of the RSSI average, weight of the newest read */
+#define PRESENCE_ALPHA (0.25f)
+/* Antennas tracked per tag; a new one replaces the longest silent */
+#define PRESENCE_ANTENNAS (4)
+/* Ticks per timeout, and wheel slots (a power of two above it) */
+#define PRESENCE_SPAN (32)
+#define PRESENCE_SLOTS (64)
+/* Tags tracked at first; the pool and table grow as needed */
+#define PRESENCE_CAPACITY (1024)
+/* No RSSI threshold: arrive on the first read, depart on timeout only */
+#define PRESENCE_ANY_RSSI (-1000)
+
+typedef struct PresenceAntenna
+{
+  uint64_t lastMs;      /* reader time it last saw the tag */
+  float rssi;           /* smoothed, dBm */
+  uint8_t antenna;      /* 0: unused */
+} PresenceAntenna;
+
+typedef struct PresenceTag
+{
+  uint64_t lastMs;      /* last read on any antenna */
+  uint32_t next;        /* next tag in the same wheel slot, or free list */
+  bool present;
+  uint8_t antenna;      /* where it is, while present */
+  uint8_t epcLen;
+  uint8_t epc[EPC_TABLE_KEY_MAX];
+  PresenceAntenna antennas[PRESENCE_ANTENNAS];
+} PresenceTag;
+
+typedef int (*PresenceEmitFn)(void *cookie, const PresenceEvent *ev);
+
+typedef struct Presence
+{
+  uint32_t timeoutMs;
+  int32_t arriveRssi;
+  int32_t departRssi;
+  int32_t moveDb;
+  uint32_t tickMs;
+  EpcTable index;       /* EPC -> tag number */
+  PresenceTag *tags;
+  uint32_t capacity;
+  uint32_t freeList;
+  uint32_t wheel[PRESENCE_SLOTS];
+  uint64_t tick;        /* last tick processed */
+  uint64_t latestMs;    /* latest read timestamp */
+  uint64_t anchorMs;    /* reader time at anchorMono */
+  uint64_t anchorMono;  /* host time the clock was last anchored */
+  PresenceEmitFn emit;
+  void *cookie;
+  uint32_t tracked;     /* tags with state */
+  uint32_t highWater;
+  uint64_t arrivals;
+  uint64_t departures;
+  uint64_t moves;
+  uint64_t skipped;     /* reads of EPCs longer than the table key */
+} Presence;
+
+int presenceInit(Presence *p, uint32_t timeoutMs, int32_t arriveRssi, int32_t departRssi, int32_t moveDb,
+                 PresenceEmitFn emit, void *cookie);
+void presenceFree(Presence *p);
+
+/**
+ * Feed a read, first timing tags out if it moves reader time past a tick.
+ * Returns 0, or -1 if emit failed.
+ */
+int presenceRead(Presence *p, const ReadRecord *rec);
+
+/** Advance the wheel to the current time, timing tags out. */
+int presenceTick(Presence *p);
+
+const char *presenceKindName(PresenceKind kind);
+
+#endif /* _PRESENCE_H */
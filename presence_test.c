@@ -0,0 +1,187 @@
+/**
+ * Checks of the presence engine on scripted reads, no reader needed.
+ *
+ * Usage: presence_test (exits 1 on the first failed check)
+ * @file presence_test.c
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "presence.h"
+
+#define TIMEOUT_MS (1000)
+#define EVENTS_MAX (64)
+
+typedef struct Script
+{
+  PresenceEvent events[EVENTS_MAX];
+  uint32_t count;
+} Script;
+
+static int failures = 0;
+
+#define check(cond, ...) \
+  do \
+  { \
+    if (!(cond)) \
+    { \
+      fprintf(stderr, "%s:%d: ", __FILE__, __LINE__); \
+      fprintf(stderr, __VA_ARGS__); \
+      fprintf(stderr, "\n"); \
+      failures++; \
+    } \
+  } while (0)
+
+static int record(void *cookie, const PresenceEvent *ev)
+{
+  Script *s = cookie;
+
+  if (s->count < EVENTS_MAX)
+  {
+    s->events[s->count] = *ev;
+  }
+  s->count++;
+  return 0;
+}
+
+static void feed(Presence *p, uint8_t id, uint8_t antenna, int8_t rssi, uint64_t tsMs)
+{
+  ReadRecord rec;
+
+  memset(&rec, 0, sizeof(rec));
+  rec.tsMs = tsMs;
+  rec.readCount = 1;
+  rec.rssi = rssi;
+  rec.antenna = antenna;
+  rec.epcLen = 12;
+  rec.epc[0] = 0xE2;
+  rec.epc[11] = id;
+  check(0 == presenceRead(p, &rec), "presenceRead failed at %llu ms", (unsigned long long)tsMs);
+}
+
+/* Events of one kind for tag id, and the timestamp of the last one */
+static uint32_t countEvents(const Script *s, PresenceKind kind, uint8_t id, uint64_t *tsMs)
+{
+  uint32_t n = 0;
+  uint32_t i;
+
+  for (i = 0; i < s->count && i < EVENTS_MAX; i++)
+  {
+    if (s->events[i].kind == kind && s->events[i].epc[11] == id)
+    {
+      n++;
+      *tsMs = s->events[i].tsMs;
+    }
+  }
+  return n;
+}
+
+/*
+ * Tag 1 leaves while tag 2 keeps being read. presenceTick is never called,
+ * as when the writer's queue never drains: the reads alone must time tag 1
+ * out within a tick of its deadline.
+ */
+static void departsUnderSteadyStream(void)
+{
+  const uint64_t start = 1700000000000ULL;
+  Presence p;
+  Script s;
+  uint64_t tsMs = 0;
+  uint64_t t;
+
+  memset(&s, 0, sizeof(s));
+  check(0 == presenceInit(&p, TIMEOUT_MS, PRESENCE_ANY_RSSI, PRESENCE_ANY_RSSI, 6, record, &s), "presenceInit");
+  for (t = 0; t <= 3000; t += 10)
+  {
+    if (t <= 500)
+    {
+      feed(&p, 1, 1, -50, start + t);
+    }
+    feed(&p, 2, 1, -50, start + t);
+  }
+  check(1 == countEvents(&s, PRESENCE_ARRIVE, 1, &tsMs), "tag 1 should arrive once");
+  check(1 == countEvents(&s, PRESENCE_DEPART, 1, &tsMs), "tag 1 should depart once");
+  check(tsMs >= start + 500 + TIMEOUT_MS && tsMs <= start + 500 + TIMEOUT_MS + p.tickMs + 10,
+        "tag 1 departed at %llu ms, deadline %u ms", (unsigned long long)(tsMs - start), 500 + TIMEOUT_MS);
+  check(0 == countEvents(&s, PRESENCE_DEPART, 2, &tsMs), "tag 2 is still being read");
+  check(1 == p.tracked, "only tag 2 should be tracked, not %u", p.tracked);
+  presenceFree(&p);
+}
+
+/* Below the depart level it leaves, and only the arrive level brings it back */
+static void hysteresis(void)
+{
+  Presence p;
+  Script s;
+  uint64_t tsMs = 0;
+  uint64_t t = 1000;
+  int i;
+
+  memset(&s, 0, sizeof(s));
+  check(0 == presenceInit(&p, TIMEOUT_MS, -60, -70, 6, record, &s), "presenceInit");
+  feed(&p, 1, 1, -65, t += 10);
+  check(0 == countEvents(&s, PRESENCE_ARRIVE, 1, &tsMs), "-65 dBm is below the arrive level");
+  for (i = 0; i < 10; i++)
+  {
+    feed(&p, 1, 1, -55, t += 10);
+  }
+  check(1 == countEvents(&s, PRESENCE_ARRIVE, 1, &tsMs), "tag should arrive once above -60 dBm");
+  /* Between the levels: still present */
+  for (i = 0; i < 10; i++)
+  {
+    feed(&p, 1, 1, -65, t += 10);
+  }
+  check(0 == countEvents(&s, PRESENCE_DEPART, 1, &tsMs), "-65 dBm is above the depart level");
+  for (i = 0; i < 10; i++)
+  {
+    feed(&p, 1, 1, -80, t += 10);
+  }
+  check(1 == countEvents(&s, PRESENCE_DEPART, 1, &tsMs), "tag should depart once below -70 dBm");
+  presenceFree(&p);
+}
+
+/* A stronger antenna takes the tag over only by the move margin */
+static void moves(void)
+{
+  Presence p;
+  Script s;
+  uint64_t tsMs = 0;
+  uint64_t t = 1000;
+  uint32_t i;
+
+  memset(&s, 0, sizeof(s));
+  check(0 == presenceInit(&p, TIMEOUT_MS, PRESENCE_ANY_RSSI, PRESENCE_ANY_RSSI, 6, record, &s), "presenceInit");
+  feed(&p, 1, 1, -60, t += 10);
+  feed(&p, 1, 2, -57, t += 10);
+  check(0 == countEvents(&s, PRESENCE_MOVE, 1, &tsMs), "3 dB stronger is within the margin");
+  feed(&p, 1, 1, -60, t += 10);
+  /* The average on antenna 2 has to climb past -54 dBm first */
+  for (i = 0; i < 4; i++)
+  {
+    feed(&p, 1, 2, -50, t += 10);
+  }
+  check(1 == countEvents(&s, PRESENCE_MOVE, 1, &tsMs), "10 dB stronger should move the tag");
+  for (i = 0; i < s.count && i < EVENTS_MAX; i++)
+  {
+    if (PRESENCE_MOVE == s.events[i].kind)
+    {
+      check(1 == s.events[i].fromAntenna && 2 == s.events[i].antenna, "move should be from 1 to 2");
+    }
+  }
+  presenceFree(&p);
+}
+
+int main(void)
+{
+  departsUnderSteadyStream();
+  hysteresis();
+  moves();
+  if (0 != failures)
+  {
+    fprintf(stderr, "%d presence checks failed\n", failures);
+    return 1;
+  }
+  printf("presence checks passed\n");
+  return 0;
+}
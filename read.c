@@ -5,6 +5,7 @@
  */
 
 #include <tm_reader.h>
+#include "sim_reader.h"
 #include <time.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -29,7 +30,7 @@
 #define numberof(x) (sizeof((x))/sizeof((x)[0]))
 
 #define usage() {errx(1, "Please provide valid reader URL, such as: reader-uri [--ant n] [--pow read_power]\n"\
-                         "reader-uri : e.g., 'tmr:///COM1' or 'tmr:///dev/ttyS0/' or 'tmr://readerIP'\n"\
+                         "reader-uri : e.g., 'tmr:///COM1' or 'tmr:///dev/ttyS0/' or 'tmr://readerIP' or 'sim://?tags=50&rate=2000' (simulated)\n"\
                          "[--ant n] : e.g., '--ant 1'\n"\
                          "[--pow read_power] : e.g, '--pow 2300'\n"\
                          "Example for UHF modules: 'tmr:///com4' or 'tmr:///com4 --ant 1,2' or 'tmr:///com4 --ant 1,2 --pow 2300'\n"\
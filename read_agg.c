@@ -0,0 +1,164 @@
+/**
+ * Per-tag aggregation of reads into fixed windows.
+ * @file read_agg.c
+ */
+
+#include <string.h>
+#include "read_agg.h"
+#include "time_util.h"
+
+/* Value of a tag's EpcTable entry; 80 bytes, two cache lines with the key */
+typedef struct ReadAggEntry
+{
+  uint64_t firstMs;
+  uint64_t lastMs;
+  int64_t rssiSum;
+  uint32_t reads;
+  uint32_t readCount;
+  uint32_t antennas;
+  uint32_t frequency[READ_AGG_FREQS];
+  uint32_t votes[READ_AGG_FREQS];
+  int32_t power;
+  int16_t rssiMin;
+  int16_t rssiMax;
+  uint8_t protocol;
+} ReadAggEntry;
+
+int readAggInit(ReadAgg *agg, uint32_t windowMs)
+{
+  memset(agg, 0, sizeof(*agg));
+  agg->windowMs = windowMs ? windowMs : 1;
+  return epcTableInit(&agg->tags, READ_AGG_CAPACITY, sizeof(ReadAggEntry));
+}
+
+void readAggFree(ReadAgg *agg)
+{
+  epcTableFree(&agg->tags);
+}
+
+/* Space-saving: an unseen frequency takes over the least counted slot */
+static void voteFrequency(ReadAggEntry *e, uint32_t frequency)
+{
+  uint32_t least = 0;
+  uint32_t i;
+
+  for (i = 0; i < READ_AGG_FREQS; i++)
+  {
+    if (e->frequency[i] == frequency && 0 != e->votes[i])
+    {
+      e->votes[i]++;
+      return;
+    }
+    if (e->votes[i] < e->votes[least])
+    {
+      least = i;
+    }
+  }
+  e->frequency[least] = frequency;
+  e->votes[least]++;
+}
+
+int readAggAdd(ReadAgg *agg, const ReadRecord *rec)
+{
+  ReadAggEntry *e;
+  bool created;
+
+  if (rec->epcLen > EPC_TABLE_KEY_MAX)
+  {
+    return -1;
+  }
+  e = epcTableInsert(&agg->tags, rec->epc, rec->epcLen, &created);
+  if (NULL == e)
+  {
+    return -1;
+  }
+  if (1 == agg->tags.count && created)
+  {
+    agg->startMs = rec->tsMs - rec->tsMs % agg->windowMs;
+  }
+  agg->mergedMs = monotonicMs();
+  if (created)
+  {
+    e->firstMs = rec->tsMs;
+    e->rssiMin = rec->rssi;
+    e->rssiMax = rec->rssi;
+  }
+  else
+  {
+    e->firstMs = rec->tsMs < e->firstMs ? rec->tsMs : e->firstMs;
+    e->rssiMin = rec->rssi < e->rssiMin ? rec->rssi : e->rssiMin;
+    e->rssiMax = rec->rssi > e->rssiMax ? rec->rssi : e->rssiMax;
+  }
+  e->lastMs = rec->tsMs > e->lastMs ? rec->tsMs : e->lastMs;
+  e->rssiSum += rec->rssi;
+  e->reads++;
+  e->readCount += rec->readCount;
+  if (rec->antenna >= 1 && rec->antenna <= 32)
+  {
+    e->antennas |= 1u << (rec->antenna - 1);
+  }
+  voteFrequency(e, rec->frequency);
+  e->power = rec->power;
+  e->protocol = rec->protocol;
+  agg->reads++;
+  return 0;
+}
+
+bool readAggDue(const ReadAgg *agg, const ReadRecord *next)
+{
+  if (0 == agg->tags.count)
+  {
+    return false;
+  }
+  if (NULL != next && next->tsMs >= agg->startMs + agg->windowMs)
+  {
+    return true;
+  }
+  return monotonicMs() - agg->mergedMs >= agg->windowMs;
+}
+
+bool readAggNext(ReadAgg *agg, uint32_t *pos, ReadSummary *sum)
+{
+  const ReadAggEntry *e = epcTableNext(&agg->tags, pos);
+  const EpcKey *key;
+  uint32_t best = 0;
+  uint32_t i;
+
+  if (NULL == e)
+  {
+    return false;
+  }
+  key = epcTableKey(&agg->tags, e);
+  for (i = 1; i < READ_AGG_FREQS; i++)
+  {
+    if (e->votes[i] > e->votes[best])
+    {
+      best = i;
+    }
+  }
+  sum->windowMs = agg->startMs;
+  sum->firstMs = e->firstMs;
+  sum->lastMs = e->lastMs;
+  sum->reads = e->reads;
+  sum->readCount = e->readCount;
+  sum->rssiMin = e->rssiMin;
+  sum->rssiMax = e->rssiMax;
+  sum->rssiMean = (double)e->rssiSum / e->reads;
+  sum->antennas = e->antennas;
+  sum->frequency = e->frequency[best];
+  sum->power = e->power;
+  sum->protocol = e->protocol;
+  sum->epcLen = key->len;
+  memcpy(sum->epc, key->epc, key->len);
+  agg->summaries++;
+  return true;
+}
+
+void readAggClear(ReadAgg *agg)
+{
+  if (0 != agg->tags.count)
+  {
+    agg->windows++;
+  }
+  epcTableClear(&agg->tags);
+}
@@ -0,0 +1,73 @@
+/**
+ * Per-tag aggregation of reads into fixed windows.
+ *
+ * Instead of a row per read, a window keeps one entry per tag in an
+ * EpcTable: first and last read, read count, RSSI range and sum, the
+ * antennas that saw the tag and the frequencies it was read on. Entries
+ * are fixed-size and stored inline, so merging a read is one hash probe
+ * and no allocation. When the window is over every entry becomes one
+ * ReadSummary and the table is cleared for the next window.
+ *
+ * Windows are aligned to multiples of their length in reader time. One
+ * is over when a read past its end arrives, or, when the tags go quiet,
+ * once no read has been merged for a window length. Waiting that long
+ * rather than for the end of the window lets reads that the reader
+ * delivers late still land in it.
+ *
+ * The dominant frequency is tracked with READ_AGG_FREQS counters per tag
+ * (space-saving): exact when a tag is read on at most that many
+ * frequencies in a window, otherwise the heaviest one is still found when
+ * it stands out.
+ * @file read_agg.h
+ */
+
+#ifndef _READ_AGG_H
+#define _READ_AGG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "epc_table.h"
+#include "read_record.h"
+
+/* Tags per window the table starts with; it grows past this as needed */
+#define READ_AGG_CAPACITY (1024)
+/* Frequency counters per tag */
+#define READ_AGG_FREQS (4)
+
+typedef struct ReadAgg
+{
+  EpcTable tags;        /* EPC -> ReadAggEntry */
+  uint64_t windowMs;    /* window length */
+  uint64_t startMs;     /* reader time the open window started at */
+  uint64_t mergedMs;    /* monotonic time of the last read merged */
+  uint64_t reads;       /* merged so far, all windows */
+  uint64_t summaries;   /* produced so far */
+  uint64_t windows;     /* closed so far */
+} ReadAgg;
+
+int readAggInit(ReadAgg *agg, uint32_t windowMs);
+void readAggFree(ReadAgg *agg);
+
+/**
+ * Merge a read into the open window, opening one if needed. Returns 0,
+ * or -1 if the read can't be aggregated (an EPC longer than the table
+ * key, or no memory) and should be stored as it is.
+ */
+int readAggAdd(ReadAgg *agg, const ReadRecord *rec);
+
+/**
+ * Whether the open window is over: next, the read about to be merged, is
+ * past its end, or nothing was merged for windowMs. next may be NULL.
+ */
+bool readAggDue(const ReadAgg *agg, const ReadRecord *next);
+
+/**
+ * Summaries of the open window: start with *pos = 0, returns false after
+ * the last one.
+ */
+bool readAggNext(ReadAgg *agg, uint32_t *pos, ReadSummary *sum);
+
+/** Close the window once its summaries are stored. */
+void readAggClear(ReadAgg *agg);
+
+#endif /* _READ_AGG_H */
@@ -6,8 +6,13 @@
 
 #include <unistd.h>
 #include <sys/select.h>
+#include <sys/stat.h>
 #include <termios.h>
+#include <signal.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <tm_reader.h>
+#include "sim_reader.h"
 #include <time.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -15,6 +20,21 @@
 #include <string.h>
 #include <inttypes.h>
 #include <sqlite3.h>
+#include "db_sink.h"
+#include "read_log.h"
+#include "read_pack.h"
+#include "rotate.h"
+#include "read_queue.h"
+#include "read_agg.h"
+#include "read_dedup.h"
+#include "presence.h"
+#include "epc_table.h"
+#include "epc_match.h"
+#include "capture.h"
+#include "replay_transport.h"
+#include "trace_ring.h"
+#include "hot_stats.h"
+#include "time_util.h"
 #ifdef TMR_ENABLE_HF_LF
 #include <tmr_utils.h>
 #endif /* TMR_ENABLE_HF_LF */
@@ -33,17 +53,184 @@
 #define numberof(x) (sizeof((x))/sizeof((x)[0]))
 
 #define usage() {errx(1, "Please provide valid reader URL, such as: reader-uri [--ant n] [--pow read_power]\n"\
-                         "reader-uri : e.g., 'tmr:///COM1' or 'tmr:///dev/ttyS0/' or 'tmr://readerIP'\n"\
+                         "reader-uri : e.g., 'tmr:///COM1' or 'tmr:///dev/ttyS0/' or 'tmr://readerIP' or 'sim://?tags=50&rate=2000' (simulated)\n"\
                          "[--ant n] : e.g., '--ant 1'\n"\
                          "[--pow read_power] : e.g, '-pow 3150'\n"\
                          "[--time reading_time] : e.g, '--time 10 (seconds)'\n"\
+                         "[--stop quiet_ms[,tags]] : e.g, '--stop 1000,250 (stop before --time once no new tag is read for 1 s or 250 are found; tags defaults to the --tags lines that are whole EPCs, 96 bits or more, 0: none)'\n"\
                          "[--file file_name] : e.g, '--file database.db'\n"\
+                         "[--append 0|1] : e.g, '--append 1' (add to --file and its sessions table instead of recreating it)\n"\
+                         "[--dedup ms] : e.g, '--dedup 1000 (drop repeat reads of a tag on an antenna within this long, adding up their read counts)'\n"\
+                         "[--presence ms[,arrive,depart,move]] : e.g, '--presence 3000,-65,-72,6 (ARRIVE/MOVE/DEPART events rows: gone after 3 s unseen or below -72 dBm, in at -65 dBm, moved when another antenna is 6 dB stronger)'\n"\
+                         "[--aggregate ms] : e.g, '--aggregate 60000 (one summaries row per tag and minute instead of a ToP row per read)'\n"\
+                         "[--log dir] : e.g, '--log /data/reads (binary read log segments instead of --file, see read_log_dump)'\n"\
+                         "[--pack dir] : e.g, '--pack /data/reads (compressed read log segments instead of --file)'\n"\
+                         "[--segment MB] : e.g, '--segment 64 (size of each --log or --pack segment, or of --file databases)'\n"\
+                         "[--rotate minutes] : e.g, '--rotate 60 (start a new timestamped database or log segment every hour)'\n"\
+                         "[--budget MB] : e.g, '--budget 4096 (delete the oldest segments past this much disk)'\n"\
                          "[--tags file_name] : e.g, '--tags tags.txt'\n"\
                          "[--reg region] : e.g, '--reg 1 (Europe) 2 (USA)'\n"\
+                         "[--batch rows] : e.g, '--batch 500 (rows per transaction)'\n"\
+                         "[--flush ms] : e.g, '--flush 1000 (max ms before a commit)'\n"\
+                         "[--queue records] : e.g, '--queue 8192 (reader to writer queue size)'\n"\
+                         "[--async on,off] : e.g, '--async 250,0 (continuous reading, on/off ms)'\n"\
+                         "[--select 0|1] : e.g, '--select 0 (don't push --tags prefixes to the reader)'\n"\
+                         "[--capture file_name] : e.g, '--capture portal.cap (record serial traffic, replay with replay:///portal.cap[?realtime])'\n"\
+                         "[--trace prefix] : e.g, '--trace /var/log/m6e (keep recent serial traffic in memory, dumped on SIGUSR1 or error)'\n"\
+                         "[--stats dir] : e.g, '--stats /var/lib/node_exporter (write m6e_read_cont.prom for the textfile collector)'\n"\
+                         "[--statsms ms] : e.g, '--statsms 10000 (how often the stats file is rewritten)'\n"\
                          "Example for UHF modules: 'tmr:///com4' or 'tmr:///com4 --ant 1,2' or 'tmr:///com4 --ant 1,2 --pow 2300'\n"\
                          "Example for HF/LF modules: 'tmr:///com4' \n");}
 
+/* How long the writer sleeps when the queue is empty */
+#define WRITER_IDLE_MS 2
+/* Gaps between reads longer than this are counted as dead radio time */
+#define LONG_GAP_US 100000
+/* More prefixes than this are merged into one Select on their common bits */
+#define MAX_SELECT_PLANS 8
+/* EPC memory bank: CRC and PC words come before the EPC itself */
+#define EPC_BIT_POINTER 32
+/* Name of the --stats file, *.prom as the node_exporter textfile collector expects */
+#define STATS_FILE "m6e_read_cont.prom"
+
+/* Where the writer stores reads */
+typedef enum Store
+{
+  STORE_DB,             /* --file */
+  STORE_LOG,            /* --log */
+  STORE_PACK,           /* --pack */
+} Store;
+
+/**
+ * The reader thread only pushes matching tags into the queue; the writer
+ * thread owns the database handle and does all printing and inserting, so
+ * a slow disk never delays the next TMR_read.
+ */
+typedef struct Writer
+{
+  pthread_t thread;
+  bool running;
+  ReadQueue queue;
+  Store store;
+  DbSink sink;
+  ReadLog log;
+  ReadPack pack;
+  atomic_bool done;     /* set by the reader, nothing more will be queued */
+  atomic_bool failed;   /* set by the writer on a storage error */
+  uint64_t *pendingTsMs; /* reader timestamps of the rows not yet committed */
+  uint32_t pendingCount;
+  uint64_t commits;     /* sink commits already accounted for */
+  Rotator rotator;      /* finishes old segments and keeps the --budget */
+  bool dbRotate;        /* --file names timestamped databases */
+  char dbDir[256];
+  char dbPrefix[64];
+  char dbPath[300];     /* open database */
+  uint32_t batchRows;
+  uint32_t batchMs;
+  uint64_t dbBytes;     /* --segment for databases, 0: no limit */
+  uint64_t dbRows;      /* rows and commits of finished databases */
+  uint64_t dbCommits;
+  uint64_t sizeChecked; /* commits when the database size was last checked */
+  uint64_t rotateMs;    /* --rotate, 0: only when a segment is full */
+  uint64_t openedMs;    /* when the open segment was started */
+  uint64_t openedRows;  /* rows committed before it */
+  uint32_t rotations;
+  bool append;          /* --append: add to --file instead of recreating it */
+  DbSession session;    /* filled in by the reader before it queues anything */
+  atomic_bool sessionReady;
+  bool sessionBegun;    /* sessions row written to the open database */
+  bool aggregate;       /* --aggregate: summaries rows instead of ToP rows */
+  ReadAgg agg;
+  bool deduplicate;     /* --dedup: one record per tag, antenna and window */
+  ReadDedup dedup;
+  bool presenceOn;      /* --presence: events rows as tags come and go */
+  Presence presence;
+} Writer;
+
+/**
+ * Where time goes on the hot path, kept by the thread that does each step
+ * (reader loop or read listener, and writer) and exported by --stats.
+ */
+typedef struct HotPathStats
+{
+  HotHistogram readNs;          /* TMR_read */
+  HotHistogram tagsPerRead;
+  HotHistogram nextTagNs;       /* TMR_getNextTag */
+  HotHistogram insertNs;        /* sink insert, including the commits it runs */
+  HotHistogram commitLagUs;     /* reader timestamp to committed row */
+  HotCounter matched;           /* tags passing the --tags filter */
+  HotCounter rejected;
+  HotCounter bufferFull;        /* TMR_ERROR_TAG_ID_BUFFER_FULL */
+  HotCounter errors;
+  HotCounter rows;              /* rows committed */
+} HotPathStats;
+
+/**
+ * Raw read statistics, to compare the polling and continuous reading
+ * paths. Only touched by whichever thread delivers tags.
+ */
+typedef struct ReadStats
+{
+  uint64_t startUs;
+  uint64_t lastUs;
+  uint64_t reads;
+  uint64_t maxGapUs;
+  uint64_t gapSumUs;
+  uint64_t longGaps;
+  EpcTable unique;
+  atomic_uint found;            /* unique tags passing the --tags filter */
+  _Atomic uint64_t lastNewUs;   /* when the last of them was first read */
+} ReadStats;
+
+/* Everything the per-tag path needs, shared by TMR_read and the read listener */
+typedef struct ReadContext
+{
+  EpcPrefixSet prefixes;
+  int readpower;
+  ReadStats stats;
+  uint64_t quietUs;     /* --stop: no new tag for this long, 0: never */
+  uint32_t expected;    /* --stop: tags to find, 0: unknown */
+} ReadContext;
+
+/**
+ * Gen2 Select filters built from the --tags prefixes, so only tags we
+ * keep backscatter. The read plan points into this, so it must live as
+ * long as the reader.
+ */
+typedef struct SelectPlan
+{
+  uint32_t count;
+  uint16_t bits[MAX_SELECT_PLANS];
+  uint8_t mask[MAX_SELECT_PLANS][EPC_PREFIX_MAX];
+  TMR_TagFilter filter[MAX_SELECT_PLANS];
+  TMR_ReadPlan subPlan[MAX_SELECT_PLANS];
+  TMR_ReadPlan *subPlanList[MAX_SELECT_PLANS];
+} SelectPlan;
+
 struct termios orig_termios;
+static Writer writer;
+static SelectPlan selects;
+static volatile sig_atomic_t stopRequested = 0;
+
+/* Serial trace, NULL unless --trace */
+static TraceRing trace;
+static TraceRing *activeTrace = NULL;
+
+static HotPathStats hot;
+static HotExporter exporter;
+
+void onSignal(int signo)
+{
+  stopRequested = 1;
+}
+
+void onDumpSignal(int signo)
+{
+  if (NULL != activeTrace)
+  {
+    traceRingRequestDump(activeTrace, TRACE_DUMP_SIGNAL);
+  }
+}
 
 void reset_terminal_mode()
 {
@@ -100,28 +287,46 @@ void checkerr(TMR_Reader* rp, TMR_Status ret, int exitval, const char *msg)
 #ifndef BARE_METAL
   if (TMR_SUCCESS != ret)
   {
+    if (NULL != activeTrace)
+    {
+      traceRingDump(activeTrace, TRACE_DUMP_ERROR);
+    }
     errx(exitval, "Error %s: %s\n", msg, TMR_strerr(rp, ret));
   }
 #endif /* BARE_METAL */
 }
 
 #ifdef USE_TRANSPORT_LISTENER
+/* Formats the whole frame into one buffer and writes it once */
 void serialPrinter(bool tx, uint32_t dataLen, const uint8_t data[],
                    uint32_t timeout, void *cookie)
 {
+  static const char digits[] = "0123456789abcdef";
   FILE *out = cookie;
+  char line[16 + 4 * 256];
+  char *p = line;
   uint32_t i;
 
-  fprintf(out, "%s", tx ? "Sending: " : "Received:");
+  memcpy(p, tx ? "Sending: " : "Received:", 9);
+  p += 9;
   for (i = 0; i < dataLen; i++)
   {
+    if (p > line + sizeof(line) - 16)
+    {
+      fwrite(line, 1, p - line, out);
+      p = line;
+    }
     if (i > 0 && (i & 15) == 0)
     {
-      fprintf(out, "\n         ");
+      memcpy(p, "\n         ", 10);
+      p += 10;
     }
-    fprintf(out, " %02x", data[i]);
+    *p++ = ' ';
+    *p++ = digits[data[i] >> 4];
+    *p++ = digits[data[i] & 0xF];
   }
-  fprintf(out, "\n");
+  *p++ = '\n';
+  fwrite(line, 1, p - line, out);
 }
 
 void stringPrinter(bool tx,uint32_t dataLen, const uint8_t data[],uint32_t timeout, void *cookie)
@@ -205,49 +410,783 @@ void getTimeStamp(struct TMR_Reader *rp, const struct TMR_TagReadData *read, cha
     end = timeStr;
     end += strftime(end, timeEnd-end, "%H:%M:%S", localtime(&seconds));
   }
-  memcpy(timeString, timeStr, (sizeof(timeStr)/sizeof(timeStr[0])));
-}
-
-int get_lines(char *file)
-{
-    FILE * fp;
-    char *line = NULL;
-    size_t len = 0;
-    ssize_t read;
-    int i = 0;
-    fp = fopen(file, "r");
-    if (fp == NULL)
-        exit(EXIT_FAILURE);
-    while ((read = getline(&line, &len, fp)) != -1) {
-      i++;
+  memcpy(timeString, timeStr, (sizeof(timeStr)/sizeof(timeStr[0])));
+}
+
+void printRecord(const ReadRecord *rec)
+{
+  char idStr[128];
+  char timeStr[32];
+  time_t seconds = rec->tsMs / 1000;
+
+  TMR_bytesToHex(rec->epc, rec->epcLen, idStr);
+  strftime(timeStr, sizeof(timeStr), "%H:%M:%S", localtime(&seconds));
+  printf("%s | %d | %d | %d | %d | %d | %s\n", idStr, rec->power, rec->rssi, rec->phase, rec->frequency, rec->antenna, timeStr);
+}
+
+int writerInsert(Writer *w, const ReadRecord *rec)
+{
+  switch (w->store)
+  {
+  case STORE_LOG:
+    return readLogAppend(&w->log, rec);
+  case STORE_PACK:
+    return readPackAppend(&w->pack, rec);
+  default:
+    return SQLITE_OK == dbSinkInsert(&w->sink, rec) ? 0 : -1;
+  }
+}
+
+int writerPoll(Writer *w)
+{
+  switch (w->store)
+  {
+  case STORE_LOG:
+    return readLogPoll(&w->log);
+  case STORE_PACK:
+    return readPackPoll(&w->pack);
+  default:
+    return SQLITE_OK == dbSinkPoll(&w->sink) ? 0 : -1;
+  }
+}
+
+void writerClose(Writer *w)
+{
+  switch (w->store)
+  {
+  case STORE_LOG:
+    readLogClose(&w->log);
+    break;
+  case STORE_PACK:
+    readPackClose(&w->pack);
+    break;
+  default:
+    dbSinkClose(&w->sink);
+    break;
+  }
+}
+
+uint64_t writerCommits(const Writer *w)
+{
+  switch (w->store)
+  {
+  case STORE_LOG:
+    return w->log.commits;
+  case STORE_PACK:
+    return w->pack.commits;
+  default:
+    return w->dbCommits + w->sink.commits;
+  }
+}
+
+uint64_t writerRows(const Writer *w)
+{
+  switch (w->store)
+  {
+  case STORE_LOG:
+    return w->log.rows;
+  case STORE_PACK:
+    return w->pack.rows;
+  default:
+    return w->dbRows + w->sink.rows;
+  }
+}
+
+uint32_t writerBatchRows(const Writer *w)
+{
+  switch (w->store)
+  {
+  case STORE_LOG:
+    return w->log.batchRows;
+  case STORE_PACK:
+    return w->pack.batchRows;
+  default:
+    return w->sink.batchRows;
+  }
+}
+
+/* Once the sink has committed, every row inserted so far is durable */
+void noteCommitted(Writer *w)
+{
+  uint64_t now;
+  uint32_t i;
+
+  if (writerCommits(w) == w->commits)
+  {
+    return;
+  }
+  now = wallUs();
+  for (i = 0; i < w->pendingCount; i++)
+  {
+    uint64_t tsUs = w->pendingTsMs[i] * 1000;
+
+    hotRecord(&hot.commitLagUs, now > tsUs ? now - tsUs : 0);
+  }
+  hotAdd(&hot.rows, w->pendingCount);
+  w->pendingCount = 0;
+  w->commits = writerCommits(w);
+}
+
+/* Remember when a row was read, to time its commit */
+void notePending(Writer *w, uint64_t tsMs)
+{
+  /* A commit happens at the latest on the batchRows-th pending row */
+  if (w->pendingCount < writerBatchRows(w))
+  {
+    w->pendingTsMs[w->pendingCount++] = tsMs;
+  }
+}
+
+/* Store a summaries row per tag of the window and start the next one */
+int writerSummarize(Writer *w)
+{
+  ReadSummary sum;
+  uint32_t pos = 0;
+
+  while (readAggNext(&w->agg, &pos, &sum))
+  {
+    notePending(w, sum.lastMs);
+    if (SQLITE_OK != dbSinkInsertSummary(&w->sink, &sum))
+    {
+      return -1;
+    }
+    noteCommitted(w);
+  }
+  readAggClear(&w->agg);
+  return 0;
+}
+
+/* Merge a read into its tag's summary, closing the window first if it is over */
+int writerAggregate(Writer *w, const ReadRecord *rec)
+{
+  if (readAggDue(&w->agg, rec) && 0 != writerSummarize(w))
+  {
+    return -1;
+  }
+  if (0 == readAggAdd(&w->agg, rec))
+  {
+    return 0;
+  }
+  /* EPCs too long to aggregate are stored as they are */
+  notePending(w, rec->tsMs);
+  return writerInsert(w, rec);
+}
+
+/* Without rotation this is just --file, recreated */
+int openDatabase(Writer *w)
+{
+  if (w->dbRotate && 0 != rotateName(w->dbPath, sizeof(w->dbPath), w->dbDir, w->dbPrefix, ".db"))
+  {
+    fprintf(stderr, "Database name too long: %s/%s\n", w->dbDir, w->dbPrefix);
+    return -1;
+  }
+  if (SQLITE_OK != dbSinkOpen(&w->sink, w->dbPath, w->append, w->batchRows, w->batchMs))
+  {
+    return -1;
+  }
+  /* A rotated database gets its own copy of the run's sessions row */
+  if (w->sessionBegun && SQLITE_OK != dbSinkBeginSession(&w->sink, &w->session))
+  {
+    dbSinkClose(&w->sink);
+    return -1;
+  }
+  return 0;
+}
+
+/* Sessions are only recorded in databases; log segments don't carry them */
+int writerBeginSession(Writer *w)
+{
+  w->sessionBegun = true;
+  if (STORE_DB != w->store)
+  {
+    return 0;
+  }
+  return SQLITE_OK == dbSinkBeginSession(&w->sink, &w->session) ? 0 : -1;
+}
+
+/* Builds the index and closes an old database, on the rotator thread */
+void finishDatabase(void *segment)
+{
+  dbSinkClose(segment);
+  free(segment);
+}
+
+/* Commit, then carry on in a new database while the rotator closes the old one */
+int rotateDatabase(Writer *w)
+{
+  DbSink *old = malloc(sizeof(*old));
+
+  if (NULL == old || SQLITE_OK != dbSinkFlush(&w->sink))
+  {
+    free(old);
+    return -1;
+  }
+  noteCommitted(w);
+  *old = w->sink;
+  if (0 != openDatabase(w))
+  {
+    w->sink = *old;
+    free(old);
+    return -1;
+  }
+  w->dbRows += old->rows;
+  w->dbCommits += old->commits;
+  rotatorRetire(&w->rotator, finishDatabase, old);
+  return 0;
+}
+
+/*
+ * Time for a new segment: --rotate has elapsed, or a database has grown
+ * past --segment (checked once per commit). Segments without a committed
+ * row are never rotated, so an idle reader doesn't leave empty files.
+ */
+bool rotationDue(Writer *w)
+{
+  struct stat st;
+  char wal[310];
+  uint64_t size;
+
+  if (writerRows(w) == w->openedRows)
+  {
+    return false;
+  }
+  if (0 != w->rotateMs && monotonicUs() / 1000 - w->openedMs >= w->rotateMs)
+  {
+    return true;
+  }
+  if (STORE_DB != w->store || 0 == w->dbBytes || writerCommits(w) == w->sizeChecked)
+  {
+    return false;
+  }
+  w->sizeChecked = writerCommits(w);
+  if (0 != stat(w->dbPath, &st))
+  {
+    return false;
+  }
+  size = st.st_size;
+  /* Committed rows sit in the WAL until the next checkpoint */
+  snprintf(wal, sizeof(wal), "%s-wal", w->dbPath);
+  if (0 == stat(wal, &st))
+  {
+    size += st.st_size;
+  }
+  return size >= w->dbBytes;
+}
+
+int writerRotate(Writer *w)
+{
+  int rc;
+
+  switch (w->store)
+  {
+  case STORE_LOG:
+    rc = readLogRotate(&w->log);
+    break;
+  case STORE_PACK:
+    rc = readPackRotate(&w->pack);
+    break;
+  default:
+    rc = rotateDatabase(w);
+    break;
+  }
+  noteCommitted(w);
+  w->openedMs = monotonicUs() / 1000;
+  w->openedRows = writerRows(w);
+  w->rotations++;
+  return rc;
+}
+
+/* Print and store a record that made it past --dedup */
+int writerStore(Writer *w, const ReadRecord *rec)
+{
+  uint64_t startNs;
+  int rc;
+
+  /* The reader describes the session before it queues the first record */
+  if (!w->sessionBegun && atomic_load(&w->sessionReady) && 0 != writerBeginSession(w))
+  {
+    return -1;
+  }
+  printRecord(rec);
+  startNs = hotNowNs();
+  if (w->aggregate)
+  {
+    rc = writerAggregate(w, rec);
+  }
+  else
+  {
+    notePending(w, rec->tsMs);
+    rc = writerInsert(w, rec);
+  }
+  hotRecord(&hot.insertNs, hotNowNs() - startNs);
+  return rc;
+}
+
+/* Print and store a --presence event */
+int writerEvent(void *cookie, const PresenceEvent *ev)
+{
+  Writer *w = cookie;
+  char idStr[128];
+
+  if (!w->sessionBegun && atomic_load(&w->sessionReady) && 0 != writerBeginSession(w))
+  {
+    return -1;
+  }
+  TMR_bytesToHex(ev->epc, ev->epcLen, idStr);
+  if (PRESENCE_MOVE == ev->kind)
+  {
+    printf("%s %s | ant %u -> %u | %.1f\n", presenceKindName(ev->kind), idStr, ev->fromAntenna, ev->antenna, ev->rssi);
+  }
+  else
+  {
+    printf("%s %s | ant %u | %.1f\n", presenceKindName(ev->kind), idStr, ev->antenna, ev->rssi);
+  }
+  notePending(w, ev->tsMs);
+  return SQLITE_OK == dbSinkInsertEvent(&w->sink, ev) ? 0 : -1;
+}
+
+/* Store the held records whose --dedup window is over */
+int writerRelease(Writer *w, ReadDedupRelease release)
+{
+  ReadRecord rec;
+
+  while (readDedupNext(&w->dedup, release, &rec))
+  {
+    if (0 != writerStore(w, &rec))
+    {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+void *writerMain(void *arg)
+{
+  Writer *w = arg;
+  ReadRecord rec;
+
+  for (;;)
+  {
+    /* Sample the flag first so records queued before it was set are drained */
+    bool done = atomic_load(&w->done);
+    bool idle = true;
+
+    while (readQueuePop(&w->queue, &rec))
+    {
+      int rc;
+
+      idle = false;
+      /* Presence sees every read, repeats included, to smooth the RSSI */
+      if (w->presenceOn && 0 != presenceRead(&w->presence, &rec))
+      {
+        atomic_store(&w->failed, true);
+        break;
+      }
+      if (w->deduplicate && 0 == readDedupAdd(&w->dedup, &rec))
+      {
+        rc = writerRelease(w, READ_DEDUP_EXPIRED);
+      }
+      else
+      {
+        rc = writerStore(w, &rec);
+      }
+      if (0 != rc)
+      {
+        atomic_store(&w->failed, true);
+        break;
+      }
+      noteCommitted(w);
+      /* Under a steady stream the queue never drains, so check here too */
+      if (rotationDue(w) && 0 != writerRotate(w))
+      {
+        atomic_store(&w->failed, true);
+        break;
+      }
+    }
+    if (w->deduplicate && 0 != writerRelease(w, done ? READ_DEDUP_ALL : READ_DEDUP_QUIET))
+    {
+      atomic_store(&w->failed, true);
+      break;
+    }
+    if (w->presenceOn && 0 != presenceTick(&w->presence))
+    {
+      atomic_store(&w->failed, true);
+      break;
+    }
+    /* Tags gone quiet: the window still closes */
+    if (w->aggregate && (done || readAggDue(&w->agg, NULL)) && 0 != writerSummarize(w))
+    {
+      atomic_store(&w->failed, true);
+      break;
+    }
+    if (atomic_load(&w->failed) || 0 != writerPoll(w))
+    {
+      atomic_store(&w->failed, true);
+      break;
+    }
+    noteCommitted(w);
+    if (rotationDue(w) && 0 != writerRotate(w))
+    {
+      atomic_store(&w->failed, true);
+      break;
+    }
+    if (done)
+    {
+      /* A run without reads still leaves its sessions row */
+      if (!w->sessionBegun && atomic_load(&w->sessionReady))
+      {
+        writerBeginSession(w);
+      }
+      break;
+    }
+    if (idle)
+    {
+      tmr_sleep(WRITER_IDLE_MS);
+    }
+  }
+  writerClose(w);
+  noteCommitted(w);
+  return NULL;
+}
+
+void stopStats()
+{
+  hotExporterStop(&exporter);
+}
+
+/* Also runs on errx(), so rows already read are not lost on reader errors */
+void stopWriter()
+{
+  if (!writer.running)
+  {
+    return;
+  }
+  writer.running = false;
+  atomic_store(&writer.done, true);
+  pthread_join(writer.thread, NULL);
+  rotatorStop(&writer.rotator);
+}
+
+/* Returns whether the tag was never read before */
+bool noteRead(ReadStats *stats, const TMR_TagReadData *trd)
+{
+  uint64_t now = monotonicUs();
+  uint64_t gap = now - stats->lastUs;
+  bool created;
+
+  if (gap > stats->maxGapUs)
+  {
+    stats->maxGapUs = gap;
+  }
+  if (gap > LONG_GAP_US)
+  {
+    stats->longGaps++;
+  }
+  stats->gapSumUs += gap;
+  stats->lastUs = now;
+  stats->reads++;
+  epcTableInsert(&stats->unique, trd->tag.epc, trd->tag.epcByteCount, &created);
+  return created;
+}
+
+void printReadStats(ReadStats *stats)
+{
+  double seconds = (monotonicUs() - stats->startUs) / 1e6;
+
+  printf("Reads: %" PRIu64 " in %.2f s (%.1f reads/s), unique tags: %u (%.1f tags/s)\n",
+         stats->reads, seconds, stats->reads / seconds, stats->unique.count, stats->unique.count / seconds);
+  printf("Read gaps: mean %.1f ms, max %.1f ms, %" PRIu64 " over %d ms\n",
+         stats->reads ? stats->gapSumUs / 1e3 / stats->reads : 0.0, stats->maxGapUs / 1e3,
+         stats->longGaps, LONG_GAP_US / 1000);
+  printf("Reader errors: %" PRIu64 ", tag buffer full: %" PRIu64 "\n",
+         atomic_load(&hot.errors), atomic_load(&hot.bufferFull));
+}
+
+/* Median, p99, p99.9 and max of a histogram, divided by scale */
+void printQuantiles(const char *what, HotHistogram *h, double scale, const char *unit)
+{
+  printf("%s: p50 %.1f%s, p99 %.1f%s, p99.9 %.1f%s, max %.1f%s (%" PRIu64 " samples)\n", what,
+         hotQuantile(h, 0.5) / scale, unit, hotQuantile(h, 0.99) / scale, unit,
+         hotQuantile(h, 0.999) / scale, unit, atomic_load(&h->max) / scale, unit, atomic_load(&h->count));
+}
+
+void printHotStats()
+{
+  uint64_t matched = atomic_load(&hot.matched);
+  uint64_t seen = matched + atomic_load(&hot.rejected);
+
+  if (0 != atomic_load(&hot.readNs.count))
+  {
+    printQuantiles("TMR_read", &hot.readNs, 1e6, " ms");
+    printQuantiles("Tags per read", &hot.tagsPerRead, 1, "");
+    printQuantiles("TMR_getNextTag", &hot.nextTagNs, 1e3, " us");
+  }
+  printf("Filter: %" PRIu64 " of %" PRIu64 " tags matched (%.1f%%)\n", matched, seen, seen ? 100.0 * matched / seen : 0.0);
+  printQuantiles("Insert", &hot.insertNs, 1e3, " us");
+  printQuantiles("Read to commit", &hot.commitLagUs, 1e3, " ms");
+}
+
+/* HotWriteFn for --stats */
+void writeHotStats(FILE *fp, void *cookie)
+{
+  hotWriteHistogram(fp, "m6e_read_duration_seconds", "Time spent in TMR_read.", &hot.readNs, 1e-9, 10, 34);
+  hotWriteHistogram(fp, "m6e_tags_per_read", "Tags returned by one TMR_read.", &hot.tagsPerRead, 1, 0, 14);
+  hotWriteHistogram(fp, "m6e_get_next_tag_seconds", "Time spent in TMR_getNextTag.", &hot.nextTagNs, 1e-9, 6, 24);
+  hotWriteHistogram(fp, "m6e_sqlite_insert_seconds", "Time to insert one row, including commits.", &hot.insertNs, 1e-9, 8, 32);
+  hotWriteHistogram(fp, "m6e_read_to_commit_seconds", "Reader timestamp of a tag read to its row being committed.",
+                    &hot.commitLagUs, 1e-6, 7, 26);
+  hotWriteCounter(fp, "m6e_filter_matched_total", "Tag reads passing the --tags filter.", atomic_load(&hot.matched));
+  hotWriteCounter(fp, "m6e_filter_rejected_total", "Tag reads dropped by the --tags filter.", atomic_load(&hot.rejected));
+  hotWriteCounter(fp, "m6e_tag_buffer_full_total", "TMR_ERROR_TAG_ID_BUFFER_FULL events.", atomic_load(&hot.bufferFull));
+  hotWriteCounter(fp, "m6e_reader_errors_total", "Other reader errors.", atomic_load(&hot.errors));
+  hotWriteCounter(fp, "m6e_rows_committed_total", "Rows committed to the database.", atomic_load(&hot.rows));
+  hotWriteCounter(fp, "m6e_queue_dropped_total", "Reads dropped because the writer queue was full.",
+                  atomic_load(&writer.queue.dropped));
+  hotWriteGauge(fp, "m6e_queue_depth", "Reads waiting for the writer.", readQueueDepth(&writer.queue));
+}
+
+/**
+ * --stop: whether the population has converged, and why. The count of new
+ * tags is what converges: once every tag in the field has answered, reads
+ * keep coming but no new EPC does.
+ */
+bool inventoryDone(ReadContext *ctx, const char **reason)
+{
+  uint32_t found = atomic_load(&ctx->stats.found);
+
+  if (0 != ctx->expected && found >= ctx->expected)
+  {
+    *reason = "all expected tags found";
+    return true;
+  }
+  if (0 != ctx->quietUs && monotonicUs() - atomic_load(&ctx->stats.lastNewUs) >= ctx->quietUs)
+  {
+    *reason = "no new tag for the quiet period";
+    return true;
+  }
+  return false;
+}
+
+void printCompleteness(ReadContext *ctx, const char *reason)
+{
+  uint32_t found = atomic_load(&ctx->stats.found);
+  double lastNew = (atomic_load(&ctx->stats.lastNewUs) - ctx->stats.startUs) / 1e6;
+
+  if (0 != ctx->expected)
+  {
+    printf("Completeness: %u of %u expected tags (%.1f%%)", found, ctx->expected, 100.0 * found / ctx->expected);
+  }
+  else
+  {
+    printf("Completeness: %u tags", found);
+  }
+  if (0 != found)
+  {
+    printf(", last new one after %.2f s (%.1f new tags/s until then)", lastNew, lastNew > 0 ? found / lastNew : 0.0);
+  }
+  printf("; stopped after %.2f s: %s\n", (monotonicUs() - ctx->stats.startUs) / 1e6, reason);
+}
+
+void fillRecord(ReadRecord *rec, const TMR_TagReadData *trd, int readpower)
+{
+  rec->tsMs = ((uint64_t)trd->timestampHigh<<32) | trd->timestampLow;
+  rec->readCount = trd->readCount;
+  rec->frequency = trd->frequency;
+  rec->rssi = trd->rssi;
+  rec->phase = trd->phase;
+  rec->power = readpower;
+  rec->antenna = trd->antenna;
+  rec->protocol = trd->tag.protocol;
+  rec->epcLen = trd->tag.epcByteCount;
+  memcpy(rec->epc, trd->tag.epc, trd->tag.epcByteCount);
+}
+
+void handleTag(ReadContext *ctx, const TMR_TagReadData *trd)
+{
+  bool fresh = noteRead(&ctx->stats, trd);
+
+  if (epcPrefixSetMatch(&ctx->prefixes, trd->tag.epc, trd->tag.epcByteCount))
+  {
+    ReadRecord rec;
+
+    if (fresh)
+    {
+      atomic_fetch_add(&ctx->stats.found, 1);
+      atomic_store(&ctx->stats.lastNewUs, monotonicUs());
+    }
+    hotAdd(&hot.matched, 1);
+    fillRecord(&rec, trd, ctx->readpower);
+    readQueuePush(&writer.queue, &rec);
+  }
+  else
+  {
+    hotAdd(&hot.rejected, 1);
+  }
+}
+
+void readCallback(TMR_Reader *reader, const TMR_TagReadData *t, void *cookie)
+{
+  handleTag(cookie, t);
+}
+
+void exceptionCallback(TMR_Reader *reader, TMR_Status error, void *cookie)
+{
+  if (TMR_ERROR_TAG_ID_BUFFER_FULL == error)
+  {
+    hotAdd(&hot.bufferFull, 1);
+  }
+  else
+  {
+    hotAdd(&hot.errors, 1);
+    if (NULL != activeTrace)
+    {
+      traceRingRequestDump(activeTrace, TRACE_DUMP_ERROR);
+    }
+  }
+  fprintf(stdout, "Error:%s\n", TMR_strerr(reader, error));
+}
+
+/* Number of leading bits two masks have in common, up to limit */
+uint16_t commonBits(const uint8_t *a, const uint8_t *b, uint16_t limit)
+{
+  uint16_t bit;
+
+  for (bit = 0; bit < limit; bit++)
+  {
+    uint8_t m = 0x80 >> (bit % 8);
+    if ((a[bit / 8] & m) != (b[bit / 8] & m))
+    {
+      break;
+    }
+  }
+  return bit;
+}
+
+/**
+ * Reduce the prefix allowlist to at most MAX_SELECT_PLANS Select masks:
+ * one per prefix when there are few, otherwise a single mask on the bits
+ * all prefixes share. Leaves count at 0 when no useful Select exists
+ * (no allowlist, an empty prefix, or nothing in common).
+ */
+void buildSelectPlan(SelectPlan *sp, const EpcPrefixSet *set)
+{
+  const EpcPrefix *first = &set->prefixes[0];
+  uint16_t common;
+  uint32_t i;
+  uint32_t j;
+
+  sp->count = 0;
+  if (set->matchAll || 0 == set->count)
+  {
+    return;
+  }
+
+  /* Prefixes are sorted shortest first, so a covering prefix is seen first */
+  common = 4 * first->nibbles;
+  for (i = 0; i < set->count; i++)
+  {
+    const EpcPrefix *p = &set->prefixes[i];
+    uint16_t bits = 4 * p->nibbles;
+
+    common = commonBits(first->bytes, p->bytes, common < bits ? common : bits);
+    if (sp->count > MAX_SELECT_PLANS)
+    {
+      continue;
+    }
+    for (j = 0; j < sp->count && j < MAX_SELECT_PLANS; j++)
+    {
+      if (commonBits(sp->mask[j], p->bytes, sp->bits[j]) == sp->bits[j])
+      {
+        break;
+      }
+    }
+    if (j < sp->count)
+    {
+      continue;
+    }
+    if (sp->count < MAX_SELECT_PLANS)
+    {
+      memcpy(sp->mask[sp->count], p->bytes, EPC_PREFIX_MAX);
+      sp->bits[sp->count] = bits;
+    }
+    sp->count++;
+  }
+
+  if (sp->count > MAX_SELECT_PLANS)
+  {
+    memcpy(sp->mask[0], first->bytes, EPC_PREFIX_MAX);
+    sp->bits[0] = common;
+    sp->count = common ? 1 : 0;
+  }
+}
+
+/* Attach the Select masks to a simple Gen2 plan, splitting it if needed */
+TMR_Status applySelectPlan(SelectPlan *sp, TMR_ReadPlan *plan, uint8_t antennaCount, uint8_t *antennaList)
+{
+  TMR_Status ret;
+  uint32_t j;
+
+  if (0 == sp->count)
+  {
+    return TMR_SUCCESS;
+  }
+  for (j = 0; j < sp->count; j++)
+  {
+    ret = TMR_TF_init_gen2_select(&sp->filter[j], false, TMR_GEN2_BANK_EPC, EPC_BIT_POINTER, sp->bits[j], sp->mask[j]);
+    if (TMR_SUCCESS != ret)
+    {
+      return ret;
+    }
+  }
+  if (1 == sp->count)
+  {
+    return TMR_RP_set_filter(plan, &sp->filter[0]);
+  }
+  for (j = 0; j < sp->count; j++)
+  {
+    ret = TMR_RP_init_simple(&sp->subPlan[j], antennaCount, antennaList, TMR_TAG_PROTOCOL_GEN2, 1000);
+    if (TMR_SUCCESS != ret)
+    {
+      return ret;
+    }
+    ret = TMR_RP_set_filter(&sp->subPlan[j], &sp->filter[j]);
+    if (TMR_SUCCESS != ret)
+    {
+      return ret;
     }
-    fclose(fp);
-    if (line)
-        free(line);
-    return i;
+    sp->subPlanList[j] = &sp->subPlan[j];
+  }
+  return TMR_RP_init_multi(plan, sp->subPlanList, sp->count, 0);
 }
 
-void read_lines(char *file, char lines[][33])
+/* What the reader reports once configured; settings it doesn't report stay unknown */
+void describeSession(TMR_Reader *rp, DbSession *session, const char *model, const uint8_t *antennaList, uint8_t antennaCount)
 {
-    FILE * fp;
-    char *line = NULL;
-    size_t len = 0;
-    ssize_t read;
-    int i = 0;
-
-    fp = fopen(file, "r");
-    if (fp == NULL)
-        exit(EXIT_FAILURE);
-
-    while ((read = getline(&line, &len, fp)) != -1) {
-      line[strcspn(line, "\r\n")] = 0;
-      strcpy(lines[i],line);
-      i++;
-    }
-
-    fclose(fp);
-    if (line)
-        free(line);
+  TMR_String firmware;
+  TMR_Region region;
+  int32_t power;
+  size_t used = 0;
+  uint8_t j;
+
+  snprintf(session->model, sizeof(session->model), "%s", model);
+  firmware.value = session->firmware;
+  firmware.max = sizeof(session->firmware);
+  if (TMR_SUCCESS != TMR_paramGet(rp, TMR_PARAM_VERSION_SOFTWARE, &firmware))
+  {
+    session->firmware[0] = '\0';
+  }
+  if (TMR_SUCCESS == TMR_paramGet(rp, TMR_PARAM_REGION_ID, &region))
+  {
+    session->region = region;
+  }
+  if (TMR_SUCCESS == TMR_paramGet(rp, TMR_PARAM_RADIO_READPOWER, &power))
+  {
+    session->readPower = power;
+  }
+  for (j = 0; j < antennaCount && used < sizeof(session->antennas); j++)
+  {
+    used += snprintf(session->antennas + used, sizeof(session->antennas) - used, "%s%u", j ? "," : "", antennaList[j]);
+  }
 }
 
 int main(int argc, char *argv[])
@@ -273,19 +1212,42 @@ int main(int argc, char *argv[])
   time_t time1;
   time ( &time1 );
   double delta = 5;
-  int ts = 0;
 
   int reg = 1;
 
-  char *tags = "";
-  int n;
-  size_t NumberOfElements;
-  bool right_prefix = false;
+  char *tags = NULL;
+  ReadContext ctx;
+  uint32_t quietMs = 0;
+  bool stopRule = false;
+  long expected = -1;
+  const char *stopReason = "reading time over";
+  bool asyncRead = false;
+  uint32_t asyncOnTime = 250;
+  uint32_t asyncOffTime = 0;
+  bool select = true;
 
-  sqlite3 *db;
-  sqlite3_stmt *stmt;
-  char *err_msg = 0;
   char *database = "default.db";
+  char *logDir = NULL;
+  char *packDir = NULL;
+  uint32_t segmentMb = 0;
+  uint32_t rotateMin = 0;
+  uint32_t budgetMb = 0;
+  uint32_t batchRows = DB_SINK_BATCH_ROWS;
+  uint32_t batchMs = DB_SINK_BATCH_MS;
+  uint32_t aggregateMs = 0;
+  uint32_t dedupMs = 0;
+  uint32_t presenceMs = 0;
+  int presenceArrive = PRESENCE_ANY_RSSI;
+  int presenceDepart = PRESENCE_ANY_RSSI;
+  int presenceMove = 6;
+  uint32_t queueSize = READ_QUEUE_CAPACITY;
+  char *capturePath = NULL;
+  CaptureWriter capture;
+  TMR_TransportListenerBlock cb;
+  char *tracePrefix = NULL;
+  TMR_TransportListenerBlock trb;
+  char *statsDir = NULL;
+  uint32_t statsMs = HOT_EXPORT_MS;
   // printf("Enter database file name: ");
   // scanf("%s", database);
   TMR_uint32List value;
@@ -302,6 +1264,8 @@ int main(int argc, char *argv[])
     usage(); 
   }
 
+  /* Before the options are parsed, as --ant splits its argument in place */
+  dbSessionInit(&writer.session, argc, argv);
   for (i = 2; i < argc; i+=2)
   {
     if(0x00 == strcmp("--ant", argv[i]))
@@ -376,37 +1340,407 @@ int main(int argc, char *argv[])
     else if (0 == strcmp("--tags", argv[i]))
     {
       tags = argv[i+1];
-      n = get_lines(tags);
     }
     else if (0 == strcmp("--file", argv[i]))
     {
       database = argv[i+1];
     }
+    else if (0 == strcmp("--append", argv[i]))
+    {
+      writer.append = (NULL != argv[i+1] && 0 != atoi(argv[i+1]));
+    }
+    else if (0 == strcmp("--batch", argv[i]))
+    {
+      char *startptr = argv[i+1];
+      char *endptr;
+      batchRows = strtoul(startptr, &endptr, 0);
+      if (endptr == startptr || 0 == batchRows)
+      {
+        fprintf(stdout, "Can't parse batch size: %s\n", argv[i+1]);
+        usage();
+      }
+    }
+    else if (0 == strcmp("--async", argv[i]))
+    {
+      if (NULL == argv[i+1] || 2 != sscanf(argv[i+1], "%"SCNu32",%"SCNu32, &asyncOnTime, &asyncOffTime))
+      {
+        fprintf(stdout, "Can't parse async on,off times: %s\n", argv[i+1]);
+        usage();
+      }
+      asyncRead = true;
+    }
+    else if (0 == strcmp("--capture", argv[i]))
+    {
+      capturePath = argv[i+1];
+    }
+    else if (0 == strcmp("--trace", argv[i]))
+    {
+      tracePrefix = argv[i+1];
+    }
+    else if (0 == strcmp("--log", argv[i]))
+    {
+      logDir = argv[i+1];
+    }
+    else if (0 == strcmp("--pack", argv[i]))
+    {
+      packDir = argv[i+1];
+    }
+    else if (0 == strcmp("--segment", argv[i]))
+    {
+      char *startptr = argv[i+1];
+      char *endptr;
+      segmentMb = strtoul(startptr, &endptr, 0);
+      if (endptr == startptr || 0 == segmentMb)
+      {
+        fprintf(stdout, "Can't parse segment size: %s\n", argv[i+1]);
+        usage();
+      }
+    }
+    else if (0 == strcmp("--rotate", argv[i]))
+    {
+      char *startptr = argv[i+1];
+      char *endptr;
+      rotateMin = strtoul(startptr, &endptr, 0);
+      if (endptr == startptr || 0 == rotateMin)
+      {
+        fprintf(stdout, "Can't parse rotation period: %s\n", argv[i+1]);
+        usage();
+      }
+    }
+    else if (0 == strcmp("--budget", argv[i]))
+    {
+      char *startptr = argv[i+1];
+      char *endptr;
+      budgetMb = strtoul(startptr, &endptr, 0);
+      if (endptr == startptr || 0 == budgetMb)
+      {
+        fprintf(stdout, "Can't parse disk budget: %s\n", argv[i+1]);
+        usage();
+      }
+    }
+    else if (0 == strcmp("--stats", argv[i]))
+    {
+      statsDir = argv[i+1];
+    }
+    else if (0 == strcmp("--statsms", argv[i]))
+    {
+      char *startptr = argv[i+1];
+      char *endptr;
+      statsMs = strtoul(startptr, &endptr, 0);
+      if (endptr == startptr || 0 == statsMs)
+      {
+        fprintf(stdout, "Can't parse stats interval: %s\n", argv[i+1]);
+        usage();
+      }
+    }
+    else if (0 == strcmp("--select", argv[i]))
+    {
+      select = (NULL != argv[i+1] && 0 != atoi(argv[i+1]));
+    }
+    else if (0 == strcmp("--queue", argv[i]))
+    {
+      char *startptr = argv[i+1];
+      char *endptr;
+      queueSize = strtoul(startptr, &endptr, 0);
+      if (endptr == startptr || 0 == queueSize)
+      {
+        fprintf(stdout, "Can't parse queue size: %s\n", argv[i+1]);
+        usage();
+      }
+    }
+    else if (0 == strcmp("--dedup", argv[i]))
+    {
+      char *startptr = argv[i+1];
+      char *endptr;
+      dedupMs = strtoul(startptr, &endptr, 0);
+      if (endptr == startptr)
+      {
+        fprintf(stdout, "Can't parse dedup window: %s\n", argv[i+1]);
+        usage();
+      }
+    }
+    else if (0 == strcmp("--stop", argv[i]))
+    {
+      char *startptr = argv[i+1];
+      char *endptr = NULL;
+
+      /* strtoul would take "-1" as a huge count */
+      if (NULL != startptr && NULL == strchr(startptr, '-'))
+      {
+        quietMs = strtoul(startptr, &endptr, 0);
+        if (endptr != startptr && ',' == *endptr)
+        {
+          startptr = endptr + 1;
+          expected = strtoul(startptr, &endptr, 0);
+        }
+      }
+      if (NULL == endptr || endptr == startptr || '\0' != *endptr)
+      {
+        fprintf(stdout, "Can't parse stop rule: %s\n", argv[i+1]);
+        usage();
+      }
+      stopRule = true;
+    }
+    else if (0 == strcmp("--presence", argv[i]))
+    {
+      if (NULL == argv[i+1] || sscanf(argv[i+1], "%u,%d,%d,%d", &presenceMs, &presenceArrive, &presenceDepart, &presenceMove) < 1
+          || 0 == presenceMs)
+      {
+        fprintf(stdout, "Can't parse presence settings: %s\n", argv[i+1]);
+        usage();
+      }
+    }
+    else if (0 == strcmp("--aggregate", argv[i]))
+    {
+      char *startptr = argv[i+1];
+      char *endptr;
+      aggregateMs = strtoul(startptr, &endptr, 0);
+      if (endptr == startptr)
+      {
+        fprintf(stdout, "Can't parse aggregation window: %s\n", argv[i+1]);
+        usage();
+      }
+    }
+    else if (0 == strcmp("--flush", argv[i]))
+    {
+      char *startptr = argv[i+1];
+      char *endptr;
+      batchMs = strtoul(startptr, &endptr, 0);
+      if (endptr == startptr)
+      {
+        fprintf(stdout, "Can't parse flush interval: %s\n", argv[i+1]);
+        usage();
+      }
+    }
     else
     {
       fprintf(stdout, "Argument %s is not recognized\n", argv[i]);
       usage();
     }
   }
-  char pre[n][33];
-  read_lines(tags, pre);
-  int rc = sqlite3_open(database, &db);
-  if (rc != SQLITE_OK) {
-      fprintf(stderr, "Cannot open database: %s\n", sqlite3_errmsg(db));
-      sqlite3_close(db);
+  memset(&ctx, 0, sizeof(ctx));
+  epcPrefixSetInit(&ctx.prefixes);
+  if (NULL != tags)
+  {
+    if (0 != epcPrefixSetLoad(&ctx.prefixes, tags))
+    {
+      fprintf(stderr, "Cannot read tags file: %s\n", tags);
+      return 1;
+    }
+    fprintf(stdout, "Loaded %u tag prefixes\n", ctx.prefixes.count);
+  }
+  ctx.readpower = readpower;
+  ctx.quietUs = (uint64_t)quietMs * 1000;
+  /* Without ,N the --tags lines that are whole EPCs give the population */
+  if (stopRule)
+  {
+    ctx.expected = expected >= 0 ? (uint32_t)expected
+                 : NULL != tags ? epcPrefixSetCount(&ctx.prefixes, EPC_MATCH_FULL_NIBBLES) : 0;
+  }
+  if (0 != ctx.quietUs && 0 != ctx.expected)
+  {
+    fprintf(stdout, "Stopping early after %u ms without a new tag or at %u tags\n", quietMs, ctx.expected);
+  }
+  else if (0 != ctx.quietUs)
+  {
+    fprintf(stdout, "Stopping early after %u ms without a new tag (tag count 0: not used)\n", quietMs);
+  }
+  else if (0 != ctx.expected)
+  {
+    fprintf(stdout, "Stopping early at %u tags (quiet period 0: not used)\n", ctx.expected);
+  }
+  if (0 != epcTableInit(&ctx.stats.unique, 1024, 0))
+  {
+    fprintf(stderr, "Cannot allocate unique tag table\n");
+    return 1;
+  }
+  if (NULL != logDir && NULL != packDir)
+  {
+    fprintf(stdout, "--log and --pack can't be used together\n");
+    usage();
+  }
+  writer.store = NULL != logDir ? STORE_LOG : NULL != packDir ? STORE_PACK : STORE_DB;
+  if (0 != aggregateMs)
+  {
+    /* Log segments hold ReadRecords only */
+    if (STORE_DB != writer.store)
+    {
+      fprintf(stdout, "--aggregate needs a database, not --log or --pack\n");
+      usage();
+    }
+    if (0 != readAggInit(&writer.agg, aggregateMs))
+    {
+      fprintf(stderr, "Cannot allocate the aggregation table\n");
+      return 1;
+    }
+    writer.aggregate = true;
+    fprintf(stdout, "Aggregating reads per tag over %u ms windows\n", aggregateMs);
+  }
+  if (0 != dedupMs)
+  {
+    if (0 != readDedupInit(&writer.dedup, dedupMs))
+    {
+      fprintf(stderr, "Cannot allocate the dedup table\n");
+      return 1;
+    }
+    writer.deduplicate = true;
+    fprintf(stdout, "Dropping repeat reads per tag and antenna within %u ms\n", dedupMs);
+  }
+  if (0 != presenceMs)
+  {
+    if (STORE_DB != writer.store)
+    {
+      fprintf(stdout, "--presence needs a database, not --log or --pack\n");
+      usage();
+    }
+    /* Leaving below the arrival level is what stops a tag at the edge flapping */
+    if (presenceDepart > presenceArrive)
+    {
+      fprintf(stdout, "--presence depart level can't be above the arrive level\n");
+      usage();
+    }
+    if (0 != presenceInit(&writer.presence, presenceMs, presenceArrive, presenceDepart, presenceMove,
+                          writerEvent, &writer))
+    {
+      fprintf(stderr, "Cannot allocate the presence table\n");
+      return 1;
+    }
+    writer.presenceOn = true;
+    fprintf(stdout, "Tracking presence: gone after %u ms unseen\n", presenceMs);
+  }
+  writer.batchRows = batchRows;
+  writer.batchMs = batchMs;
+  writer.rotateMs = (uint64_t)rotateMin * 60000;
+  writer.dbBytes = (uint64_t)segmentMb << 20;
+  if (STORE_DB == writer.store)
+  {
+    /* A directory, --rotate or --segment: new timestamped databases instead of recreating --file */
+    writer.dbRotate = rotateSplit(database, "reads", writer.dbDir, sizeof(writer.dbDir),
+                                  writer.dbPrefix, sizeof(writer.dbPrefix));
+    writer.dbRotate = writer.dbRotate || 0 != rotateMin || 0 != segmentMb;
+    snprintf(writer.dbPath, sizeof(writer.dbPath), "%s", database);
+    /* A single --file is never deleted, so there is nothing to budget */
+    if (!writer.dbRotate && 0 != budgetMb)
+    {
+      fprintf(stdout, "--budget needs rotating databases: a directory, --rotate or --segment\n");
+      usage();
+    }
+  }
+  else
+  {
+    snprintf(writer.dbDir, sizeof(writer.dbDir), "%s", STORE_LOG == writer.store ? logDir : packDir);
+    snprintf(writer.dbPrefix, sizeof(writer.dbPrefix), "%s", READ_LOG_PREFIX);
+  }
+  if ((STORE_DB != writer.store || writer.dbRotate)
+      && 0 != rotatorStart(&writer.rotator, writer.dbDir, writer.dbPrefix, (uint64_t)budgetMb << 20))
+  {
+    return 1;
+  }
+  if (STORE_LOG == writer.store)
+  {
+    if (0 != readLogOpen(&writer.log, logDir, segmentMb, batchRows, batchMs))
+    {
+      return 1;
+    }
+    writer.log.rotator = &writer.rotator;
+    fprintf(stdout, "Logging reads to %s, %" PRIu64 " MB segments\n", logDir, writer.log.segmentBytes >> 20);
+  }
+  else if (STORE_PACK == writer.store)
+  {
+    if (0 != readPackOpen(&writer.pack, packDir, segmentMb, batchRows, batchMs))
+    {
+      return 1;
+    }
+    writer.pack.rotator = &writer.rotator;
+    fprintf(stdout, "Logging compressed reads to %s, %" PRIu64 " MB segments\n", packDir, writer.pack.segmentBytes >> 20);
+  }
+  else
+  {
+    if (0 != openDatabase(&writer))
+    {
       return 1;
+    }
+    if (writer.dbRotate)
+    {
+      fprintf(stdout, "Writing reads to %s\n", writer.dbPath);
+    }
+    else if (writer.append)
+    {
+      fprintf(stdout, "Appending reads to %s\n", writer.dbPath);
+    }
+  }
+  if (0 != rotateMin)
+  {
+    fprintf(stdout, "New segment every %u minutes\n", rotateMin);
+  }
+  if (0 != budgetMb)
+  {
+    fprintf(stdout, "Keeping %s/%s-* segments within %u MB\n", writer.dbDir, writer.dbPrefix, budgetMb);
+  }
+  writer.openedMs = monotonicUs() / 1000;
+  if (0 != readQueueInit(&writer.queue, queueSize))
+  {
+    fprintf(stderr, "Cannot allocate a queue of %u records\n", queueSize);
+    return 1;
+  }
+  writer.pendingTsMs = calloc(batchRows, sizeof(*writer.pendingTsMs));
+  if (NULL == writer.pendingTsMs)
+  {
+    fprintf(stderr, "Cannot allocate commit tracking for %u rows\n", batchRows);
+    return 1;
+  }
+  /* From here on the database handle or read log belongs to the writer thread */
+  atomic_init(&writer.done, false);
+  atomic_init(&writer.failed, false);
+  if (0 != pthread_create(&writer.thread, NULL, writerMain, &writer))
+  {
+    fprintf(stderr, "Cannot start writer thread\n");
+    return 1;
   }
-  char *sql = "DROP TABLE IF EXISTS ToP;"
-              "CREATE TABLE ToP(epc INT, rssi INT, phase INT, freq INT, pow INT, ant INT, ts INT, read_count INT, protocol INT);";
-  rc = sqlite3_exec(db, sql, 0, 0, &err_msg);
-  if (rc != SQLITE_OK ) {
-      fprintf(stderr, "SQL error: %s\n", err_msg);
-      sqlite3_free(err_msg);        
-      sqlite3_close(db);
+  writer.running = true;
+  /* Handlers run in reverse, so the last export sees the final commit */
+  atexit(stopStats);
+  atexit(stopWriter);
+  if (NULL != statsDir)
+  {
+    if (0 != hotExporterStart(&exporter, statsDir, STATS_FILE, statsMs, writeHotStats, NULL))
+    {
       return 1;
-  } 
+    }
+    fprintf(stdout, "Writing stats to %s every %u ms\n", exporter.path, statsMs);
+  }
+  signal(SIGINT, onSignal);
+  signal(SIGTERM, onSignal);
+  ret = replayRegister();
+  checkerr(rp, ret, 1, "registering replay transport");
   ret = TMR_create(rp, argv[1]);
   checkerr(rp, ret, 1, "creating reader");
+  memset(&capture, 0, sizeof(capture));
+  if (NULL != capturePath)
+  {
+    if (0 != captureOpen(&capture, capturePath))
+    {
+      return 1;
+    }
+    cb.listener = captureListener;
+    cb.cookie = &capture;
+    cb.next = NULL;
+    TMR_addTransportListener(rp, &cb);
+  }
+  if (NULL != tracePrefix)
+  {
+    if (0 != traceRingInit(&trace, TRACE_RING_SLOTS, tracePrefix))
+    {
+      fprintf(stderr, "Cannot allocate serial trace\n");
+      return 1;
+    }
+    activeTrace = &trace;
+    signal(SIGUSR1, onDumpSignal);
+    trb.listener = traceListener;
+    trb.cookie = &trace;
+    trb.next = NULL;
+    TMR_addTransportListener(rp, &trb);
+  }
 #else
   ret = TMR_create(rp, "tmr:///com1");
 
@@ -530,6 +1864,16 @@ int main(int argc, char *argv[])
   if (0 != strcmp("M3e", model.value))
   {
     ret = TMR_RP_init_simple(&plan, antennaCount, antennaList, TMR_TAG_PROTOCOL_GEN2, 1000);
+    checkerr(rp, ret, 1, "initializing the  read plan");
+
+    /* Only tags on the allowlist answer; handleTag() stays as a safety net */
+    if (select)
+    {
+      buildSelectPlan(&selects, &ctx.prefixes);
+      ret = applySelectPlan(&selects, &plan, antennaCount, antennaList);
+      checkerr(rp, ret, 1, "setting tag filters");
+      fprintf(stdout, "Gen2 Select filters: %u\n", selects.count);
+    }
   }
   else
   {
@@ -541,13 +1885,60 @@ int main(int argc, char *argv[])
   ret = TMR_paramSet(rp, TMR_PARAM_READ_PLAN, &plan);
   checkerr(rp, ret, 1, "setting read plan");
 
-  while (difftime(time2,time1) < delta && !kbhit()) {
+  describeSession(rp, &writer.session, model.value, antennaList, antennaCount);
+  atomic_store(&writer.sessionReady, true);
+
+  ctx.stats.startUs = ctx.stats.lastUs = monotonicUs();
+  atomic_store(&ctx.stats.lastNewUs, ctx.stats.startUs);
+
+  if (asyncRead)
+  {
+    TMR_ReadListenerBlock rlb;
+    TMR_ReadExceptionListenerBlock reb;
+
+    /* The module streams tags on its own and the API calls us back per tag */
+    ret = TMR_paramSet(rp, TMR_PARAM_READ_ASYNCONTIME, &asyncOnTime);
+    checkerr(rp, ret, 1, "setting async on time");
+    ret = TMR_paramSet(rp, TMR_PARAM_READ_ASYNCOFFTIME, &asyncOffTime);
+    checkerr(rp, ret, 1, "setting async off time");
+
+    rlb.listener = readCallback;
+    rlb.cookie = &ctx;
+    rlb.next = NULL;
+    ret = TMR_addReadListener(rp, &rlb);
+    checkerr(rp, ret, 1, "adding read listener");
+
+    reb.listener = exceptionCallback;
+    reb.cookie = &ctx;
+    reb.next = NULL;
+    ret = TMR_addReadExceptionListener(rp, &reb);
+    checkerr(rp, ret, 1, "adding exception listener");
+
+    ret = TMR_startReading(rp);
+    checkerr(rp, ret, 1, "starting reading");
+    while (difftime(time2,time1) < delta && !kbhit() && !stopRequested && !atomic_load(&writer.failed)
+           && !inventoryDone(&ctx, &stopReason))
+    {
+      tmr_sleep(100);
+      time ( &time2 );
+    }
+    ret = TMR_stopReading(rp);
+    checkerr(rp, ret, 1, "stopping reading");
+  }
+
+  while (!asyncRead && difftime(time2,time1) < delta && !kbhit() && !stopRequested && !atomic_load(&writer.failed)
+         && !inventoryDone(&ctx, &stopReason)) {
+    uint64_t startNs = hotNowNs();
+    uint32_t tagCount = 0;
+
     ret = TMR_read(rp, 500, NULL);
+    hotRecord(&hot.readNs, hotNowNs() - startNs);
     if (TMR_ERROR_TAG_ID_BUFFER_FULL == ret)
     {
       /* In case of TAG ID Buffer Full, extract the tags present
       * in buffer.
       */
+      hotAdd(&hot.bufferFull, 1);
     #ifndef BARE_METAL
       fprintf(stdout, "reading tags:%s\n", TMR_strerr(rp, ret));
     #endif /* BARE_METAL */
@@ -560,24 +1951,21 @@ int main(int argc, char *argv[])
     while (TMR_SUCCESS == TMR_hasMoreTags(rp))
       {
         TMR_TagReadData trd;
-        char idStr[128];
-      #ifndef BARE_METAL
-        char timeStr[128];
-      #endif /* BARE_METAL */
 
+        startNs = hotNowNs();
         ret = TMR_getNextTag(rp, &trd); 
+        hotRecord(&hot.nextTagNs, hotNowNs() - startNs);
         checkerr(rp, ret, 1, "fetching tag");
-
-        TMR_bytesToHex(trd.tag.epc, trd.tag.epcByteCount, idStr);
+        tagCount++;
 
       #ifndef BARE_METAL
-      getTimeStamp(rp, &trd, timeStr);
-      // printf("Tag ID: %s ", timeStr);
-
       // Enable PRINT_TAG_METADATA Flags to print Metadata value
       #if PRINT_TAG_METADATA
       {
       uint16_t j = 0;
+      char timeStr[128];
+
+      getTimeStamp(rp, &trd, timeStr);
 
       printf("\n");
       for (j=0; (1<<j) <= TMR_TRD_METADATA_FLAG_MAX; j++)
@@ -728,41 +2116,91 @@ int main(int argc, char *argv[])
       }
       #endif
       #endif
-      ts = getSeconds(rp, &trd);
-      NumberOfElements = sizeof(pre)/sizeof(*pre);
-      for (i=0;i<NumberOfElements;i++){
-        if (strncmp(pre[i], idStr, strlen(pre[i])) == 0 && pre[i] != NULL){
-          right_prefix = true;
-        }
-      }
-      if (right_prefix==true){
-        printf("%s | %d | %d | %d | %d | %d | %s\n", idStr, readpower, trd.rssi, trd.phase, trd.frequency, trd.antenna, timeStr);
-        if (sqlite3_prepare_v2(db, "INSERT INTO ToP(epc, rssi, phase, freq, pow, ant, ts, read_count, protocol) VALUES(?, ?, ?, ?, ?, ?, ?, ?, ?);", -1, &stmt, NULL)) {
-            printf("Error executing sql statement\n");
-            sqlite3_close(db);
-            exit(-1);
-        }
-        sqlite3_bind_text(stmt, 1, idStr, -1, NULL);
-        sqlite3_bind_int (stmt, 2, trd.rssi);
-        sqlite3_bind_int (stmt, 3, trd.phase);
-        sqlite3_bind_int (stmt, 4, trd.frequency);
-        sqlite3_bind_int (stmt, 5, readpower);    
-        sqlite3_bind_int (stmt, 6, trd.antenna);
-        sqlite3_bind_int (stmt, 7, ts);
-        sqlite3_bind_int (stmt, 8, trd.readCount);
-        sqlite3_bind_int (stmt, 9, trd.tag.protocol); 
-        sqlite3_step(stmt);
-        sqlite3_reset(stmt);
-      }
-      right_prefix=false;
+      handleTag(&ctx, &trd);
     }
+    hotRecord(&hot.tagsPerRead, tagCount);
     time ( &time2 );
   }
   printf("Stopping...\n");
-  printf("Closing database\n");
-  // sqlite3_finalize(stmt);
-  tmr_sleep(500);
-  sqlite3_close(db);
+  printReadStats(&ctx.stats);
+  if (0 != ctx.quietUs || 0 != ctx.expected)
+  {
+    printCompleteness(&ctx, kbhit() || stopRequested ? "interrupted" : stopReason);
+  }
+  epcTableFree(&ctx.stats.unique);
+  epcPrefixSetFree(&ctx.prefixes);
+  printf(STORE_DB == writer.store ? "Closing database\n" : "Closing read log\n");
+  stopWriter();
+  stopStats();
+  if (STORE_LOG == writer.store)
+  {
+    printf("Stored %" PRIu64 " rows in %" PRIu64 " syncs, %u segments in %s\n", writer.log.rows, writer.log.commits,
+           writer.log.segments, logDir);
+  }
+  else if (STORE_PACK == writer.store)
+  {
+    printf("Stored %" PRIu64 " rows in %" PRIu64 " syncs, %u segments in %s, %" PRIu64 " bytes (%.1f per row)\n",
+           writer.pack.rows, writer.pack.commits, writer.pack.segments, packDir, writer.pack.bytes,
+           writer.pack.rows ? (double)writer.pack.bytes / writer.pack.rows : 0.0);
+  }
+  else
+  {
+    printf("Stored %" PRIu64 " rows in %" PRIu64 " transactions", writerRows(&writer), writerCommits(&writer));
+    if (0 != writer.sink.session)
+    {
+      printf(", session %lld", (long long)writer.sink.session);
+    }
+    printf("\n");
+  }
+  if (writer.deduplicate)
+  {
+    printf("Dedup: %" PRIu64 " reads, %" PRIu64 " repeats merged (%.1f%%), %" PRIu64 " passed on, at most %u held\n",
+           writer.dedup.reads, writer.dedup.merged,
+           writer.dedup.reads ? 100.0 * writer.dedup.merged / writer.dedup.reads : 0.0,
+           writer.dedup.reads - writer.dedup.merged, writer.dedup.highWater);
+    readDedupFree(&writer.dedup);
+  }
+  if (writer.presenceOn)
+  {
+    printf("Presence: %" PRIu64 " arrivals, %" PRIu64 " moves, %" PRIu64 " departures, at most %u tags tracked\n",
+           writer.presence.arrivals, writer.presence.moves, writer.presence.departures, writer.presence.highWater);
+    presenceFree(&writer.presence);
+  }
+  if (writer.aggregate)
+  {
+    printf("Aggregated %" PRIu64 " reads into %" PRIu64 " summaries over %" PRIu64 " windows (%.1f reads per row)\n",
+           writer.agg.reads, writer.agg.summaries, writer.agg.windows,
+           writer.agg.summaries ? (double)writer.agg.reads / writer.agg.summaries : 0.0);
+    readAggFree(&writer.agg);
+  }
+  if (STORE_DB == writer.store && writer.dbRotate)
+  {
+    printf("Rotation: %u databases, last %s; %" PRIu64 " old segments deleted (%.1f MB) for the budget\n",
+           writer.rotations + 1, writer.dbPath, writer.rotator.deleted, writer.rotator.deletedBytes / 1048576.0);
+  }
+  else if (STORE_DB != writer.store && (writer.rotations > 0 || writer.rotator.deleted > 0))
+  {
+    printf("Rotation: %u on --rotate; %" PRIu64 " old segments deleted (%.1f MB) for the budget\n",
+           writer.rotations, writer.rotator.deleted, writer.rotator.deletedBytes / 1048576.0);
+  }
+  printHotStats();
+  printf("Queue: %" PRIu64 " queued, %" PRIu64 " dropped, depth %u, high-water %u of %u\n",
+         atomic_load(&writer.queue.pushed), atomic_load(&writer.queue.dropped),
+         readQueueDepth(&writer.queue), atomic_load(&writer.queue.highWater), writer.queue.mask + 1);
+  readQueueFree(&writer.queue);
+  free(writer.pendingTsMs);
   TMR_destroy(rp);
-  return 0;
+#ifndef BARE_METAL
+  if (NULL != capturePath)
+  {
+    printf("Captured %" PRIu64 " frames, %" PRIu64 " bytes\n", capture.frames, capture.bytes);
+    captureClose(&capture);
+  }
+  if (NULL != activeTrace)
+  {
+    activeTrace = NULL;
+    traceRingFree(&trace);
+  }
+#endif /* BARE_METAL */
+  return atomic_load(&writer.failed) ? 1 : 0;
 }
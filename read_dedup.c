@@ -0,0 +1,142 @@
+/**
+ * Duplicate suppression per (EPC, antenna) over a time window.
+ * @file read_dedup.c
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "read_dedup.h"
+#include "time_util.h"
+
+/* The EPC followed by the antenna; false if that doesn't fit a table key */
+static bool makeKey(const ReadRecord *rec, uint8_t *key, uint8_t *len)
+{
+  if (rec->epcLen >= EPC_TABLE_KEY_MAX)
+  {
+    return false;
+  }
+  memcpy(key, rec->epc, rec->epcLen);
+  key[rec->epcLen] = rec->antenna;
+  *len = rec->epcLen + 1;
+  return true;
+}
+
+int readDedupInit(ReadDedup *d, uint32_t windowMs)
+{
+  memset(d, 0, sizeof(*d));
+  d->windowMs = windowMs;
+  d->ring = malloc(READ_DEDUP_CAPACITY * sizeof(*d->ring));
+  if (NULL == d->ring || 0 != epcTableInit(&d->keys, READ_DEDUP_CAPACITY, sizeof(uint64_t)))
+  {
+    free(d->ring);
+    d->ring = NULL;
+    return -1;
+  }
+  d->mask = READ_DEDUP_CAPACITY - 1;
+  return 0;
+}
+
+void readDedupFree(ReadDedup *d)
+{
+  epcTableFree(&d->keys);
+  free(d->ring);
+  d->ring = NULL;
+}
+
+/* Double the ring; records keep their sequence numbers */
+static int growRing(ReadDedup *d)
+{
+  uint32_t size = 2 * (d->mask + 1);
+  ReadDedupHeld *ring = malloc(size * sizeof(*ring));
+  uint64_t seq;
+
+  if (NULL == ring)
+  {
+    return -1;
+  }
+  for (seq = d->tail; seq != d->head; seq++)
+  {
+    ring[seq & (size - 1)] = d->ring[seq & d->mask];
+  }
+  free(d->ring);
+  d->ring = ring;
+  d->mask = size - 1;
+  return 0;
+}
+
+int readDedupAdd(ReadDedup *d, const ReadRecord *rec)
+{
+  uint8_t key[EPC_TABLE_KEY_MAX];
+  uint8_t len;
+  uint64_t *seq;
+  bool created;
+
+  d->reads++;
+  if (rec->tsMs > d->latestMs)
+  {
+    d->latestMs = rec->tsMs;
+  }
+  if (!makeKey(rec, key, &len))
+  {
+    return -1;
+  }
+  if (d->head - d->tail > d->mask && 0 != growRing(d))
+  {
+    return -1;
+  }
+  seq = epcTableInsert(&d->keys, key, len, &created);
+  if (NULL == seq)
+  {
+    return -1;
+  }
+  if (!created)
+  {
+    ReadDedupHeld *held = &d->ring[*seq & d->mask];
+
+    if (rec->tsMs < held->rec.tsMs + d->windowMs)
+    {
+      held->rec.readCount += rec->readCount;
+      d->merged++;
+      return 0;
+    }
+    /* Its window is over but it isn't released yet: the key moves on to this read */
+  }
+  *seq = d->head;
+  d->ring[d->head & d->mask].rec = *rec;
+  d->ring[d->head & d->mask].heldMs = monotonicMs();
+  d->head++;
+  if (d->head - d->tail > d->highWater)
+  {
+    d->highWater = (uint32_t)(d->head - d->tail);
+  }
+  return 0;
+}
+
+bool readDedupNext(ReadDedup *d, ReadDedupRelease release, ReadRecord *rec)
+{
+  ReadDedupHeld *held;
+  uint8_t key[EPC_TABLE_KEY_MAX];
+  uint8_t len;
+  uint64_t *seq;
+
+  if (d->tail == d->head)
+  {
+    return false;
+  }
+  held = &d->ring[d->tail & d->mask];
+  if (READ_DEDUP_ALL != release && d->latestMs < held->rec.tsMs + d->windowMs
+      && (READ_DEDUP_EXPIRED == release || monotonicMs() - held->heldMs < d->windowMs))
+  {
+    return false;
+  }
+  *rec = held->rec;
+  /* Only records with a key are held, so this always finds one */
+  seq = makeKey(rec, key, &len) ? epcTableFind(&d->keys, key, len) : NULL;
+  if (NULL != seq && d->tail == *seq)
+  {
+    epcTableRemove(&d->keys, seq);
+  }
+  d->tail++;
+  d->released++;
+  return true;
+}
@@ -0,0 +1,78 @@
+/**
+ * Duplicate suppression per (EPC, antenna) over a time window.
+ *
+ * The first read of a tag on an antenna is held for the window; reads of
+ * the same tag on the same antenna inside it are dropped and their
+ * readCount added to the held record, which is then released with the
+ * total. A static tag in front of an antenna so becomes one record per
+ * window instead of dozens per second.
+ *
+ * Held records sit in a FIFO ring in the order they were first read and
+ * an EpcTable keyed by EPC and antenna finds a tag's held record. The
+ * window is the same for every record, so they expire in ring order:
+ * adding, merging and releasing are all O(1), however many tags are live.
+ * A record is released once a read a window past its first read arrives,
+ * or, when the tags go quiet, a window after it was held in host time.
+ * The clock is read when a record is first held, not for the reads merged
+ * into it, and releasing reads it only in the quiet check, which is left
+ * to idle moments.
+ * @file read_dedup.h
+ */
+
+#ifndef _READ_DEDUP_H
+#define _READ_DEDUP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "epc_table.h"
+#include "read_record.h"
+
+/* Held records the ring and table start with; both grow as needed */
+#define READ_DEDUP_CAPACITY (1024)
+
+/* When readDedupNext releases a held record */
+typedef enum ReadDedupRelease
+{
+  READ_DEDUP_EXPIRED,   /* a read a window past it has arrived */
+  READ_DEDUP_QUIET,     /* that, or it was held a window ago in host time */
+  READ_DEDUP_ALL        /* in any case, at shutdown */
+} ReadDedupRelease;
+
+typedef struct ReadDedupHeld
+{
+  ReadRecord rec;       /* first read, readCount merged */
+  uint64_t heldMs;      /* monotonic time it was held */
+} ReadDedupHeld;
+
+typedef struct ReadDedup
+{
+  EpcTable keys;        /* EPC and antenna -> sequence number of the held record */
+  ReadDedupHeld *ring;
+  uint32_t mask;
+  uint64_t head;        /* sequence number of the next record held */
+  uint64_t tail;        /* of the oldest record still held */
+  uint64_t windowMs;
+  uint64_t latestMs;    /* latest reader timestamp seen */
+  uint64_t reads;       /* offered so far */
+  uint64_t merged;      /* dropped as duplicates */
+  uint64_t released;
+  uint32_t highWater;   /* most records held at once */
+} ReadDedup;
+
+int readDedupInit(ReadDedup *d, uint32_t windowMs);
+void readDedupFree(ReadDedup *d);
+
+/**
+ * Hold a read, or merge it into the held record of its EPC and antenna.
+ * Returns 0, or -1 if it can't be deduplicated (an EPC too long for the
+ * table key, or no memory) and should be passed on as it is.
+ */
+int readDedupAdd(ReadDedup *d, const ReadRecord *rec);
+
+/**
+ * Release the oldest held record if release says it is due. Returns false
+ * when there is none to release.
+ */
+bool readDedupNext(ReadDedup *d, ReadDedupRelease release, ReadRecord *rec);
+
+#endif /* _READ_DEDUP_H */
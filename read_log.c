@@ -0,0 +1,362 @@
+/**
+ * Append-only binary read log in memory-mapped segments.
+ * @file read_log.c
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "read_log.h"
+#include "time_util.h"
+
+static uint64_t load64(const uint8_t *p)
+{
+  uint64_t v;
+
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+/* FNV-style mix of every 64-bit word but the one holding seq and check */
+uint32_t readLogCheck(const ReadLogRecord *r)
+{
+  const uint8_t *p = (const uint8_t *)r;
+  uint64_t h = 0xcbf29ce484222325ULL ^ r->seq;
+  size_t i;
+
+  for (i = 0; i < sizeof(*r); i += sizeof(uint64_t))
+  {
+    if (i != 8)
+    {
+      h = (h ^ load64(p + i)) * 0x100000001b3ULL;
+      h ^= h >> 29;
+    }
+  }
+  return (uint32_t)(h ^ (h >> 32));
+}
+
+/* A full segment on its way to the rotator */
+typedef struct LogClosing
+{
+  char path[300];
+  int fd;
+  uint8_t *map;
+  size_t mapSize;
+  uint64_t bytes;       /* header and records */
+} LogClosing;
+
+static int createSegment(ReadLog *log)
+{
+  int rc;
+
+  if (0 != rotateName(log->path, sizeof(log->path), log->dir, READ_LOG_PREFIX, READ_LOG_SUFFIX))
+  {
+    fprintf(stderr, "Log directory name too long: %s\n", log->dir);
+    return -1;
+  }
+  log->fd = open(log->path, O_RDWR | O_CREAT | O_EXCL, 0644);
+  if (log->fd < 0)
+  {
+    fprintf(stderr, "Cannot create log segment %s: %s\n", log->path, strerror(errno));
+    return -1;
+  }
+  /* Allocate every block now, so appends never fail or fragment on a full card */
+  rc = posix_fallocate(log->fd, 0, (off_t)log->segmentBytes);
+  if (0 != rc)
+  {
+    fprintf(stderr, "Cannot allocate log segment %s: %s\n", log->path, strerror(rc));
+    close(log->fd);
+    unlink(log->path);
+    log->fd = -1;
+    return -1;
+  }
+  log->map = mmap(NULL, log->segmentBytes, PROT_READ | PROT_WRITE, MAP_SHARED, log->fd, 0);
+  if (MAP_FAILED == log->map)
+  {
+    fprintf(stderr, "Cannot map log segment %s: %s\n", log->path, strerror(errno));
+    close(log->fd);
+    unlink(log->path);
+    log->fd = -1;
+    log->map = NULL;
+    return -1;
+  }
+  madvise(log->map, log->segmentBytes, MADV_SEQUENTIAL);
+  log->mapSize = log->segmentBytes;
+  log->header = (ReadLogHeader *)log->map;
+  log->records = (ReadLogRecord *)(log->map + READ_LOG_HEADER_SIZE);
+  log->capacity = (log->segmentBytes - READ_LOG_HEADER_SIZE) / READ_LOG_RECORD_SIZE;
+  log->count = 0;
+  log->synced = 0;
+
+  memcpy(log->header->magic, READ_LOG_MAGIC, sizeof(READ_LOG_MAGIC));
+  log->header->version = READ_LOG_VERSION;
+  log->header->headerSize = READ_LOG_HEADER_SIZE;
+  log->header->recordSize = READ_LOG_RECORD_SIZE;
+  log->header->endian = READ_LOG_ENDIAN;
+  log->header->segment = log->segments;
+  log->header->capacity = log->capacity;
+  log->header->createdMs = wallMs();
+  log->header->committed = 0;
+  snprintf(log->header->schema, sizeof(log->header->schema), "%s", READ_LOG_SCHEMA);
+  if (0 != msync(log->map, READ_LOG_HEADER_SIZE, MS_SYNC))
+  {
+    fprintf(stderr, "Cannot sync log segment %s: %s\n", log->path, strerror(errno));
+    return -1;
+  }
+  /* A running rotator syncs the directory after the old segment is finished */
+  if (NULL == log->rotator || !log->rotator->started)
+  {
+    rotateSyncDir(log->dir);
+  }
+  log->segments++;
+  return 0;
+}
+
+/* Trim to the records written, unmap and close */
+static void finishSegment(void *arg)
+{
+  LogClosing *c = arg;
+
+  munmap(c->map, c->mapSize);
+  if (0 != ftruncate(c->fd, (off_t)c->bytes))
+  {
+    fprintf(stderr, "Cannot trim log segment %s: %s\n", c->path, strerror(errno));
+  }
+  fsync(c->fd);
+  close(c->fd);
+  free(c);
+}
+
+/* Sync the open segment and hand it to the rotator, or finish it here without one */
+static int retireSegment(ReadLog *log, Rotator *rotator)
+{
+  LogClosing *c;
+
+  if (NULL == log->map)
+  {
+    return 0;
+  }
+  if (0 != readLogFlush(log))
+  {
+    return -1;
+  }
+  c = malloc(sizeof(*c));
+  if (NULL == c)
+  {
+    fprintf(stderr, "Cannot close log segment %s: out of memory\n", log->path);
+    return -1;
+  }
+  memcpy(c->path, log->path, sizeof(c->path));
+  c->fd = log->fd;
+  c->map = log->map;
+  c->mapSize = log->mapSize;
+  c->bytes = READ_LOG_HEADER_SIZE + log->count * READ_LOG_RECORD_SIZE;
+  log->map = NULL;
+  log->header = NULL;
+  log->records = NULL;
+  log->fd = -1;
+  log->count = 0;
+  log->capacity = 0;
+  rotatorRetire(rotator, finishSegment, c);
+  return 0;
+}
+
+int readLogOpen(ReadLog *log, const char *dir, uint32_t segmentMb, uint32_t batchRows, uint32_t batchMs)
+{
+  memset(log, 0, sizeof(*log));
+  log->fd = -1;
+  if ((size_t)snprintf(log->dir, sizeof(log->dir), "%s", dir) >= sizeof(log->dir))
+  {
+    fprintf(stderr, "Log directory name too long: %s\n", dir);
+    return -1;
+  }
+  log->segmentBytes = (uint64_t)(segmentMb ? segmentMb : READ_LOG_SEGMENT_MB) << 20;
+  log->batchRows = batchRows ? batchRows : 1;
+  log->batchMs = batchMs;
+  return createSegment(log);
+}
+
+int readLogRotate(ReadLog *log)
+{
+  if (0 != retireSegment(log, log->rotator))
+  {
+    return -1;
+  }
+  return createSegment(log);
+}
+
+int readLogAppend(ReadLog *log, const ReadRecord *rec)
+{
+  ReadLogRecord *r;
+
+  if (log->count == log->capacity && 0 != readLogRotate(log))
+  {
+    return -1;
+  }
+  if (0 == log->pending)
+  {
+    log->txStartMs = monotonicMs();
+  }
+
+  /* The slot is still zero from fallocate, so unused EPC bytes need no clearing */
+  r = &log->records[log->count];
+  r->tsMs = rec->tsMs;
+  r->readCount = rec->readCount;
+  r->frequency = rec->frequency;
+  r->rssi = (int16_t)rec->rssi;
+  r->phase = (int16_t)rec->phase;
+  r->power = (int16_t)rec->power;
+  r->antenna = rec->antenna;
+  r->protocol = rec->protocol;
+  r->epcLen = rec->epcLen;
+  memcpy(r->epc, rec->epc, rec->epcLen);
+  r->seq = (uint32_t)(log->count + 1);
+  r->check = readLogCheck(r);
+  log->count++;
+  log->pending++;
+
+  if (log->pending >= log->batchRows)
+  {
+    return readLogFlush(log);
+  }
+  return 0;
+}
+
+int readLogPoll(ReadLog *log)
+{
+  if (0 != log->pending && monotonicMs() - log->txStartMs >= log->batchMs)
+  {
+    return readLogFlush(log);
+  }
+  return 0;
+}
+
+int readLogFlush(ReadLog *log)
+{
+  size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  size_t start;
+  size_t end;
+
+  if (0 == log->pending || NULL == log->map)
+  {
+    return 0;
+  }
+  start = (READ_LOG_HEADER_SIZE + log->synced * READ_LOG_RECORD_SIZE) & ~(page - 1);
+  end = READ_LOG_HEADER_SIZE + log->count * READ_LOG_RECORD_SIZE;
+
+  /* Records first, so a committed count never points past what is on disk */
+  if (0 != msync(log->map + start, end - start, MS_SYNC))
+  {
+    fprintf(stderr, "Cannot sync log segment %s: %s\n", log->path, strerror(errno));
+    return -1;
+  }
+  log->header->committed = log->count;
+  if (0 != msync(log->map, READ_LOG_HEADER_SIZE, MS_SYNC))
+  {
+    fprintf(stderr, "Cannot sync log segment %s: %s\n", log->path, strerror(errno));
+    return -1;
+  }
+  log->synced = log->count;
+  log->rows += log->pending;
+  log->commits++;
+  log->pending = 0;
+  return 0;
+}
+
+void readLogClose(ReadLog *log)
+{
+  retireSegment(log, NULL);
+}
+
+int readLogReaderOpen(ReadLogReader *r, const char *path)
+{
+  struct stat st;
+  uint64_t room;
+
+  memset(r, 0, sizeof(*r));
+  r->fd = open(path, O_RDONLY);
+  if (r->fd < 0)
+  {
+    fprintf(stderr, "Cannot open %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+  if (0 != fstat(r->fd, &st) || st.st_size < READ_LOG_HEADER_SIZE)
+  {
+    fprintf(stderr, "%s is not a read log segment\n", path);
+    close(r->fd);
+    return -1;
+  }
+  r->size = (size_t)st.st_size;
+  r->map = mmap(NULL, r->size, PROT_READ, MAP_PRIVATE, r->fd, 0);
+  if (MAP_FAILED == r->map)
+  {
+    fprintf(stderr, "Cannot map %s: %s\n", path, strerror(errno));
+    close(r->fd);
+    return -1;
+  }
+  madvise(r->map, r->size, MADV_SEQUENTIAL);
+  r->header = (const ReadLogHeader *)r->map;
+  if (0 != memcmp(r->header->magic, READ_LOG_MAGIC, sizeof(READ_LOG_MAGIC))
+      || READ_LOG_VERSION != r->header->version
+      || READ_LOG_RECORD_SIZE != r->header->recordSize
+      || READ_LOG_HEADER_SIZE != r->header->headerSize)
+  {
+    fprintf(stderr, "%s is not a version %d read log segment\n", path, READ_LOG_VERSION);
+    readLogReaderClose(r);
+    return -1;
+  }
+  if (READ_LOG_ENDIAN != r->header->endian)
+  {
+    fprintf(stderr, "%s was written with the other byte order\n", path);
+    readLogReaderClose(r);
+    return -1;
+  }
+  r->records = (const ReadLogRecord *)(r->map + READ_LOG_HEADER_SIZE);
+  r->committed = r->header->committed;
+
+  /* Whole records run on past the committed count if the writer died between syncs */
+  room = (r->size - READ_LOG_HEADER_SIZE) / READ_LOG_RECORD_SIZE;
+  while (r->count < room && r->records[r->count].seq == r->count + 1
+         && r->records[r->count].check == readLogCheck(&r->records[r->count])
+         && r->records[r->count].epcLen <= READ_RECORD_EPC_MAX)
+  {
+    r->count++;
+  }
+  return 0;
+}
+
+void readLogReaderClose(ReadLogReader *r)
+{
+  if (NULL != r->map)
+  {
+    munmap(r->map, r->size);
+    r->map = NULL;
+  }
+  if (r->fd >= 0)
+  {
+    close(r->fd);
+    r->fd = -1;
+  }
+}
+
+void readLogGet(const ReadLogReader *r, uint64_t i, ReadRecord *rec)
+{
+  const ReadLogRecord *src = &r->records[i];
+
+  rec->tsMs = src->tsMs;
+  rec->readCount = src->readCount;
+  rec->frequency = src->frequency;
+  rec->rssi = src->rssi;
+  rec->phase = src->phase;
+  rec->power = src->power;
+  rec->antenna = src->antenna;
+  rec->protocol = src->protocol;
+  rec->epcLen = src->epcLen;
+  memcpy(rec->epc, src->epc, src->epcLen);
+}
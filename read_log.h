@@ -0,0 +1,143 @@
+/**
+ * Append-only binary read log in preallocated, memory-mapped segments.
+ *
+ * A segment is a one-page header followed by fixed-size records written
+ * straight into the mapping, so appending a read costs about a memcpy and
+ * no system call. Segments are preallocated when created and trimmed to
+ * their records when closed; a full segment rolls over to the next file
+ * in the directory, named after the time it was opened (see rotate.h).
+ *
+ * Records are synced like a SQLite transaction: after a number of records
+ * or a time limit, the new records are msync()ed and then the header's
+ * committed count. Each record also carries its number and a check value,
+ * so after a crash or power loss a reader keeps every whole record up to
+ * the first torn or missing one, even past the last committed count.
+ *
+ * All fields are in host byte order (little-endian on the gateways and
+ * dev boxes); the header says which, and lists the record layout.
+ * @file read_log.h
+ */
+
+#ifndef _READ_LOG_H
+#define _READ_LOG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "read_record.h"
+#include "rotate.h"
+
+#define READ_LOG_MAGIC "M6ELOG"
+#define READ_LOG_VERSION (1)
+#define READ_LOG_HEADER_SIZE (4096)
+#define READ_LOG_RECORD_SIZE (96)
+#define READ_LOG_ENDIAN (0x0102)
+#define READ_LOG_SEGMENT_MB (64)
+#define READ_LOG_SUFFIX ".m6l"
+#define READ_LOG_PREFIX "reads"
+
+#define READ_LOG_SCHEMA "tsMs:u64@0 seq:u32@8 check:u32@12 readCount:u32@16 frequency:u32@20 " \
+                        "rssi:i16@24 phase:i16@26 power:i16@28 antenna:u8@30 protocol:u8@31 " \
+                        "epcLen:u8@32 epc:u8[62]@33"
+
+typedef struct ReadLogHeader
+{
+  char magic[8];
+  uint16_t version;
+  uint16_t headerSize;
+  uint16_t recordSize;
+  uint16_t endian;      /* READ_LOG_ENDIAN as the writer stored it */
+  uint32_t segment;     /* segments the writer opened before this one */
+  uint32_t reserved;
+  uint64_t capacity;    /* records the file was created with room for */
+  uint64_t createdMs;   /* wall clock */
+  uint64_t committed;   /* records known to be on disk */
+  char schema[256];     /* READ_LOG_SCHEMA */
+} ReadLogHeader;
+
+typedef struct ReadLogRecord
+{
+  uint64_t tsMs;        /* reader timestamp, ms since the epoch */
+  uint32_t seq;         /* record number in the segment, from 1 */
+  uint32_t check;       /* readLogCheck() of the rest of the record */
+  uint32_t readCount;
+  uint32_t frequency;   /* kHz */
+  int16_t rssi;         /* dBm */
+  int16_t phase;        /* degrees */
+  int16_t power;        /* read power, cdBm */
+  uint8_t antenna;
+  uint8_t protocol;
+  uint8_t epcLen;
+  uint8_t epc[READ_RECORD_EPC_MAX];
+  uint8_t reserved;
+} ReadLogRecord;
+
+_Static_assert(sizeof(ReadLogRecord) == READ_LOG_RECORD_SIZE, "read log record layout");
+_Static_assert(sizeof(ReadLogHeader) <= READ_LOG_HEADER_SIZE, "read log header layout");
+
+typedef struct ReadLog
+{
+  char dir[256];
+  char path[300];       /* of the open segment */
+  Rotator *rotator;     /* finishes full segments, if set */
+  int fd;
+  uint8_t *map;
+  size_t mapSize;
+  ReadLogHeader *header;
+  ReadLogRecord *records;
+  uint64_t capacity;
+  uint64_t count;       /* records in the open segment */
+  uint64_t synced;      /* of them, on disk */
+  uint64_t segmentBytes;
+  uint32_t batchRows;   /* sync after this many records ... */
+  uint32_t batchMs;     /* ... or this many ms after the first unsynced one */
+  uint32_t pending;     /* records not synced yet */
+  uint64_t txStartMs;
+  uint64_t rows;        /* records synced so far, all segments */
+  uint64_t commits;     /* syncs so far */
+  uint32_t segments;    /* segments created */
+} ReadLog;
+
+/* A segment opened for reading */
+typedef struct ReadLogReader
+{
+  int fd;
+  uint8_t *map;
+  size_t size;
+  const ReadLogHeader *header;
+  const ReadLogRecord *records;
+  uint64_t count;       /* whole records, up to the first bad one */
+  uint64_t committed;   /* header's committed count */
+} ReadLogReader;
+
+uint32_t readLogCheck(const ReadLogRecord *r);
+
+/** Start a new segment in dir, which must exist. Returns 0 or -1. */
+int readLogOpen(ReadLog *log, const char *dir, uint32_t segmentMb, uint32_t batchRows, uint32_t batchMs);
+
+/** Append one record; syncs when the record limit is reached. Returns 0 or -1. */
+int readLogAppend(ReadLog *log, const ReadRecord *rec);
+
+/** Sync if the oldest unsynced record is older than batchMs. */
+int readLogPoll(ReadLog *log);
+
+/** Sync the new records, then the header's committed count. */
+int readLogFlush(ReadLog *log);
+
+/**
+ * Sync and move on to a new segment; the old one is trimmed and closed
+ * by the rotator. Returns 0 or -1.
+ */
+int readLogRotate(ReadLog *log);
+
+/** Sync, trim the segment to its records and close it. Safe to call twice. */
+void readLogClose(ReadLog *log);
+
+/** Map a segment and find its whole records. Returns 0 or -1. */
+int readLogReaderOpen(ReadLogReader *r, const char *path);
+void readLogReaderClose(ReadLogReader *r);
+
+/** Record i (below r->count) as a ReadRecord. */
+void readLogGet(const ReadLogReader *r, uint64_t i, ReadRecord *rec);
+
+#endif /* _READ_LOG_H */
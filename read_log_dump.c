@@ -0,0 +1,215 @@
+/**
+ * Export read log segments written by read_cont --log (raw, *.m6l) or
+ * --pack (compressed, *.m6z) to CSV or to a database with the schema of
+ * db_sink.h.
+ *
+ * Segments are read in the order given; whole records past a raw
+ * segment's last sync (the writer stopped without closing it) are
+ * exported too and counted as recovered. A compressed segment is decoded
+ * up to its first torn block.
+ *
+ * Usage: read_log_dump [--csv out.csv | --db out.db] segment...
+ * @file read_log_dump.c
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sqlite3.h>
+#include "db_sink.h"
+#include "read_log.h"
+#include "read_pack.h"
+
+#define usage() {fprintf(stderr, "Usage: read_log_dump [--csv out.csv | --db out.db] segment...\n"\
+                         "[--csv out.csv] : e.g, '--csv reads.csv' (default: CSV to stdout)\n"\
+                         "[--db out.db] : e.g, '--db reads.db' (recreated if present)\n"\
+                         "segment : e.g, 'log/reads-*.m6l' or 'log/reads-*.m6z'\n"); exit(1);}
+
+#define DUMP_BATCH_ROWS (10000)
+
+typedef struct DumpStats
+{
+  uint64_t rows;
+  uint64_t recovered;
+  uint64_t lost;
+  uint32_t damaged;     /* compressed segments cut short */
+} DumpStats;
+
+static void writeCsv(FILE *fp, const ReadRecord *rec)
+{
+  static const char digits[] = "0123456789ABCDEF";
+  char hex[2 * READ_RECORD_EPC_MAX + 1];
+  uint8_t i;
+
+  for (i = 0; i < rec->epcLen; i++)
+  {
+    hex[2 * i] = digits[rec->epc[i] >> 4];
+    hex[2 * i + 1] = digits[rec->epc[i] & 0xf];
+  }
+  hex[2 * rec->epcLen] = '\0';
+  fprintf(fp, "%s,%" PRIu64 ",%d,%d,%u,%d,%u,%u,%u\n", hex, rec->tsMs, rec->rssi, rec->phase,
+          rec->frequency, rec->power, rec->antenna, rec->readCount, rec->protocol);
+}
+
+/* Raw and compressed segments are told apart by their first bytes */
+static bool isPacked(const char *path)
+{
+  char magic[sizeof(READ_PACK_MAGIC)] = "";
+  FILE *fp = fopen(path, "rb");
+
+  if (NULL != fp)
+  {
+    if (1 != fread(magic, sizeof(magic), 1, fp))
+    {
+      magic[0] = '\0';
+    }
+    fclose(fp);
+  }
+  return 0 == memcmp(magic, READ_PACK_MAGIC, sizeof(magic));
+}
+
+static int exportRecord(FILE *csv, DbSink *sink, const ReadRecord *rec)
+{
+  if (NULL == csv)
+  {
+    return SQLITE_OK == dbSinkInsert(sink, rec) ? 0 : -1;
+  }
+  writeCsv(csv, rec);
+  return 0;
+}
+
+static int exportPacked(const char *path, FILE *csv, DbSink *sink, DumpStats *stats)
+{
+  ReadPackReader reader;
+  ReadRecord rec;
+  int rc = 0;
+
+  if (0 != readPackReaderOpen(&reader, path))
+  {
+    return -1;
+  }
+  while (0 == rc && readPackNext(&reader, &rec))
+  {
+    rc = exportRecord(csv, sink, &rec);
+  }
+  stats->rows += reader.records;
+  if (reader.damaged)
+  {
+    fprintf(stderr, "%s: block %" PRIu64 " is torn or damaged, rest of the segment skipped\n",
+            path, reader.blocks + 1);
+    stats->damaged++;
+  }
+  readPackReaderClose(&reader);
+  return rc;
+}
+
+static int exportRaw(const char *path, FILE *csv, DbSink *sink, DumpStats *stats)
+{
+  ReadLogReader reader;
+  ReadRecord rec;
+  uint64_t j;
+  int rc = 0;
+
+  if (0 != readLogReaderOpen(&reader, path))
+  {
+    return -1;
+  }
+  for (j = 0; j < reader.count && 0 == rc; j++)
+  {
+    readLogGet(&reader, j, &rec);
+    rc = exportRecord(csv, sink, &rec);
+  }
+  stats->rows += reader.count;
+  if (reader.count > reader.committed)
+  {
+    stats->recovered += reader.count - reader.committed;
+  }
+  else if (reader.count < reader.committed)
+  {
+    fprintf(stderr, "%s: record %" PRIu64 " is damaged, %" PRIu64 " committed records after it skipped\n",
+            path, reader.count + 1, reader.committed - reader.count);
+    stats->lost += reader.committed - reader.count;
+  }
+  readLogReaderClose(&reader);
+  return rc;
+}
+
+int main(int argc, char *argv[])
+{
+  FILE *csv = NULL;
+  DbSink sink;
+  DumpStats stats;
+  const char *csvPath = NULL;
+  const char *dbPath = NULL;
+  int first = 1;
+  int rc = 0;
+  int i;
+
+  if (argc > 2 && 0 == strcmp("--csv", argv[1]))
+  {
+    csvPath = argv[2];
+    first = 3;
+  }
+  else if (argc > 2 && 0 == strcmp("--db", argv[1]))
+  {
+    dbPath = argv[2];
+    first = 3;
+  }
+  if (first >= argc || '-' == argv[first][0])
+  {
+    usage();
+  }
+
+  if (NULL != dbPath)
+  {
+    if (SQLITE_OK != dbSinkOpen(&sink, dbPath, false, DUMP_BATCH_ROWS, UINT32_MAX))
+    {
+      return 1;
+    }
+  }
+  else
+  {
+    csv = NULL == csvPath ? stdout : fopen(csvPath, "w");
+    if (NULL == csv)
+    {
+      perror(csvPath);
+      return 1;
+    }
+    fprintf(csv, "epc,ts_ms,rssi,phase,freq,pow,ant,read_count,protocol\n");
+  }
+
+  memset(&stats, 0, sizeof(stats));
+  for (i = first; i < argc && 0 == rc; i++)
+  {
+    if (isPacked(argv[i]))
+    {
+      rc = exportPacked(argv[i], csv, &sink, &stats);
+    }
+    else
+    {
+      rc = exportRaw(argv[i], csv, &sink, &stats);
+    }
+  }
+
+  if (NULL != dbPath)
+  {
+    if (0 == rc && SQLITE_OK != dbSinkFlush(&sink))
+    {
+      rc = -1;
+    }
+    dbSinkClose(&sink);
+  }
+  else if (csv != stdout)
+  {
+    if (0 != fclose(csv))
+    {
+      perror(csvPath);
+      rc = -1;
+    }
+  }
+
+  fprintf(stderr, "Exported %" PRIu64 " records from %d segments, %" PRIu64 " recovered past the last sync, %" PRIu64 " lost"
+          ", %u cut short\n", stats.rows, argc - first, stats.recovered, stats.lost, stats.damaged);
+  return 0 == rc ? 0 : 1;
+}
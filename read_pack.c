@@ -0,0 +1,593 @@
+/**
+ * Compressed read log segments.
+ * @file read_pack.c
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "read_pack.h"
+#include "time_util.h"
+
+/* Tags seen in a typical segment; the dictionary grows past this as needed */
+#define READ_PACK_EPC_CACHE (1024)
+/* A block claiming more than this is corrupt, whatever its header says */
+#define READ_PACK_BLOCK_LIMIT (16 * 1024 * 1024)
+
+static uint8_t *putVarint(uint8_t *p, uint64_t v)
+{
+  while (v >= 0x80)
+  {
+    *p++ = (uint8_t)v | 0x80;
+    v >>= 7;
+  }
+  *p++ = (uint8_t)v;
+  return p;
+}
+
+static uint64_t zigzag(int64_t v)
+{
+  return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static int64_t unzigzag(uint64_t v)
+{
+  return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+/* FNV-1a of the payload, seeded with the record count */
+static uint32_t blockCheck(const uint8_t *payload, uint32_t bytes, uint32_t records)
+{
+  uint32_t h = 2166136261U ^ records;
+  uint32_t i;
+
+  for (i = 0; i < bytes; i++)
+  {
+    h = (h ^ payload[i]) * 16777619U;
+  }
+  return h;
+}
+
+static bool sameContext(const ReadPackContext *a, const ReadPackContext *b)
+{
+  return a->frequency == b->frequency && a->power == b->power
+    && a->antenna == b->antenna && a->protocol == b->protocol;
+}
+
+static int writeAll(int fd, const uint8_t *buf, size_t len)
+{
+  while (len > 0)
+  {
+    ssize_t n = write(fd, buf, len);
+
+    if (n < 0 && EINTR == errno)
+    {
+      continue;
+    }
+    if (n <= 0)
+    {
+      return -1;
+    }
+    buf += n;
+    len -= n;
+  }
+  return 0;
+}
+
+static int createSegment(ReadPack *pack)
+{
+  ReadPackHeader header;
+
+  if (0 != rotateName(pack->path, sizeof(pack->path), pack->dir, READ_PACK_PREFIX, READ_PACK_SUFFIX))
+  {
+    fprintf(stderr, "Log directory name too long: %s\n", pack->dir);
+    return -1;
+  }
+  pack->fd = open(pack->path, O_WRONLY | O_CREAT | O_EXCL | O_APPEND, 0644);
+  if (pack->fd < 0)
+  {
+    fprintf(stderr, "Cannot create log segment %s: %s\n", pack->path, strerror(errno));
+    return -1;
+  }
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, READ_PACK_MAGIC, sizeof(READ_PACK_MAGIC));
+  header.version = READ_PACK_VERSION;
+  header.headerSize = sizeof(header);
+  header.segment = pack->segments;
+  header.createdMs = wallMs();
+  header.blockMax = READ_PACK_BLOCK_MAX;
+  if (0 != writeAll(pack->fd, (const uint8_t *)&header, sizeof(header)) || 0 != fdatasync(pack->fd))
+  {
+    fprintf(stderr, "Cannot write log segment %s: %s\n", pack->path, strerror(errno));
+    close(pack->fd);
+    pack->fd = -1;
+    return -1;
+  }
+  /* A running rotator syncs the directory after the old segment is closed */
+  if (NULL == pack->rotator || !pack->rotator->started)
+  {
+    rotateSyncDir(pack->dir);
+  }
+
+  /* Each segment decodes on its own */
+  pack->written = sizeof(header);
+  epcTableClear(&pack->epcs);
+  pack->contextCount = 0;
+  pack->haveLast = false;
+  pack->lastTsMs = 0;
+  pack->segments++;
+  return 0;
+}
+
+static int writeBlock(ReadPack *pack)
+{
+  ReadPackBlock header;
+  uint32_t len;
+
+  if (0 == pack->blockRecords)
+  {
+    return 0;
+  }
+  header.magic = READ_PACK_BLOCK_MAGIC;
+  header.bytes = pack->used;
+  header.records = pack->blockRecords;
+  header.check = blockCheck(pack->block + sizeof(header), pack->used, pack->blockRecords);
+  memcpy(pack->block, &header, sizeof(header));
+  len = sizeof(header) + pack->used;
+  /* One write per block, so a crash leaves at most one torn block at the end */
+  if (0 != writeAll(pack->fd, pack->block, len))
+  {
+    fprintf(stderr, "Cannot write log segment %s: %s\n", pack->path, strerror(errno));
+    return -1;
+  }
+  pack->written += len;
+  pack->bytes += len;
+  pack->used = 0;
+  pack->blockRecords = 0;
+  return 0;
+}
+
+/* Blocks are synced as they are flushed, so only the close is left */
+static void finishSegment(void *arg)
+{
+  int *fd = arg;
+
+  close(*fd);
+  free(fd);
+}
+
+/* Flush the open segment and hand it to the rotator, or close it here without one */
+static int retireSegment(ReadPack *pack, Rotator *rotator)
+{
+  int *fd;
+
+  if (pack->fd < 0)
+  {
+    return 0;
+  }
+  if (0 != readPackFlush(pack))
+  {
+    return -1;
+  }
+  fd = malloc(sizeof(*fd));
+  if (NULL == fd)
+  {
+    close(pack->fd);
+  }
+  else
+  {
+    *fd = pack->fd;
+    rotatorRetire(rotator, finishSegment, fd);
+  }
+  pack->fd = -1;
+  return 0;
+}
+
+int readPackOpen(ReadPack *pack, const char *dir, uint32_t segmentMb, uint32_t batchRows, uint32_t batchMs)
+{
+  memset(pack, 0, sizeof(*pack));
+  pack->fd = -1;
+  if ((size_t)snprintf(pack->dir, sizeof(pack->dir), "%s", dir) >= sizeof(pack->dir))
+  {
+    fprintf(stderr, "Log directory name too long: %s\n", dir);
+    return -1;
+  }
+  pack->segmentBytes = (uint64_t)(segmentMb ? segmentMb : READ_PACK_SEGMENT_MB) << 20;
+  pack->batchRows = batchRows ? batchRows : 1;
+  pack->batchMs = batchMs;
+  pack->block = malloc(sizeof(ReadPackBlock) + READ_PACK_BLOCK_MAX);
+  if (NULL == pack->block || 0 != epcTableInit(&pack->epcs, READ_PACK_EPC_CACHE, sizeof(uint32_t)))
+  {
+    fprintf(stderr, "Cannot allocate the read log encoder\n");
+    free(pack->block);
+    pack->block = NULL;
+    return -1;
+  }
+  if (0 != createSegment(pack))
+  {
+    readPackClose(pack);
+    return -1;
+  }
+  return 0;
+}
+
+int readPackAppend(ReadPack *pack, const ReadRecord *rec)
+{
+  ReadPackContext ctx;
+  uint8_t *start;
+  uint8_t *p;
+  uint8_t flags = 0;
+  uint32_t *index = NULL;
+  bool created = false;
+
+  if (READ_PACK_BLOCK_MAX - pack->used < READ_PACK_RECORD_MAX)
+  {
+    if (0 != writeBlock(pack))
+    {
+      return -1;
+    }
+    if (pack->written >= pack->segmentBytes && 0 != readPackRotate(pack))
+    {
+      return -1;
+    }
+  }
+  if (0 == pack->pending)
+  {
+    pack->txStartMs = monotonicMs();
+  }
+
+  start = pack->block + sizeof(ReadPackBlock) + pack->used;
+  p = start + 1;
+  if (rec->epcLen <= READ_PACK_DICT_EPC_MAX)
+  {
+    index = epcTableInsert(&pack->epcs, rec->epc, rec->epcLen, &created);
+    if (NULL == index)
+    {
+      fprintf(stderr, "Cannot grow the read log EPC dictionary\n");
+      return -1;
+    }
+    if (created)
+    {
+      /* Entries are numbered in the order the decoder will see them */
+      *index = pack->epcs.count - 1;
+    }
+  }
+  if (NULL == index || created)
+  {
+    flags |= READ_PACK_NEW_EPC;
+    *p++ = rec->epcLen;
+    memcpy(p, rec->epc, rec->epcLen);
+    p += rec->epcLen;
+  }
+  else
+  {
+    p = putVarint(p, *index);
+  }
+
+  ctx.frequency = rec->frequency;
+  ctx.power = rec->power;
+  ctx.antenna = rec->antenna;
+  ctx.protocol = rec->protocol;
+  if (!pack->haveLast || !sameContext(&ctx, &pack->last))
+  {
+    uint32_t i;
+
+    flags |= READ_PACK_CONTEXT;
+    for (i = 0; i < pack->contextCount && !sameContext(&ctx, &pack->contexts[i]); i++)
+    {
+    }
+    p = putVarint(p, i);
+    if (i == pack->contextCount)
+    {
+      p = putVarint(p, ctx.frequency);
+      p = putVarint(p, zigzag(ctx.power));
+      *p++ = ctx.antenna;
+      *p++ = ctx.protocol;
+      if (pack->contextCount < READ_PACK_CONTEXT_MAX)
+      {
+        pack->contexts[pack->contextCount++] = ctx;
+      }
+    }
+    pack->last = ctx;
+    pack->haveLast = true;
+  }
+  if (1 != rec->readCount)
+  {
+    flags |= READ_PACK_COUNT;
+    p = putVarint(p, rec->readCount);
+  }
+  p = putVarint(p, zigzag((int64_t)(rec->tsMs - pack->lastTsMs)));
+  pack->lastTsMs = rec->tsMs;
+  p = putVarint(p, zigzag(rec->rssi));
+  p = putVarint(p, zigzag(rec->phase));
+  *start = flags;
+
+  pack->used += p - start;
+  pack->blockRecords++;
+  pack->pending++;
+  if (pack->pending >= pack->batchRows)
+  {
+    return readPackFlush(pack);
+  }
+  return 0;
+}
+
+int readPackRotate(ReadPack *pack)
+{
+  if (0 != writeBlock(pack) || 0 != retireSegment(pack, pack->rotator))
+  {
+    return -1;
+  }
+  return createSegment(pack);
+}
+
+int readPackPoll(ReadPack *pack)
+{
+  if (0 != pack->pending && monotonicMs() - pack->txStartMs >= pack->batchMs)
+  {
+    return readPackFlush(pack);
+  }
+  return 0;
+}
+
+int readPackFlush(ReadPack *pack)
+{
+  if (0 == pack->pending || pack->fd < 0)
+  {
+    return 0;
+  }
+  if (0 != writeBlock(pack))
+  {
+    return -1;
+  }
+  if (0 != fdatasync(pack->fd))
+  {
+    fprintf(stderr, "Cannot sync log segment %s: %s\n", pack->path, strerror(errno));
+    return -1;
+  }
+  pack->rows += pack->pending;
+  pack->commits++;
+  pack->pending = 0;
+  return 0;
+}
+
+void readPackClose(ReadPack *pack)
+{
+  retireSegment(pack, NULL);
+  free(pack->block);
+  pack->block = NULL;
+  epcTableFree(&pack->epcs);
+}
+
+int readPackReaderOpen(ReadPackReader *r, const char *path)
+{
+  memset(r, 0, sizeof(*r));
+  r->fp = fopen(path, "rb");
+  if (NULL == r->fp)
+  {
+    fprintf(stderr, "Cannot open %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+  if (1 != fread(&r->header, sizeof(r->header), 1, r->fp)
+      || 0 != memcmp(r->header.magic, READ_PACK_MAGIC, sizeof(READ_PACK_MAGIC))
+      || READ_PACK_VERSION != r->header.version
+      || r->header.headerSize < sizeof(r->header)
+      || r->header.blockMax > READ_PACK_BLOCK_LIMIT)
+  {
+    fprintf(stderr, "%s is not a version %d compressed read log segment\n", path, READ_PACK_VERSION);
+    readPackReaderClose(r);
+    return -1;
+  }
+  r->payload = malloc(r->header.blockMax);
+  if (NULL == r->payload || 0 != fseek(r->fp, r->header.headerSize, SEEK_SET))
+  {
+    fprintf(stderr, "Cannot read %s\n", path);
+    readPackReaderClose(r);
+    return -1;
+  }
+  return 0;
+}
+
+static bool getVarint(ReadPackReader *r, uint64_t *v)
+{
+  uint32_t shift = 0;
+
+  *v = 0;
+  while (r->pos < r->size && shift < 64)
+  {
+    uint8_t byte = r->payload[r->pos++];
+
+    *v |= (uint64_t)(byte & 0x7f) << shift;
+    if (0 == (byte & 0x80))
+    {
+      return true;
+    }
+    shift += 7;
+  }
+  return false;
+}
+
+static bool getByte(ReadPackReader *r, uint8_t *v)
+{
+  if (r->pos >= r->size)
+  {
+    return false;
+  }
+  *v = r->payload[r->pos++];
+  return true;
+}
+
+static bool nextBlock(ReadPackReader *r)
+{
+  ReadPackBlock block;
+  size_t n = fread(&block, 1, sizeof(block), r->fp);
+
+  if (0 == n && feof(r->fp))
+  {
+    return false;
+  }
+  if (sizeof(block) != n || READ_PACK_BLOCK_MAGIC != block.magic
+      || block.bytes > r->header.blockMax || 0 == block.records
+      || block.bytes != fread(r->payload, 1, block.bytes, r->fp)
+      || block.check != blockCheck(r->payload, block.bytes, block.records))
+  {
+    r->damaged = true;
+    return false;
+  }
+  r->size = block.bytes;
+  r->pos = 0;
+  r->left = block.records;
+  r->blocks++;
+  return true;
+}
+
+static bool decode(ReadPackReader *r, ReadRecord *rec)
+{
+  uint64_t v;
+  uint8_t flags;
+
+  if (!getByte(r, &flags))
+  {
+    return false;
+  }
+  if (flags & READ_PACK_NEW_EPC)
+  {
+    if (!getByte(r, &rec->epcLen) || rec->epcLen > READ_RECORD_EPC_MAX || r->size - r->pos < rec->epcLen)
+    {
+      return false;
+    }
+    memcpy(rec->epc, r->payload + r->pos, rec->epcLen);
+    r->pos += rec->epcLen;
+    if (rec->epcLen <= READ_PACK_DICT_EPC_MAX)
+    {
+      if (r->epcCount == r->epcCapacity)
+      {
+        uint32_t capacity = r->epcCapacity ? 2 * r->epcCapacity : READ_PACK_EPC_CACHE;
+        void *epcs = realloc(r->epcs, capacity * sizeof(*r->epcs));
+
+        if (NULL == epcs)
+        {
+          return false;
+        }
+        r->epcs = epcs;
+        r->epcCapacity = capacity;
+      }
+      r->epcs[r->epcCount][0] = rec->epcLen;
+      memcpy(&r->epcs[r->epcCount][1], rec->epc, rec->epcLen);
+      r->epcCount++;
+    }
+  }
+  else
+  {
+    if (!getVarint(r, &v) || v >= r->epcCount)
+    {
+      return false;
+    }
+    rec->epcLen = r->epcs[v][0];
+    memcpy(rec->epc, &r->epcs[v][1], rec->epcLen);
+  }
+
+  if (flags & READ_PACK_CONTEXT)
+  {
+    if (!getVarint(r, &v) || v > r->contextCount)
+    {
+      return false;
+    }
+    if (v < r->contextCount)
+    {
+      r->last = r->contexts[v];
+    }
+    else
+    {
+      uint64_t frequency;
+      uint64_t power;
+
+      if (!getVarint(r, &frequency) || !getVarint(r, &power)
+          || !getByte(r, &r->last.antenna) || !getByte(r, &r->last.protocol))
+      {
+        return false;
+      }
+      r->last.frequency = (uint32_t)frequency;
+      r->last.power = (int32_t)unzigzag(power);
+      if (r->contextCount < READ_PACK_CONTEXT_MAX)
+      {
+        r->contexts[r->contextCount++] = r->last;
+      }
+    }
+  }
+  else if (0 == r->records)
+  {
+    /* The first record always sets a context */
+    return false;
+  }
+  rec->frequency = r->last.frequency;
+  rec->power = r->last.power;
+  rec->antenna = r->last.antenna;
+  rec->protocol = r->last.protocol;
+
+  rec->readCount = 1;
+  if (flags & READ_PACK_COUNT)
+  {
+    if (!getVarint(r, &v))
+    {
+      return false;
+    }
+    rec->readCount = (uint32_t)v;
+  }
+  if (!getVarint(r, &v))
+  {
+    return false;
+  }
+  r->lastTsMs += (uint64_t)unzigzag(v);
+  rec->tsMs = r->lastTsMs;
+  if (!getVarint(r, &v))
+  {
+    return false;
+  }
+  rec->rssi = (int32_t)unzigzag(v);
+  if (!getVarint(r, &v))
+  {
+    return false;
+  }
+  rec->phase = (int32_t)unzigzag(v);
+  return true;
+}
+
+int readPackNext(ReadPackReader *r, ReadRecord *rec)
+{
+  if (r->damaged)
+  {
+    return 0;
+  }
+  while (0 == r->left)
+  {
+    if (!nextBlock(r))
+    {
+      return 0;
+    }
+  }
+  if (!decode(r, rec))
+  {
+    r->damaged = true;
+    r->left = 0;
+    return 0;
+  }
+  r->left--;
+  r->records++;
+  return 1;
+}
+
+void readPackReaderClose(ReadPackReader *r)
+{
+  if (NULL != r->fp)
+  {
+    fclose(r->fp);
+    r->fp = NULL;
+  }
+  free(r->payload);
+  r->payload = NULL;
+  free(r->epcs);
+  r->epcs = NULL;
+}
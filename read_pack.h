@@ -0,0 +1,165 @@
+/**
+ * Compressed read log segments for long unattended captures.
+ *
+ * A segment is a short header followed by blocks, each a block header
+ * (size, record count, check value) and a payload of variable-length
+ * records. Within a segment every record is coded against what came
+ * before it:
+ *
+ *   flags     u8: READ_PACK_NEW_EPC, READ_PACK_CONTEXT, READ_PACK_COUNT
+ *   epc       varint index into the segment's EPC dictionary, or with
+ *             NEW_EPC the length and bytes, added to the dictionary when
+ *             at most READ_PACK_DICT_EPC_MAX bytes long
+ *   context   with CONTEXT only: varint index into the segment's
+ *             dictionary of (frequency, antenna, power, protocol); the
+ *             next free index is followed by the new context itself.
+ *             Without the flag the previous record's context repeats.
+ *   count     with COUNT only: varint readCount, otherwise 1
+ *   tsMs      zigzag varint difference from the previous record
+ *   rssi      zigzag varint
+ *   phase     zigzag varint
+ *
+ * A typical read takes 5 to 7 bytes instead of 96 in a raw segment.
+ * Blocks are written whole and checked, so after a crash a decoder
+ * stops cleanly at the first torn block; everything before it decodes.
+ * @file read_pack.h
+ */
+
+#ifndef _READ_PACK_H
+#define _READ_PACK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "epc_table.h"
+#include "read_record.h"
+#include "rotate.h"
+
+#define READ_PACK_MAGIC "M6EPACK"
+#define READ_PACK_BLOCK_MAGIC (0x425a364dU)  /* "M6ZB" */
+#define READ_PACK_VERSION (1)
+#define READ_PACK_SUFFIX ".m6z"
+#define READ_PACK_PREFIX "reads"
+#define READ_PACK_SEGMENT_MB (64)
+
+/* Payload bytes per block; a block is written when the next record might not fit */
+#define READ_PACK_BLOCK_MAX (64 * 1024)
+/* Longest encoding of one record */
+#define READ_PACK_RECORD_MAX (160)
+/* Longer EPCs are always written in full */
+#define READ_PACK_DICT_EPC_MAX (32)
+/* Contexts past this many in a segment are written in full each time */
+#define READ_PACK_CONTEXT_MAX (256)
+
+#define READ_PACK_NEW_EPC (0x01)
+#define READ_PACK_CONTEXT (0x02)
+#define READ_PACK_COUNT (0x04)
+
+_Static_assert(READ_PACK_DICT_EPC_MAX <= EPC_TABLE_KEY_MAX, "dictionary EPCs must be exact table keys");
+
+typedef struct ReadPackHeader
+{
+  char magic[8];
+  uint16_t version;
+  uint16_t headerSize;
+  uint32_t segment;     /* segments the writer opened before this one */
+  uint64_t createdMs;   /* wall clock */
+  uint32_t blockMax;    /* READ_PACK_BLOCK_MAX of the writer */
+  uint32_t reserved;
+} ReadPackHeader;
+
+typedef struct ReadPackBlock
+{
+  uint32_t magic;       /* READ_PACK_BLOCK_MAGIC */
+  uint32_t bytes;       /* payload size */
+  uint32_t records;
+  uint32_t check;       /* of records and payload */
+} ReadPackBlock;
+
+/* Radio settings that rarely change from one read to the next */
+typedef struct ReadPackContext
+{
+  uint32_t frequency;
+  int32_t power;
+  uint8_t antenna;
+  uint8_t protocol;
+} ReadPackContext;
+
+typedef struct ReadPack
+{
+  char dir[256];
+  char path[300];       /* of the open segment */
+  Rotator *rotator;     /* closes full segments, if set */
+  int fd;
+  uint64_t segmentBytes;
+  uint64_t written;     /* bytes in the open segment */
+  uint8_t *block;       /* block header followed by the payload */
+  uint32_t used;        /* payload bytes */
+  uint32_t blockRecords;
+  EpcTable epcs;        /* EPC -> dictionary index */
+  ReadPackContext contexts[READ_PACK_CONTEXT_MAX];
+  uint32_t contextCount;
+  ReadPackContext last; /* context of the previous record */
+  bool haveLast;
+  uint64_t lastTsMs;
+  uint32_t batchRows;   /* sync after this many records ... */
+  uint32_t batchMs;     /* ... or this many ms after the first unsynced one */
+  uint32_t pending;     /* records not synced yet */
+  uint64_t txStartMs;
+  uint64_t rows;        /* records synced so far, all segments */
+  uint64_t commits;     /* syncs so far */
+  uint64_t bytes;       /* bytes written, all segments */
+  uint32_t segments;    /* segments created */
+} ReadPack;
+
+/* Streaming decoder for one segment */
+typedef struct ReadPackReader
+{
+  FILE *fp;
+  ReadPackHeader header;
+  uint8_t *payload;
+  uint32_t size;        /* payload bytes of the current block */
+  uint32_t pos;
+  uint32_t left;        /* records left in the current block */
+  uint8_t (*epcs)[READ_PACK_DICT_EPC_MAX + 1]; /* length, then bytes */
+  uint32_t epcCount;
+  uint32_t epcCapacity;
+  ReadPackContext contexts[READ_PACK_CONTEXT_MAX];
+  uint32_t contextCount;
+  ReadPackContext last;
+  uint64_t lastTsMs;
+  uint64_t records;     /* decoded so far */
+  uint64_t blocks;
+  bool damaged;         /* stopped at a torn or corrupt block */
+} ReadPackReader;
+
+/** Start a new segment in dir, which must exist. Returns 0 or -1. */
+int readPackOpen(ReadPack *pack, const char *dir, uint32_t segmentMb, uint32_t batchRows, uint32_t batchMs);
+
+/** Encode one record; syncs when the record limit is reached. Returns 0 or -1. */
+int readPackAppend(ReadPack *pack, const ReadRecord *rec);
+
+/** Sync if the oldest unsynced record is older than batchMs. */
+int readPackPoll(ReadPack *pack);
+
+/** Write the open block and sync it. */
+int readPackFlush(ReadPack *pack);
+
+/** Flush and move on to a new segment, closed by the rotator. Returns 0 or -1. */
+int readPackRotate(ReadPack *pack);
+
+/** Flush and close the segment. Safe to call twice. */
+void readPackClose(ReadPack *pack);
+
+/** Open a segment and read its header. Returns 0 or -1. */
+int readPackReaderOpen(ReadPackReader *r, const char *path);
+
+/**
+ * Decode the next record. Returns 1, or 0 at the end of the segment or
+ * at the first damaged block (r->damaged tells which).
+ */
+int readPackNext(ReadPackReader *r, ReadRecord *rec);
+
+void readPackReaderClose(ReadPackReader *r);
+
+#endif /* _READ_PACK_H */
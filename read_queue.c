@@ -0,0 +1,100 @@
+/**
+ * Bounded lock-free single-producer/single-consumer queue of ReadRecords.
+ * @file read_queue.c
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "read_queue.h"
+
+int readQueueInit(ReadQueue *q, uint32_t capacity)
+{
+  uint32_t size = 2;
+
+  memset(q, 0, sizeof(*q));
+  while (size < capacity)
+  {
+    size <<= 1;
+  }
+  q->slots = malloc((size_t)size * sizeof(ReadRecord));
+  if (NULL == q->slots)
+  {
+    return -1;
+  }
+  q->mask = size - 1;
+  atomic_init(&q->head, 0);
+  atomic_init(&q->tail, 0);
+  atomic_init(&q->highWater, 0);
+  atomic_init(&q->pushed, 0);
+  atomic_init(&q->dropped, 0);
+  return 0;
+}
+
+void readQueueFree(ReadQueue *q)
+{
+  free(q->slots);
+  q->slots = NULL;
+}
+
+bool readQueuePush(ReadQueue *q, const ReadRecord *rec)
+{
+  uint32_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+  uint32_t depth = head - q->tailCache;
+
+  if (depth > q->mask)
+  {
+    /* Looks full with the cached tail, refresh it from the consumer */
+    q->tailCache = atomic_load_explicit(&q->tail, memory_order_acquire);
+    depth = head - q->tailCache;
+    if (depth > q->mask)
+    {
+      atomic_fetch_add_explicit(&q->dropped, 1, memory_order_relaxed);
+      return false;
+    }
+  }
+
+  q->slots[head & q->mask] = *rec;
+  atomic_store_explicit(&q->head, head + 1, memory_order_release);
+  atomic_fetch_add_explicit(&q->pushed, 1, memory_order_relaxed);
+  /*
+   * The cached tail only ever overstates the depth. Past the high-water
+   * mark, refresh it to get the real depth; that is rare once the mark has
+   * settled, so the tail's cache line stays with the consumer.
+   */
+  if (depth + 1 > atomic_load_explicit(&q->highWater, memory_order_relaxed))
+  {
+    q->tailCache = atomic_load_explicit(&q->tail, memory_order_acquire);
+    depth = head - q->tailCache;
+    if (depth + 1 > atomic_load_explicit(&q->highWater, memory_order_relaxed))
+    {
+      atomic_store_explicit(&q->highWater, depth + 1, memory_order_relaxed);
+    }
+  }
+  return true;
+}
+
+bool readQueuePop(ReadQueue *q, ReadRecord *rec)
+{
+  uint32_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+
+  if (tail == q->headCache)
+  {
+    q->headCache = atomic_load_explicit(&q->head, memory_order_acquire);
+    if (tail == q->headCache)
+    {
+      return false;
+    }
+  }
+
+  *rec = q->slots[tail & q->mask];
+  atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+  return true;
+}
+
+uint32_t readQueueDepth(ReadQueue *q)
+{
+  uint32_t tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+  uint32_t head = atomic_load_explicit(&q->head, memory_order_acquire);
+
+  return head - tail;
+}
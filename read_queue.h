@@ -0,0 +1,51 @@
+/**
+ * Bounded lock-free single-producer/single-consumer queue of ReadRecords.
+ *
+ * The reader thread is the only producer and the writer thread the only
+ * consumer. When the queue is full new records are dropped and counted
+ * rather than blocking the radio loop.
+ * @file read_queue.h
+ */
+
+#ifndef _READ_QUEUE_H
+#define _READ_QUEUE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include "read_record.h"
+
+#define READ_QUEUE_CAPACITY (8192)
+#define READ_QUEUE_CACHE_LINE (64)
+
+typedef struct ReadQueue
+{
+  ReadRecord *slots;
+  uint32_t mask;
+
+  /* Producer side */
+  _Alignas(READ_QUEUE_CACHE_LINE) _Atomic uint32_t head;
+  uint32_t tailCache;
+  _Atomic uint32_t highWater;
+  _Atomic uint64_t pushed;
+  _Atomic uint64_t dropped;
+
+  /* Consumer side */
+  _Alignas(READ_QUEUE_CACHE_LINE) _Atomic uint32_t tail;
+  uint32_t headCache;
+} ReadQueue;
+
+/** Allocate room for at least capacity records (rounded up to a power of two). */
+int readQueueInit(ReadQueue *q, uint32_t capacity);
+void readQueueFree(ReadQueue *q);
+
+/** Producer only. Returns false, and counts a drop, if the queue is full. */
+bool readQueuePush(ReadQueue *q, const ReadRecord *rec);
+
+/** Consumer only. Returns false if the queue is empty. */
+bool readQueuePop(ReadQueue *q, ReadRecord *rec);
+
+/** Approximate number of queued records; safe from any thread. */
+uint32_t readQueueDepth(ReadQueue *q);
+
+#endif /* _READ_QUEUE_H */
@@ -0,0 +1,69 @@
+/**
+ * A single tag observation as it travels from the reader loop to the
+ * storage sinks, the per-window summary that replaces many of them when
+ * reads are aggregated, and the presence events derived from them.
+ * @file read_record.h
+ */
+
+#ifndef _READ_RECORD_H
+#define _READ_RECORD_H
+
+#include <stdint.h>
+
+/* Same as TMR_MAX_EPC_BYTE_COUNT, kept here so sinks don't need tm_reader.h */
+#define READ_RECORD_EPC_MAX (62)
+
+typedef struct ReadRecord
+{
+  uint64_t tsMs;        /* reader timestamp, ms since the epoch */
+  uint32_t readCount;
+  uint32_t frequency;   /* kHz */
+  int32_t rssi;         /* dBm */
+  int32_t phase;        /* degrees */
+  int32_t power;        /* read power, cdBm */
+  uint8_t antenna;
+  uint8_t protocol;
+  uint8_t epcLen;
+  uint8_t epc[READ_RECORD_EPC_MAX];
+} ReadRecord;
+
+/* Everything one aggregation window saw of one tag */
+typedef struct ReadSummary
+{
+  uint64_t windowMs;    /* reader time the window started at */
+  uint64_t firstMs;     /* first and last read in the window */
+  uint64_t lastMs;
+  uint32_t reads;       /* records merged */
+  uint32_t readCount;   /* their readCount, summed */
+  int32_t rssiMin;      /* dBm */
+  int32_t rssiMax;
+  double rssiMean;      /* per record */
+  uint32_t antennas;    /* bit n-1 set if antenna n saw the tag */
+  uint32_t frequency;   /* kHz, the one read on most often */
+  int32_t power;        /* cdBm, of the last read */
+  uint8_t protocol;
+  uint8_t epcLen;
+  uint8_t epc[READ_RECORD_EPC_MAX];
+} ReadSummary;
+
+typedef enum PresenceKind
+{
+  PRESENCE_ARRIVE,
+  PRESENCE_DEPART,
+  PRESENCE_MOVE
+} PresenceKind;
+
+/* A tag arriving at an antenna, moving to another or leaving */
+typedef struct PresenceEvent
+{
+  uint64_t tsMs;        /* reader time it was detected */
+  uint64_t lastMs;      /* last read of the tag */
+  PresenceKind kind;
+  float rssi;           /* smoothed, dBm, on antenna */
+  uint8_t antenna;      /* arrived at, moved to or left */
+  uint8_t fromAntenna;  /* MOVE: left, otherwise 0 */
+  uint8_t epcLen;
+  uint8_t epc[READ_RECORD_EPC_MAX];
+} PresenceEvent;
+
+#endif /* _READ_RECORD_H */
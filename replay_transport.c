@@ -0,0 +1,226 @@
+/**
+ * Serial transport that plays a capture back to the MercuryAPI.
+ * @file replay_transport.c
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "capture.h"
+#include "replay_transport.h"
+
+typedef struct Replay
+{
+  Capture capture;
+  bool realtime;
+  bool loop;
+  uint32_t next;        /* frame after the last matched command */
+  uint32_t rx;          /* response frame being returned */
+  uint32_t rxPos;       /* bytes of it already returned */
+  uint64_t commandTsUs; /* capture time of the matched command */
+  uint64_t sentUs;      /* monotonic time the host sent it */
+  uint64_t commands;
+  uint64_t matched;
+  uint64_t skipped;     /* recorded commands passed over to find a match */
+} Replay;
+
+static void sleepUs(uint64_t us)
+{
+  struct timespec ts;
+
+  ts.tv_sec = us / 1000000;
+  ts.tv_nsec = (long)(us % 1000000) * 1000;
+  while (0 != nanosleep(&ts, &ts) && EINTR == errno)
+  {
+  }
+}
+
+/* First host frame at or after from, or count if none */
+static uint32_t nextCommand(const Replay *r, uint32_t from)
+{
+  while (from < r->capture.count && CAPTURE_TX != r->capture.frames[from].dir)
+  {
+    from++;
+  }
+  return from;
+}
+
+/* Recorded command matching the message, or the next command if none does */
+static uint32_t findCommand(Replay *r, const uint8_t *message, uint32_t length, uint32_t from)
+{
+  uint32_t first = nextCommand(r, from);
+  uint32_t i;
+  uint32_t seen = 0;
+
+  for (i = first; i < r->capture.count && seen < REPLAY_LOOKAHEAD; i = nextCommand(r, i + 1), seen++)
+  {
+    const CaptureFrame *frame = &r->capture.frames[i];
+
+    if (frame->len == length && 0 == memcmp(frame->data, message, length))
+    {
+      r->matched++;
+      r->skipped += seen;
+      return i;
+    }
+  }
+  return first;
+}
+
+static TMR_Status replayOpen(TMR_SR_SerialTransport *this)
+{
+  (void)this;
+  return TMR_SUCCESS;
+}
+
+static TMR_Status replaySendBytes(TMR_SR_SerialTransport *this, uint32_t length, uint8_t *message, const uint32_t timeoutMs)
+{
+  Replay *r = this->cookie;
+  uint32_t command;
+
+  (void)timeoutMs;
+  r->commands++;
+  command = findCommand(r, message, length, r->next);
+  if (command >= r->capture.count && r->loop)
+  {
+    command = findCommand(r, message, length, 0);
+  }
+  if (command >= r->capture.count)
+  {
+    r->next = r->rx = r->capture.count;
+    return TMR_SUCCESS;
+  }
+  r->next = command + 1;
+  r->rx = command + 1;
+  r->rxPos = 0;
+  r->commandTsUs = r->capture.frames[command].tsUs;
+  r->sentUs = captureNowUs();
+  return TMR_SUCCESS;
+}
+
+static TMR_Status replayReceiveBytes(TMR_SR_SerialTransport *this, uint32_t length, uint32_t *messageLength, uint8_t *message, const uint32_t timeoutMs)
+{
+  Replay *r = this->cookie;
+  uint32_t copied = 0;
+
+  while (copied < length && r->rx < r->capture.count && CAPTURE_RX == r->capture.frames[r->rx].dir)
+  {
+    const CaptureFrame *frame = &r->capture.frames[r->rx];
+    uint32_t n;
+
+    if (r->realtime && 0 == r->rxPos)
+    {
+      uint64_t due = frame->tsUs - r->commandTsUs;
+      uint64_t waited = captureNowUs() - r->sentUs;
+
+      if (due > waited)
+      {
+        if (due - waited > (uint64_t)timeoutMs * 1000)
+        {
+          sleepUs((uint64_t)timeoutMs * 1000);
+          break;
+        }
+        sleepUs(due - waited);
+      }
+    }
+    n = frame->len - r->rxPos;
+    if (n > length - copied)
+    {
+      n = length - copied;
+    }
+    memcpy(message + copied, frame->data + r->rxPos, n);
+    copied += n;
+    r->rxPos += n;
+    if (r->rxPos == frame->len)
+    {
+      r->rx++;
+      r->rxPos = 0;
+      r->next = r->rx;
+    }
+  }
+  *messageLength = copied;
+  return copied == length ? TMR_SUCCESS : TMR_ERROR_TIMEOUT;
+}
+
+static TMR_Status replaySetBaudRate(TMR_SR_SerialTransport *this, uint32_t rate)
+{
+  (void)this;
+  (void)rate;
+  return TMR_SUCCESS;
+}
+
+static TMR_Status replayFlush(TMR_SR_SerialTransport *this)
+{
+  (void)this;
+  return TMR_SUCCESS;
+}
+
+static TMR_Status replayShutdown(TMR_SR_SerialTransport *this)
+{
+  Replay *r = this->cookie;
+
+  if (NULL != r)
+  {
+    fprintf(stderr, "Replay: %" PRIu64 " commands, %" PRIu64 " matched, %" PRIu64 " recorded commands skipped\n",
+            r->commands, r->matched, r->skipped);
+    captureFree(&r->capture);
+    free(r);
+    this->cookie = NULL;
+  }
+  return TMR_SUCCESS;
+}
+
+TMR_Status replayTransportInit(TMR_SR_SerialTransport *transport, TMR_SR_SerialPortNativeContext *context, const char *device)
+{
+  Replay *r;
+  char *path;
+  char *options;
+
+  (void)context;
+  r = calloc(1, sizeof(*r));
+  if (NULL == r)
+  {
+    return TMR_ERROR_OUT_OF_MEMORY;
+  }
+  /* replay:///tmp/x.cap may arrive with or without the slashes */
+  if (0 == strncmp("//", device, 2))
+  {
+    device += 2;
+  }
+  path = strdup(device);
+  if (NULL == path)
+  {
+    free(r);
+    return TMR_ERROR_OUT_OF_MEMORY;
+  }
+  options = strchr(path, '?');
+  if (NULL != options)
+  {
+    *options++ = '\0';
+    r->realtime = NULL != strstr(options, "realtime");
+    r->loop = NULL != strstr(options, "loop");
+  }
+  if (0 != captureLoad(&r->capture, path))
+  {
+    free(path);
+    free(r);
+    return TMR_ERROR_INVALID;
+  }
+  free(path);
+
+  transport->cookie = r;
+  transport->open = replayOpen;
+  transport->sendBytes = replaySendBytes;
+  transport->receiveBytes = replayReceiveBytes;
+  transport->setBaudRate = replaySetBaudRate;
+  transport->shutdown = replayShutdown;
+  transport->flush = replayFlush;
+  return TMR_SUCCESS;
+}
+
+TMR_Status replayRegister(void)
+{
+  return TMR_setSerialTransport(REPLAY_SCHEME, &replayTransportInit);
+}
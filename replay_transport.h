@@ -0,0 +1,31 @@
+/**
+ * Serial transport that plays a capture back to the MercuryAPI.
+ *
+ * Registered for the "replay" scheme, so a reader created with
+ * replay:///path/to/file.cap[?realtime][&loop] runs the normal serial
+ * reader code against the recorded responses:
+ *   - each message the host sends is matched against the next recorded
+ *     host message with the same bytes (within REPLAY_LOOKAHEAD frames,
+ *     else the next one), and the reader messages that followed it are
+ *     returned byte by byte from receiveBytes;
+ *   - realtime delays each response by its recorded delay after the
+ *     command, otherwise responses are returned as fast as possible;
+ *   - loop wraps around at the end of the capture instead of failing
+ *     with a timeout.
+ * @file replay_transport.h
+ */
+
+#ifndef _REPLAY_TRANSPORT_H
+#define _REPLAY_TRANSPORT_H
+
+#include <tm_reader.h>
+
+#define REPLAY_SCHEME "replay"
+#define REPLAY_LOOKAHEAD (256)
+
+TMR_Status replayTransportInit(TMR_SR_SerialTransport *transport, TMR_SR_SerialPortNativeContext *context, const char *device);
+
+/** Register the "replay" scheme with the MercuryAPI. */
+TMR_Status replayRegister(void);
+
+#endif /* _REPLAY_TRANSPORT_H */
@@ -0,0 +1,312 @@
+/**
+ * Segment naming and retirement for rotating sinks.
+ * @file rotate.c
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "rotate.h"
+#include "time_util.h"
+
+/* "-YYYYMMDD-HHMMSS-mmm" after the prefix */
+#define ROTATE_STAMP_LEN (20)
+
+typedef struct SegmentFile
+{
+  char name[256];
+  uint64_t bytes;       /* on disk, preallocated blocks included */
+} SegmentFile;
+
+int rotateName(char *path, size_t size, const char *dir, const char *prefix, const char *suffix)
+{
+  uint64_t ms = wallMs();
+  for (;;)
+  {
+    time_t seconds = ms / 1000;
+    struct tm tm;
+    char stamp[32];
+
+    gmtime_r(&seconds, &tm);
+    strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &tm);
+    if ((size_t)snprintf(path, size, "%s/%s-%s-%03u%s", dir, prefix, stamp, (unsigned)(ms % 1000), suffix) >= size)
+    {
+      return -1;
+    }
+    /* Two segments opened within a millisecond: the later one moves on */
+    if (0 != access(path, F_OK))
+    {
+      return 0;
+    }
+    ms++;
+  }
+}
+
+bool rotateSplit(const char *file, const char *defaultPrefix, char *dir, size_t dirSize,
+                 char *prefix, size_t prefixSize)
+{
+  struct stat st;
+  const char *slash;
+  const char *dot;
+
+  if (0 == stat(file, &st) && S_ISDIR(st.st_mode))
+  {
+    size_t len = strlen(file);
+
+    while (len > 1 && '/' == file[len - 1])
+    {
+      len--;
+    }
+    snprintf(dir, dirSize, "%.*s", (int)len, file);
+    snprintf(prefix, prefixSize, "%s", defaultPrefix);
+    return true;
+  }
+  slash = strrchr(file, '/');
+  if (NULL == slash)
+  {
+    snprintf(dir, dirSize, ".");
+    slash = file - 1;
+  }
+  else
+  {
+    snprintf(dir, dirSize, "%.*s", (int)(slash - file), file);
+  }
+  dot = strrchr(slash + 1, '.');
+  if (NULL == dot || dot == slash + 1)
+  {
+    dot = slash + 1 + strlen(slash + 1);
+  }
+  snprintf(prefix, prefixSize, "%.*s", (int)(dot - slash - 1), slash + 1);
+  if ('\0' == prefix[0])
+  {
+    snprintf(prefix, prefixSize, "%s", defaultPrefix);
+  }
+  return false;
+}
+
+/* Whether name is one of our segments: prefix, then the timestamp */
+static bool isSegment(const Rotator *r, const char *name)
+{
+  static const char pattern[] = "-dddddddd-dddddd-ddd";
+  size_t len = strlen(r->prefix);
+  size_t i;
+
+  if (0 != strncmp(name, r->prefix, len) || strlen(name) < len + ROTATE_STAMP_LEN)
+  {
+    return false;
+  }
+  for (i = 0; i < ROTATE_STAMP_LEN; i++)
+  {
+    char c = name[len + i];
+
+    if ('d' == pattern[i] ? (c < '0' || c > '9') : c != pattern[i])
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+static int compareNames(const void *a, const void *b)
+{
+  return strcmp(((const SegmentFile *)a)->name, ((const SegmentFile *)b)->name);
+}
+
+/*
+ * Delete the oldest segments until the rest fit the budget. Files sharing
+ * a timestamp (a database and its -wal and -shm) are one segment, and the
+ * newest segment is never deleted.
+ */
+static void applyBudget(Rotator *r)
+{
+  DIR *d;
+  struct dirent *entry;
+  SegmentFile *files = NULL;
+  size_t count = 0;
+  size_t capacity = 0;
+  size_t stem = strlen(r->prefix) + ROTATE_STAMP_LEN;
+  uint64_t total = 0;
+  size_t newest;
+  size_t next;
+  size_t i;
+
+  if (0 == r->budgetBytes || NULL == (d = opendir(r->dir)))
+  {
+    return;
+  }
+  while (NULL != (entry = readdir(d)))
+  {
+    char path[600];
+    struct stat st;
+
+    if (!isSegment(r, entry->d_name) || strlen(entry->d_name) >= sizeof(files->name))
+    {
+      continue;
+    }
+    snprintf(path, sizeof(path), "%s/%s", r->dir, entry->d_name);
+    if (0 != stat(path, &st) || !S_ISREG(st.st_mode))
+    {
+      continue;
+    }
+    if (count == capacity)
+    {
+      size_t grown = capacity ? 2 * capacity : 64;
+      SegmentFile *more = realloc(files, grown * sizeof(*files));
+
+      if (NULL == more)
+      {
+        break;
+      }
+      files = more;
+      capacity = grown;
+    }
+    snprintf(files[count].name, sizeof(files[count].name), "%s", entry->d_name);
+    files[count].bytes = (uint64_t)st.st_blocks * 512;
+    total += files[count].bytes;
+    count++;
+  }
+  closedir(d);
+  if (0 == count)
+  {
+    free(files);
+    return;
+  }
+
+  qsort(files, count, sizeof(*files), compareNames);
+  for (newest = count - 1; newest > 0 && 0 == strncmp(files[newest - 1].name, files[count - 1].name, stem); newest--)
+  {
+  }
+  for (i = 0; i < newest && total > r->budgetBytes; i = next)
+  {
+    for (next = i; next < newest && 0 == strncmp(files[next].name, files[i].name, stem); next++)
+    {
+      char path[600];
+
+      snprintf(path, sizeof(path), "%s/%s", r->dir, files[next].name);
+      if (0 != unlink(path))
+      {
+        fprintf(stderr, "Cannot delete old segment %s: %s\n", path, strerror(errno));
+        continue;
+      }
+      total -= files[next].bytes;
+      r->deletedBytes += files[next].bytes;
+    }
+    r->deleted++;
+  }
+  if (total > r->budgetBytes)
+  {
+    fprintf(stderr, "Segments in %s use %.1f MB, over the %.1f MB budget\n", r->dir,
+            total / 1048576.0, r->budgetBytes / 1048576.0);
+  }
+  free(files);
+}
+
+void rotateSyncDir(const char *dir)
+{
+  int fd = open(dir, O_RDONLY | O_DIRECTORY);
+
+  if (fd >= 0)
+  {
+    fsync(fd);
+    close(fd);
+  }
+}
+
+static void *rotateMain(void *arg)
+{
+  Rotator *r = arg;
+
+  pthread_mutex_lock(&r->lock);
+  for (;;)
+  {
+    RotateJob job;
+
+    while (r->running && r->head == r->tail)
+    {
+      pthread_cond_wait(&r->wake, &r->lock);
+    }
+    if (r->head == r->tail)
+    {
+      break;
+    }
+    job = r->jobs[r->tail % ROTATE_QUEUE];
+    r->tail++;
+    pthread_mutex_unlock(&r->lock);
+
+    job.finish(job.segment);
+    applyBudget(r);
+    rotateSyncDir(r->dir);
+
+    pthread_mutex_lock(&r->lock);
+    r->finished++;
+  }
+  pthread_mutex_unlock(&r->lock);
+  return NULL;
+}
+
+int rotatorStart(Rotator *r, const char *dir, const char *prefix, uint64_t budgetBytes)
+{
+  memset(r, 0, sizeof(*r));
+  if ((size_t)snprintf(r->dir, sizeof(r->dir), "%s", dir) >= sizeof(r->dir)
+      || (size_t)snprintf(r->prefix, sizeof(r->prefix), "%s", prefix) >= sizeof(r->prefix))
+  {
+    fprintf(stderr, "Segment directory or name too long: %s/%s\n", dir, prefix);
+    return -1;
+  }
+  r->budgetBytes = budgetBytes;
+  applyBudget(r);
+  pthread_mutex_init(&r->lock, NULL);
+  pthread_cond_init(&r->wake, NULL);
+  r->running = true;
+  if (0 != pthread_create(&r->thread, NULL, rotateMain, r))
+  {
+    fprintf(stderr, "Cannot start segment rotation thread\n");
+    r->running = false;
+    return -1;
+  }
+  r->started = true;
+  return 0;
+}
+
+void rotatorRetire(Rotator *r, RotateFinishFn finish, void *segment)
+{
+  if (NULL != r && r->started)
+  {
+    pthread_mutex_lock(&r->lock);
+    if (r->head - r->tail < ROTATE_QUEUE)
+    {
+      r->jobs[r->head % ROTATE_QUEUE].finish = finish;
+      r->jobs[r->head % ROTATE_QUEUE].segment = segment;
+      r->head++;
+      pthread_cond_signal(&r->wake);
+      pthread_mutex_unlock(&r->lock);
+      return;
+    }
+    r->inlined++;
+    pthread_mutex_unlock(&r->lock);
+  }
+  finish(segment);
+}
+
+void rotatorStop(Rotator *r)
+{
+  if (!r->started)
+  {
+    return;
+  }
+  pthread_mutex_lock(&r->lock);
+  r->running = false;
+  pthread_cond_signal(&r->wake);
+  pthread_mutex_unlock(&r->lock);
+  pthread_join(r->thread, NULL);
+  r->started = false;
+  applyBudget(r);
+  pthread_mutex_destroy(&r->lock);
+  pthread_cond_destroy(&r->wake);
+}
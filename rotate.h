@@ -0,0 +1,83 @@
+/**
+ * Segment naming and retirement for rotating sinks.
+ *
+ * Segments are named prefix-YYYYMMDD-HHMMSS-mmm.suffix after the UTC
+ * time they were opened, so they sort by name in the order they were
+ * written and never overwrite an earlier run.
+ *
+ * A sink that rotates hands its old segment to the rotator, whose thread
+ * finishes it (sync, trim, index, close) while the writer carries on in
+ * the new one. After each retired segment, and once at start, the
+ * rotator deletes the oldest segments in the directory until the ones
+ * left fit the disk budget; the newest segment, being written, is kept.
+ * @file rotate.h
+ */
+
+#ifndef _ROTATE_H
+#define _ROTATE_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Segments waiting to be finished; a writer finishes its own when full */
+#define ROTATE_QUEUE (8)
+
+typedef void (*RotateFinishFn)(void *segment);
+
+typedef struct RotateJob
+{
+  RotateFinishFn finish;
+  void *segment;
+} RotateJob;
+
+typedef struct Rotator
+{
+  char dir[256];
+  char prefix[64];
+  uint64_t budgetBytes; /* 0: keep everything */
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  RotateJob jobs[ROTATE_QUEUE];
+  uint32_t head;
+  uint32_t tail;
+  bool running;
+  bool started;
+  uint64_t finished;    /* segments finished by the thread */
+  uint64_t inlined;     /* finished by the writer, queue full */
+  uint64_t deleted;     /* segments deleted for the budget */
+  uint64_t deletedBytes;
+} Rotator;
+
+/**
+ * Name a new segment in dir, e.g. dir/reads-20240131-235959-123.m6l.
+ * Returns 0, or -1 if the name doesn't fit.
+ */
+int rotateName(char *path, size_t size, const char *dir, const char *prefix, const char *suffix);
+
+/**
+ * Split a file name such as data/reads.db into the directory and the
+ * prefix its segments are named after (data, reads). A directory name
+ * gives the directory and defaultPrefix, and returns true.
+ */
+bool rotateSplit(const char *file, const char *defaultPrefix, char *dir, size_t dirSize,
+                 char *prefix, size_t prefixSize);
+
+/** fsync a directory, making new and deleted entries durable. */
+void rotateSyncDir(const char *dir);
+
+/** Start the thread and apply the budget to segments already in dir. */
+int rotatorStart(Rotator *r, const char *dir, const char *prefix, uint64_t budgetBytes);
+
+/**
+ * Have the thread call finish(segment). Without a running rotator, or
+ * with its queue full, finish runs in the caller.
+ */
+void rotatorRetire(Rotator *r, RotateFinishFn finish, void *segment);
+
+/** Finish every queued segment, apply the budget and stop the thread. */
+void rotatorStop(Rotator *r);
+
+#endif /* _ROTATE_H */
@@ -1 +1 @@
-sudo ./power_ramp2 eapi:///dev/ttyACM0 --ant 4 --epc1 E200493F38187C3126BE51F0 --epc2 E200493F3185AD7126ACF6B5 --minfreq 900000 --maxfreq 928000 --freqstep 1 --minpow 2000 --maxpow 3150 --powstep 100
+sudo ./power_ramp eapi:///dev/ttyACM0 --ant 4 --epc E200493F38187C3126BE51F0,E200493F3185AD7126ACF6B5 --minfreq 900000 --maxfreq 928000 --freqstep 1 --minpow 2000 --maxpow 3150 --powstep 100
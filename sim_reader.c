@@ -0,0 +1,1013 @@
+/**
+ * Simulated M6e reader.
+ * @file sim_reader.c
+ */
+
+#define SIM_READER_IMPL
+
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "sim_reader.h"
+#include "epc_match.h"
+#include "time_util.h"
+
+#define SIM_EPC_MAX (TMR_MAX_EPC_BYTE_COUNT)
+#define SIM_DEFAULT_TAGS (20)
+#define SIM_DEFAULT_EPC_LEN (12)
+#define SIM_MAX_HOPS (256)
+
+/* FCC band, the module default */
+#define SIM_FIRST_CHANNEL (902750)
+#define SIM_CHANNEL_STEP (500)
+#define SIM_CHANNELS (50)
+
+typedef struct SimTag
+{
+  uint8_t len;
+  uint8_t epc[SIM_EPC_MAX];
+  int32_t threshold;    /* cdBm, -1 until assigned */
+  double period;        /* MHz, threshold ripple */
+  double offset;        /* radians */
+  int32_t rssi;         /* dBm at 30 dBm */
+  int32_t phase;
+} SimTag;
+
+typedef struct SimReader
+{
+  TMR_Reader *reader;
+  uint64_t rng;
+
+  /* population */
+  SimTag *tags;
+  uint32_t tagCount;
+  uint32_t tagMax;
+  uint32_t randomTags;
+  uint8_t prefix[SIM_EPC_MAX];
+  uint8_t prefixLen;
+  int32_t thresholdLo;
+  int32_t thresholdHi;
+  int32_t ripple;
+  int32_t rssiMean;
+  int32_t rssiDev;
+  int32_t phaseLo;
+  int32_t phaseHi;
+  double rate;
+  double carry;         /* fraction of a read left from the last slice */
+  double fault;
+  int realtime;
+
+  /* radio */
+  int32_t power;
+  TMR_Region region;
+  uint32_t hops[SIM_MAX_HOPS];
+  uint32_t hopCount;
+  uint32_t hopTime;
+  uint32_t channel;     /* index into hops */
+  uint32_t hopLeft;     /* ms left on the channel */
+  TMR_ReadPlan plan;
+  uint16_t metadata;
+  uint32_t onTime;
+  uint32_t offTime;
+  uint64_t epochMs;     /* wall clock at connect */
+  uint64_t clockMs;     /* simulated time since connect */
+
+  /* tag buffer, one entry per EPC */
+  TMR_TagReadData *buffer;
+  int32_t *slot;        /* tag -> buffer entry, -1 if none */
+  uint32_t *active;     /* tags answering on the current channel */
+  uint32_t bufferLen;
+  uint32_t bufferPos;
+
+  /* async reading */
+  TMR_ReadListenerBlock *readListeners;
+  TMR_ReadExceptionListenerBlock *exceptionListeners;
+  pthread_t thread;
+  atomic_bool running;
+  bool started;
+} SimReader;
+
+/* One simulated reader per process, which is all the programs create */
+static SimReader *sim;
+
+static bool isSim(const TMR_Reader *reader)
+{
+  return NULL != sim && sim->reader == reader;
+}
+
+static void sleepMs(uint32_t ms)
+{
+  struct timespec ts;
+
+  ts.tv_sec = ms / 1000;
+  ts.tv_nsec = (long)(ms % 1000) * 1000000;
+  while (0 != nanosleep(&ts, &ts) && EINTR == errno)
+  {
+  }
+}
+
+/* xorshift64* */
+static uint32_t nextRandom(SimReader *s)
+{
+  s->rng ^= s->rng >> 12;
+  s->rng ^= s->rng << 25;
+  s->rng ^= s->rng >> 27;
+  return (uint32_t)((s->rng * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+/* Uniform in [lo, hi] */
+static int32_t randomRange(SimReader *s, int32_t lo, int32_t hi)
+{
+  if (hi <= lo)
+  {
+    return lo;
+  }
+  return lo + (int32_t)(nextRandom(s) % (uint32_t)(hi - lo + 1));
+}
+
+static double randomUnit(SimReader *s)
+{
+  return nextRandom(s) / 4294967296.0;
+}
+
+/* Bytes of a hex EPC or prefix, or -1 if it isn't whole bytes of hex */
+static int parseHex(const char *hex, uint8_t *bytes, uint8_t max)
+{
+  int nibbles = epcParseHex(hex, bytes, max);
+
+  return nibbles < 0 || (nibbles & 1) ? -1 : nibbles / 2;
+}
+
+static SimTag *addTag(SimReader *s)
+{
+  SimTag *tag;
+
+  if (s->tagCount == s->tagMax)
+  {
+    uint32_t max = s->tagMax ? 2 * s->tagMax : 64;
+    SimTag *tags = realloc(s->tags, max * sizeof(*tags));
+
+    if (NULL == tags)
+    {
+      return NULL;
+    }
+    s->tags = tags;
+    s->tagMax = max;
+  }
+  tag = &s->tags[s->tagCount++];
+  memset(tag, 0, sizeof(*tag));
+  tag->threshold = -1;
+  return tag;
+}
+
+/* Apply one "key value..." setting. Returns 0, or -1 if not understood. */
+static int configure(SimReader *s, char *line)
+{
+  char *save = NULL;
+  char *key = strtok_r(line, " \t\r\n", &save);
+  char *a = strtok_r(NULL, " \t\r\n", &save);
+  char *b = strtok_r(NULL, " \t\r\n", &save);
+
+  if (NULL == key || '#' == key[0])
+  {
+    return 0;
+  }
+  if (NULL == a)
+  {
+    return -1;
+  }
+  if (0 == strcmp("seed", key))
+  {
+    s->rng = strtoull(a, NULL, 0) | 1;
+  }
+  else if (0 == strcmp("tags", key))
+  {
+    s->randomTags = strtoul(a, NULL, 0);
+  }
+  else if (0 == strcmp("prefix", key))
+  {
+    int len = parseHex(a, s->prefix, SIM_DEFAULT_EPC_LEN);
+
+    if (len < 0)
+    {
+      return -1;
+    }
+    s->prefixLen = (uint8_t)len;
+  }
+  else if (0 == strcmp("tag", key))
+  {
+    SimTag *tag = addTag(s);
+    int len;
+
+    if (NULL == tag || (len = parseHex(a, tag->epc, SIM_EPC_MAX)) <= 0)
+    {
+      return -1;
+    }
+    tag->len = (uint8_t)len;
+    if (NULL != b)
+    {
+      tag->threshold = strtol(b, NULL, 0);
+    }
+  }
+  else if (0 == strcmp("threshold", key) && NULL != b)
+  {
+    s->thresholdLo = strtol(a, NULL, 0);
+    s->thresholdHi = strtol(b, NULL, 0);
+  }
+  else if (0 == strcmp("ripple", key))
+  {
+    s->ripple = strtol(a, NULL, 0);
+  }
+  else if (0 == strcmp("rssi", key) && NULL != b)
+  {
+    s->rssiMean = strtol(a, NULL, 0);
+    s->rssiDev = strtol(b, NULL, 0);
+  }
+  else if (0 == strcmp("phase", key) && NULL != b)
+  {
+    s->phaseLo = strtol(a, NULL, 0);
+    s->phaseHi = strtol(b, NULL, 0);
+  }
+  else if (0 == strcmp("rate", key))
+  {
+    s->rate = strtod(a, NULL);
+  }
+  else if (0 == strcmp("hoptime", key))
+  {
+    s->hopTime = strtoul(a, NULL, 0);
+  }
+  else if (0 == strcmp("fault", key))
+  {
+    s->fault = strtod(a, NULL);
+  }
+  else if (0 == strcmp("realtime", key))
+  {
+    s->realtime = 0 != strtol(a, NULL, 0);
+  }
+  else
+  {
+    return -1;
+  }
+  return 0;
+}
+
+static int loadConfig(SimReader *s, const char *path)
+{
+  FILE *fp = fopen(path, "r");
+  char *line = NULL;
+  size_t len = 0;
+  int rc = 0;
+
+  if (NULL == fp)
+  {
+    fprintf(stderr, "Can't open simulator config: %s\n", path);
+    return -1;
+  }
+  while (0 == rc && -1 != getline(&line, &len, fp))
+  {
+    rc = configure(s, line);
+    if (0 != rc)
+    {
+      fprintf(stderr, "Bad simulator setting: %s", line);
+    }
+  }
+  free(line);
+  fclose(fp);
+  return rc;
+}
+
+/* "key=v1,v2&key=v" */
+static int loadQuery(SimReader *s, char *query)
+{
+  char *save = NULL;
+  char *item;
+
+  for (item = strtok_r(query, "&", &save); NULL != item; item = strtok_r(NULL, "&", &save))
+  {
+    char *c;
+
+    for (c = item; '\0' != *c; c++)
+    {
+      if ('=' == *c || ',' == *c)
+      {
+        *c = ' ';
+      }
+    }
+    if (0 != configure(s, item))
+    {
+      fprintf(stderr, "Bad simulator setting: %s\n", item);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/* Fill in random tags and whatever the config left unset */
+static int populate(SimReader *s)
+{
+  uint32_t explicitTags = s->tagCount;
+  uint32_t randomTags = s->randomTags;
+  uint32_t i;
+
+  if (0 == explicitTags && 0 == randomTags)
+  {
+    randomTags = SIM_DEFAULT_TAGS;
+  }
+  for (i = 0; i < randomTags; i++)
+  {
+    SimTag *tag = addTag(s);
+    uint8_t k;
+
+    if (NULL == tag)
+    {
+      return -1;
+    }
+    tag->len = SIM_DEFAULT_EPC_LEN;
+    memcpy(tag->epc, s->prefix, s->prefixLen);
+    for (k = s->prefixLen; k < tag->len; k++)
+    {
+      tag->epc[k] = (uint8_t)nextRandom(s);
+    }
+    /* Serial number in the last bytes keeps random EPCs distinct */
+    tag->epc[tag->len - 2] = (uint8_t)(i >> 8);
+    tag->epc[tag->len - 1] = (uint8_t)i;
+  }
+  for (i = 0; i < s->tagCount; i++)
+  {
+    SimTag *tag = &s->tags[i];
+
+    if (tag->threshold < 0)
+    {
+      tag->threshold = randomRange(s, s->thresholdLo, s->thresholdHi);
+    }
+    tag->period = 5.0 + 20.0 * randomUnit(s);
+    tag->offset = 2 * M_PI * randomUnit(s);
+    tag->rssi = randomRange(s, s->rssiMean - s->rssiDev, s->rssiMean + s->rssiDev);
+    tag->phase = randomRange(s, s->phaseLo, s->phaseHi);
+  }
+
+  s->buffer = calloc(s->tagCount, sizeof(*s->buffer));
+  s->slot = malloc(s->tagCount * sizeof(*s->slot));
+  s->active = calloc(s->tagCount, sizeof(*s->active));
+  if (NULL == s->buffer || NULL == s->slot || NULL == s->active)
+  {
+    return -1;
+  }
+  memset(s->slot, -1, s->tagCount * sizeof(*s->slot));
+  return 0;
+}
+
+static void freeSim(SimReader *s)
+{
+  free(s->tags);
+  free(s->buffer);
+  free(s->slot);
+  free(s->active);
+  free(s);
+}
+
+static bool selectMatches(const TMR_GEN2_Select *select, const SimTag *tag)
+{
+  uint32_t start;
+  uint32_t i;
+  bool match = true;
+
+  if (TMR_GEN2_BANK_EPC != select->bank || select->bitPointer < 32)
+  {
+    return true;
+  }
+  start = select->bitPointer - 32;
+  for (i = 0; i < select->maskBitLength && match; i++)
+  {
+    uint32_t bit = start + i;
+    int want = (select->mask[i >> 3] >> (7 - (i & 7))) & 1;
+    int have;
+
+    if (bit >= 8u * tag->len)
+    {
+      match = false;
+      break;
+    }
+    have = (tag->epc[bit >> 3] >> (7 - (bit & 7))) & 1;
+    match = want == have;
+  }
+  return match != select->invert;
+}
+
+static bool filterMatches(const TMR_TagFilter *filter, const SimTag *tag)
+{
+  if (NULL == filter)
+  {
+    return true;
+  }
+  switch (filter->type)
+  {
+  case TMR_FILTER_TYPE_GEN2_SELECT:
+    return selectMatches(&filter->u.gen2Select, tag);
+  case TMR_FILTER_TYPE_TAG_DATA:
+    return filter->u.tagData.epcByteCount == tag->len
+        && 0 == memcmp(filter->u.tagData.epc, tag->epc, tag->len);
+  default:
+    return true;
+  }
+}
+
+/* Antenna the plan reads the tag on, or 0 if its filters exclude it */
+static uint8_t planAntenna(SimReader *s, const TMR_ReadPlan *plan, const SimTag *tag)
+{
+  if (TMR_READ_PLAN_TYPE_MULTI == plan->type)
+  {
+    uint32_t i;
+
+    for (i = 0; i < plan->u.multi.planCount; i++)
+    {
+      uint8_t antenna = planAntenna(s, plan->u.multi.plans[i], tag);
+
+      if (0 != antenna)
+      {
+        return antenna;
+      }
+    }
+    return 0;
+  }
+  if (!filterMatches(plan->u.simple.filter, tag))
+  {
+    return 0;
+  }
+  if (0 == plan->u.simple.antennas.len || NULL == plan->u.simple.antennas.list)
+  {
+    return 1;
+  }
+  return plan->u.simple.antennas.list[nextRandom(s) % plan->u.simple.antennas.len];
+}
+
+static int32_t threshold(const SimReader *s, const SimTag *tag, uint32_t freq)
+{
+  return tag->threshold + (int32_t)(s->ripple * sin(freq / 1000.0 * 2 * M_PI / tag->period + tag->offset));
+}
+
+static void addRead(SimReader *s, uint32_t t, uint8_t antenna, uint32_t freq, uint64_t ms)
+{
+  const SimTag *tag = &s->tags[t];
+  TMR_TagReadData *read;
+
+  if (s->slot[t] >= 0)
+  {
+    s->buffer[s->slot[t]].readCount++;
+    return;
+  }
+  s->slot[t] = (int32_t)s->bufferLen;
+  read = &s->buffer[s->bufferLen++];
+  memset(read, 0, sizeof(*read));
+  read->tag.protocol = TMR_TAG_PROTOCOL_GEN2;
+  read->tag.epcByteCount = tag->len;
+  memcpy(read->tag.epc, tag->epc, tag->len);
+  read->metadataFlags = s->metadata;
+  read->readCount = 1;
+  read->antenna = antenna;
+  read->frequency = freq;
+  read->rssi = tag->rssi + (s->power - 3000) / 100 + randomRange(s, -2, 2);
+  read->phase = (tag->phase + freq / 250) % 180;
+  read->timestampLow = (uint32_t)ms;
+  read->timestampHigh = (uint32_t)(ms >> 32);
+}
+
+/**
+ * Run the inventory for ms of simulated time, hopping channels every
+ * hopTime, and leave the merged reads in the tag buffer.
+ */
+static void inventory(SimReader *s, uint32_t ms)
+{
+  uint32_t i;
+
+  for (i = 0; i < s->tagCount; i++)
+  {
+    s->slot[i] = -1;
+  }
+  s->bufferLen = 0;
+  s->bufferPos = 0;
+
+  while (ms > 0)
+  {
+    uint32_t slice = ms < s->hopLeft ? ms : s->hopLeft;
+    uint32_t freq = s->hops[s->channel];
+    uint32_t activeCount = 0;
+    double expected;
+    uint32_t reads;
+
+    for (i = 0; i < s->tagCount; i++)
+    {
+      if (s->power >= threshold(s, &s->tags[i], freq))
+      {
+        s->active[activeCount++] = i;
+      }
+    }
+    expected = s->rate * slice / 1000.0 + s->carry;
+    reads = (uint32_t)expected;
+    s->carry = activeCount ? expected - reads : 0;
+    for (i = 0; i < reads && activeCount > 0; i++)
+    {
+      uint32_t t = s->active[nextRandom(s) % activeCount];
+      uint8_t antenna = planAntenna(s, &s->plan, &s->tags[t]);
+
+      if (0 != antenna)
+      {
+        addRead(s, t, antenna, freq, s->epochMs + s->clockMs + (uint64_t)i * slice / reads);
+      }
+    }
+
+    s->clockMs += slice;
+    s->hopLeft -= slice;
+    ms -= slice;
+    if (0 == s->hopLeft)
+    {
+      s->channel = nextRandom(s) % s->hopCount;
+      s->hopLeft = s->hopTime;
+    }
+  }
+}
+
+/**
+ * In realtime mode the next ms of reads end now, so timestamps stay
+ * comparable with the host clock; time the host spent between reads is
+ * dead time, as it is for the module between commands.
+ */
+static void followWallClock(SimReader *s, uint32_t ms)
+{
+  uint64_t now = wallMs() - s->epochMs;
+
+  if (now > s->clockMs + ms)
+  {
+    s->clockMs = now - ms;
+  }
+}
+
+static bool faulted(SimReader *s)
+{
+  return s->fault > 0 && randomUnit(s) < s->fault;
+}
+
+static void *asyncMain(void *arg)
+{
+  SimReader *s = arg;
+
+  while (atomic_load(&s->running))
+  {
+    if (s->realtime)
+    {
+      sleepMs(s->onTime);
+      followWallClock(s, s->onTime);
+    }
+    if (faulted(s))
+    {
+      TMR_ReadExceptionListenerBlock *e;
+
+      for (e = s->exceptionListeners; NULL != e; e = e->next)
+      {
+        e->listener(s->reader, TMR_ERROR_TIMEOUT, e->cookie);
+      }
+    }
+    else
+    {
+      uint32_t i;
+
+      inventory(s, s->onTime);
+      for (i = 0; i < s->bufferLen; i++)
+      {
+        TMR_ReadListenerBlock *l;
+
+        for (l = s->readListeners; NULL != l; l = l->next)
+        {
+          l->listener(s->reader, &s->buffer[i], l->cookie);
+        }
+      }
+    }
+    s->clockMs += s->offTime;
+    if (s->realtime)
+    {
+      sleepMs(s->offTime);
+    }
+  }
+  return NULL;
+}
+
+TMR_Status simCreate(TMR_Reader *reader, const char *deviceUri)
+{
+  SimReader *s;
+  const char *rest;
+  char *spec;
+  char *query;
+  uint32_t i;
+  int rc = 0;
+
+  if (0 != strncmp(SIM_READER_SCHEME, deviceUri, strlen(SIM_READER_SCHEME)))
+  {
+    return TMR_create(reader, deviceUri);
+  }
+  if (NULL != sim)
+  {
+    return TMR_ERROR_INVALID;
+  }
+
+  s = calloc(1, sizeof(*s));
+  if (NULL == s)
+  {
+    return TMR_ERROR_OUT_OF_MEMORY;
+  }
+  s->reader = reader;
+  s->rng = 1;
+  s->prefix[0] = 0xE2;
+  s->prefix[1] = 0x80;
+  s->prefixLen = 2;
+  s->thresholdLo = 1000;
+  s->thresholdHi = 3000;
+  s->ripple = 150;
+  s->rssiMean = -55;
+  s->rssiDev = 8;
+  s->phaseLo = 0;
+  s->phaseHi = 180;
+  s->rate = 1000;
+  s->hopTime = 200;
+  s->power = 3000;
+  s->region = TMR_REGION_NA;
+  s->metadata = TMR_TRD_METADATA_FLAG_ALL;
+  s->onTime = 250;
+  s->offTime = 0;
+  for (i = 0; i < SIM_CHANNELS; i++)
+  {
+    s->hops[i] = SIM_FIRST_CHANNEL + i * SIM_CHANNEL_STEP;
+  }
+  s->hopCount = SIM_CHANNELS;
+  TMR_RP_init_simple(&s->plan, 0, NULL, TMR_TAG_PROTOCOL_GEN2, 1000);
+
+  /* sim://path?query, where sim:///tmp/x names /tmp/x */
+  rest = deviceUri + strlen(SIM_READER_SCHEME);
+  if (0 == strncmp("//", rest, 2))
+  {
+    rest += 2;
+  }
+  spec = strdup(rest);
+  if (NULL == spec)
+  {
+    free(s);
+    return TMR_ERROR_OUT_OF_MEMORY;
+  }
+  query = strchr(spec, '?');
+  if (NULL != query)
+  {
+    *query++ = '\0';
+  }
+  if ('\0' != spec[0])
+  {
+    rc = loadConfig(s, spec);
+  }
+  if (0 == rc && NULL != query)
+  {
+    rc = loadQuery(s, query);
+  }
+  free(spec);
+  if (0 == rc)
+  {
+    rc = populate(s);
+  }
+  if (0 != rc || 0 == s->hopTime || s->rate < 0)
+  {
+    freeSim(s);
+    return TMR_ERROR_INVALID;
+  }
+  s->hopLeft = s->hopTime;
+
+  memset(reader, 0, sizeof(*reader));
+  reader->readerType = TMR_READER_TYPE_SERIAL;
+  sim = s;
+  return TMR_SUCCESS;
+}
+
+TMR_Status simConnect(TMR_Reader *reader)
+{
+  if (!isSim(reader))
+  {
+    return TMR_connect(reader);
+  }
+  sim->epochMs = wallMs();
+  sim->clockMs = 0;
+  return TMR_SUCCESS;
+}
+
+TMR_Status simDestroy(TMR_Reader *reader)
+{
+  if (!isSim(reader))
+  {
+    return TMR_destroy(reader);
+  }
+  simStopReading(reader);
+  freeSim(sim);
+  sim = NULL;
+  return TMR_SUCCESS;
+}
+
+TMR_Status simParamSet(TMR_Reader *reader, TMR_Param key, const void *value)
+{
+  if (!isSim(reader))
+  {
+    return TMR_paramSet(reader, key, value);
+  }
+  switch (key)
+  {
+  case TMR_PARAM_RADIO_READPOWER:
+    sim->power = *(const int32_t *)value;
+    break;
+  case TMR_PARAM_REGION_ID:
+    sim->region = *(const TMR_Region *)value;
+    break;
+  case TMR_PARAM_REGION_HOPTABLE:
+  {
+    const TMR_uint32List *list = value;
+
+    if (0 == list->len || list->len > SIM_MAX_HOPS)
+    {
+      return TMR_ERROR_INVALID;
+    }
+    memcpy(sim->hops, list->list, list->len * sizeof(uint32_t));
+    sim->hopCount = list->len;
+    sim->channel = 0;
+    sim->hopLeft = sim->hopTime;
+    break;
+  }
+  case TMR_PARAM_REGION_HOPTIME:
+    if (0 == *(const uint32_t *)value)
+    {
+      return TMR_ERROR_INVALID;
+    }
+    sim->hopTime = *(const uint32_t *)value;
+    sim->hopLeft = sim->hopTime;
+    break;
+  case TMR_PARAM_READ_PLAN:
+    sim->plan = *(const TMR_ReadPlan *)value;
+    break;
+  case TMR_PARAM_METADATAFLAG:
+    sim->metadata = (uint16_t)*(const TMR_TRD_MetadataFlag *)value;
+    break;
+  case TMR_PARAM_READ_ASYNCONTIME:
+    sim->onTime = *(const uint32_t *)value;
+    break;
+  case TMR_PARAM_READ_ASYNCOFFTIME:
+    sim->offTime = *(const uint32_t *)value;
+    break;
+  default:
+    break;
+  }
+  return TMR_SUCCESS;
+}
+
+TMR_Status simParamGet(TMR_Reader *reader, TMR_Param key, void *value)
+{
+  if (!isSim(reader))
+  {
+    return TMR_paramGet(reader, key, value);
+  }
+  switch (key)
+  {
+  case TMR_PARAM_VERSION_MODEL:
+  {
+    TMR_String *model = value;
+
+    snprintf(model->value, model->max, "M6e");
+    break;
+  }
+  case TMR_PARAM_VERSION_SOFTWARE:
+  {
+    TMR_String *version = value;
+
+    snprintf(version->value, version->max, "sim");
+    break;
+  }
+  case TMR_PARAM_RADIO_READPOWER:
+    *(int32_t *)value = sim->power;
+    break;
+  case TMR_PARAM_REGION_ID:
+    *(TMR_Region *)value = sim->region;
+    break;
+  case TMR_PARAM_REGION_SUPPORTEDREGIONS:
+  {
+    TMR_RegionList *regions = value;
+    uint8_t i;
+
+    /* The programs pick entry 22, the open region on an M6e */
+    for (i = 0; i < regions->max; i++)
+    {
+      regions->list[i] = TMR_REGION_OPEN;
+    }
+    regions->len = regions->max;
+    break;
+  }
+  case TMR_PARAM_REGION_HOPTABLE:
+  {
+    TMR_uint32List *list = value;
+
+    list->len = sim->hopCount < list->max ? sim->hopCount : list->max;
+    memcpy(list->list, sim->hops, list->len * sizeof(uint32_t));
+    break;
+  }
+  case TMR_PARAM_REGION_HOPTIME:
+    *(uint32_t *)value = sim->hopTime;
+    break;
+  case TMR_PARAM_READ_PLAN:
+    *(TMR_ReadPlan *)value = sim->plan;
+    break;
+  case TMR_PARAM_METADATAFLAG:
+    *(TMR_TRD_MetadataFlag *)value = (TMR_TRD_MetadataFlag)sim->metadata;
+    break;
+  case TMR_PARAM_READ_ASYNCONTIME:
+    *(uint32_t *)value = sim->onTime;
+    break;
+  case TMR_PARAM_READ_ASYNCOFFTIME:
+    *(uint32_t *)value = sim->offTime;
+    break;
+  case TMR_PARAM_ANTENNA_RETURNLOSS:
+    ((TMR_PortValueList *)value)->len = 0;
+    break;
+  default:
+    return TMR_ERROR_UNSUPPORTED;
+  }
+  return TMR_SUCCESS;
+}
+
+TMR_Status simRead(TMR_Reader *reader, uint32_t timeoutMs, int32_t *tagCount)
+{
+  if (!isSim(reader))
+  {
+    return TMR_read(reader, timeoutMs, tagCount);
+  }
+  sim->bufferLen = 0;
+  sim->bufferPos = 0;
+  if (sim->realtime)
+  {
+    /* The module reads for the whole timeout and answers at its end */
+    sleepMs(timeoutMs);
+    followWallClock(sim, timeoutMs);
+  }
+  if (faulted(sim))
+  {
+    sim->clockMs += timeoutMs;
+    return TMR_ERROR_TIMEOUT;
+  }
+  inventory(sim, timeoutMs);
+  if (NULL != tagCount)
+  {
+    *tagCount = (int32_t)sim->bufferLen;
+  }
+  return TMR_SUCCESS;
+}
+
+TMR_Status simHasMoreTags(TMR_Reader *reader)
+{
+  if (!isSim(reader))
+  {
+    return TMR_hasMoreTags(reader);
+  }
+  return sim->bufferPos < sim->bufferLen ? TMR_SUCCESS : TMR_ERROR_NO_TAGS;
+}
+
+TMR_Status simGetNextTag(TMR_Reader *reader, TMR_TagReadData *read)
+{
+  if (!isSim(reader))
+  {
+    return TMR_getNextTag(reader, read);
+  }
+  if (sim->bufferPos >= sim->bufferLen)
+  {
+    return TMR_ERROR_NO_TAGS;
+  }
+  *read = sim->buffer[sim->bufferPos++];
+  return TMR_SUCCESS;
+}
+
+TMR_Status simStartReading(TMR_Reader *reader)
+{
+  if (!isSim(reader))
+  {
+    return TMR_startReading(reader);
+  }
+  if (sim->started)
+  {
+    return TMR_SUCCESS;
+  }
+  if (0 == sim->onTime)
+  {
+    return TMR_ERROR_INVALID;
+  }
+  atomic_store(&sim->running, true);
+  if (0 != pthread_create(&sim->thread, NULL, asyncMain, sim))
+  {
+    atomic_store(&sim->running, false);
+    return TMR_ERROR_OUT_OF_MEMORY;
+  }
+  sim->started = true;
+  return TMR_SUCCESS;
+}
+
+TMR_Status simStopReading(TMR_Reader *reader)
+{
+  if (!isSim(reader))
+  {
+    return TMR_stopReading(reader);
+  }
+  if (sim->started)
+  {
+    atomic_store(&sim->running, false);
+    pthread_join(sim->thread, NULL);
+    sim->started = false;
+  }
+  return TMR_SUCCESS;
+}
+
+TMR_Status simAddReadListener(TMR_Reader *reader, TMR_ReadListenerBlock *block)
+{
+  if (!isSim(reader))
+  {
+    return TMR_addReadListener(reader, block);
+  }
+  block->next = sim->readListeners;
+  sim->readListeners = block;
+  return TMR_SUCCESS;
+}
+
+TMR_Status simAddReadExceptionListener(TMR_Reader *reader, TMR_ReadExceptionListenerBlock *block)
+{
+  if (!isSim(reader))
+  {
+    return TMR_addReadExceptionListener(reader, block);
+  }
+  block->next = sim->exceptionListeners;
+  sim->exceptionListeners = block;
+  return TMR_SUCCESS;
+}
+
+TMR_Status simAddTransportListener(TMR_Reader *reader, TMR_TransportListenerBlock *block)
+{
+  if (!isSim(reader))
+  {
+    return TMR_addTransportListener(reader, block);
+  }
+  /* No bytes on a wire to report */
+  return TMR_SUCCESS;
+}
+
+const char *simStrerr(TMR_Reader *reader, TMR_Status status)
+{
+  if (!isSim(reader))
+  {
+    return TMR_strerr(reader, status);
+  }
+  switch (status)
+  {
+  case TMR_SUCCESS:
+    return "Success";
+  case TMR_ERROR_TIMEOUT:
+    return "Timeout (simulated)";
+  case TMR_ERROR_NO_TAGS:
+    return "No tags found";
+  case TMR_ERROR_INVALID:
+    return "Invalid argument";
+  case TMR_ERROR_UNSUPPORTED:
+    return "Unsupported operation";
+  case TMR_ERROR_OUT_OF_MEMORY:
+    return "Out of memory";
+  default:
+    return "Simulated reader error";
+  }
+}
+
+void simGetTimeStamp(TMR_Reader *reader, const TMR_TagReadData *read, char *timeStr)
+{
+  uint64_t ms;
+  time_t seconds;
+  struct tm tm;
+  size_t len;
+
+  if (!isSim(reader))
+  {
+    TMR_getTimeStamp(reader, read, timeStr);
+    return;
+  }
+  ms = ((uint64_t)read->timestampHigh << 32) | read->timestampLow;
+  seconds = (time_t)(ms / 1000);
+  localtime_r(&seconds, &tm);
+  len = strftime(timeStr, 32, "%FT%H:%M:%S", &tm);
+  sprintf(timeStr + len, ".%03u", (unsigned)(ms % 1000));
+}
+
+TMR_Status simAntDetectEnabled(TMR_Reader *reader, uint8_t *antennaList)
+{
+  if (!isSim(reader))
+  {
+    return isAntDetectEnabled(reader, antennaList);
+  }
+  return TMR_SUCCESS;
+}
@@ -0,0 +1,77 @@
+/**
+ * Simulated M6e reader for running the programs without hardware.
+ *
+ * Included after tm_reader.h, this header routes the reader calls the
+ * programs make through sim_reader.c. A reader created with a "sim:" URI
+ * is served by a synthetic tag population; any other URI goes straight to
+ * the MercuryAPI, so every program runs unchanged against either.
+ *
+ * URI: sim://[config-file][?key=value&key=v1,v2...]
+ *
+ * Config file lines are "key value...", '#' starts a comment, and query
+ * keys override the file:
+ *   seed n             random seed (1)
+ *   tags n             random tags added to the population (20 if no tag lines)
+ *   prefix hex         EPC prefix of the random tags (E280)
+ *   tag epc [cdBm]     one tag, optionally with its activation threshold
+ *   threshold lo hi    range of random activation thresholds, cdBm (1000 3000)
+ *   ripple cdBm        threshold swing across the band (150)
+ *   rssi mean dev      RSSI in dBm at 30 dBm read power (-55 8)
+ *   phase lo hi        phase range in degrees (0 180)
+ *   rate n             reads per second over the whole population (1000)
+ *   hoptime ms         dwell on each channel (200)
+ *   fault p            probability a read cycle fails with a timeout (0)
+ *   realtime 0|1       pace reads to the wall clock and timestamp them with it
+ *                      (0: as fast as the host)
+ *
+ * A tag answers on a channel when the read power is at least its
+ * threshold there; the threshold follows a sine of the frequency with a
+ * per-tag period and offset. Reads within one TMR_read or one async on
+ * time are merged per EPC like the module's tag buffer.
+ * @file sim_reader.h
+ */
+
+#ifndef _SIM_READER_H
+#define _SIM_READER_H
+
+#include <tm_reader.h>
+
+#define SIM_READER_SCHEME "sim:"
+
+TMR_Status simCreate(TMR_Reader *reader, const char *deviceUri);
+TMR_Status simConnect(TMR_Reader *reader);
+TMR_Status simDestroy(TMR_Reader *reader);
+TMR_Status simParamSet(TMR_Reader *reader, TMR_Param key, const void *value);
+TMR_Status simParamGet(TMR_Reader *reader, TMR_Param key, void *value);
+TMR_Status simRead(TMR_Reader *reader, uint32_t timeoutMs, int32_t *tagCount);
+TMR_Status simHasMoreTags(TMR_Reader *reader);
+TMR_Status simGetNextTag(TMR_Reader *reader, TMR_TagReadData *read);
+TMR_Status simStartReading(TMR_Reader *reader);
+TMR_Status simStopReading(TMR_Reader *reader);
+TMR_Status simAddReadListener(TMR_Reader *reader, TMR_ReadListenerBlock *block);
+TMR_Status simAddReadExceptionListener(TMR_Reader *reader, TMR_ReadExceptionListenerBlock *block);
+TMR_Status simAddTransportListener(TMR_Reader *reader, TMR_TransportListenerBlock *block);
+const char *simStrerr(TMR_Reader *reader, TMR_Status status);
+void simGetTimeStamp(TMR_Reader *reader, const TMR_TagReadData *read, char *timeStr);
+TMR_Status simAntDetectEnabled(TMR_Reader *reader, uint8_t *antennaList);
+
+#ifndef SIM_READER_IMPL
+#define TMR_create simCreate
+#define TMR_connect simConnect
+#define TMR_destroy simDestroy
+#define TMR_paramSet simParamSet
+#define TMR_paramGet simParamGet
+#define TMR_read simRead
+#define TMR_hasMoreTags simHasMoreTags
+#define TMR_getNextTag simGetNextTag
+#define TMR_startReading simStartReading
+#define TMR_stopReading simStopReading
+#define TMR_addReadListener simAddReadListener
+#define TMR_addReadExceptionListener simAddReadExceptionListener
+#define TMR_addTransportListener simAddTransportListener
+#define TMR_strerr simStrerr
+#define TMR_getTimeStamp simGetTimeStamp
+#define isAntDetectEnabled simAntDetectEnabled
+#endif /* SIM_READER_IMPL */
+
+#endif /* _SIM_READER_H */
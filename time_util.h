@@ -0,0 +1,21 @@
+/**
+ * Millisecond and microsecond clocks shared by the modules and programs.
+ *
+ * The monotonic clocks time intervals (batching, windows, timeouts); the
+ * wall clocks stamp what gets stored (sessions, segment headers) and pace
+ * the simulated reader.
+ * @file time_util.h
+ */
+
+#ifndef _TIME_UTIL_H
+#define _TIME_UTIL_H
+
+#include <stdint.h>
+
+uint64_t monotonicNs(void);
+uint64_t monotonicMs(void);
+uint64_t monotonicUs(void);
+uint64_t wallMs(void);
+uint64_t wallUs(void);
+
+#endif /* _TIME_UTIL_H */
@@ -0,0 +1,185 @@
+/**
+ * Always-on trace of reader serial traffic.
+ * @file trace_ring.c
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "capture.h"
+#include "trace_ring.h"
+
+/* How often the dump thread looks for requests */
+#define TRACE_POLL_MS (100)
+
+static const char *reasonName(int reason)
+{
+  switch (reason)
+  {
+  case TRACE_DUMP_SIGNAL:
+    return "signal";
+  case TRACE_DUMP_ERROR:
+    return "error";
+  default:
+    return "dump";
+  }
+}
+
+static void *dumpMain(void *arg)
+{
+  TraceRing *t = arg;
+  struct timespec poll = { 0, TRACE_POLL_MS * 1000000L };
+
+  while (atomic_load(&t->running))
+  {
+    int reason = atomic_exchange(&t->pending, TRACE_DUMP_NONE);
+
+    if (TRACE_DUMP_NONE != reason)
+    {
+      traceRingDump(t, reason);
+    }
+    nanosleep(&poll, NULL);
+  }
+  return NULL;
+}
+
+int traceRingInit(TraceRing *t, uint32_t slots, const char *prefix)
+{
+  uint32_t size = 1;
+
+  memset(t, 0, sizeof(*t));
+  while (size < slots)
+  {
+    size <<= 1;
+  }
+  t->slots = calloc(size, sizeof(*t->slots));
+  if (NULL == t->slots)
+  {
+    return -1;
+  }
+  t->mask = size - 1;
+  t->prefix = prefix;
+  pthread_mutex_init(&t->dumpLock, NULL);
+  atomic_store(&t->running, true);
+  if (0 != pthread_create(&t->thread, NULL, dumpMain, t))
+  {
+    free(t->slots);
+    t->slots = NULL;
+    return -1;
+  }
+  t->started = true;
+  return 0;
+}
+
+void traceRingFree(TraceRing *t)
+{
+  if (t->started)
+  {
+    atomic_store(&t->running, false);
+    pthread_join(t->thread, NULL);
+    t->started = false;
+  }
+  if (NULL != t->slots)
+  {
+    pthread_mutex_destroy(&t->dumpLock);
+    free(t->slots);
+    t->slots = NULL;
+  }
+}
+
+void traceRingRecord(TraceRing *t, uint8_t dir, const uint8_t *data, uint32_t len)
+{
+  uint64_t n = atomic_fetch_add_explicit(&t->next, 1, memory_order_relaxed);
+  TraceSlot *slot = &t->slots[n & t->mask];
+
+  atomic_store_explicit(&slot->seq, 2 * n + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  slot->tsUs = captureNowUs();
+  slot->origLen = len > UINT16_MAX ? UINT16_MAX : (uint16_t)len;
+  slot->len = len > TRACE_SLOT_DATA ? TRACE_SLOT_DATA : (uint16_t)len;
+  slot->dir = dir;
+  memcpy(slot->data, data, slot->len);
+  atomic_store_explicit(&slot->seq, 2 * n + 2, memory_order_release);
+}
+
+void traceListener(bool tx, uint32_t dataLen, const uint8_t data[], uint32_t timeout, void *cookie)
+{
+  (void)timeout;
+  traceRingRecord(cookie, tx ? CAPTURE_TX : CAPTURE_RX, data, dataLen);
+}
+
+void traceRingRequestDump(TraceRing *t, int reason)
+{
+  atomic_store(&t->pending, reason);
+}
+
+int traceRingDump(TraceRing *t, int reason)
+{
+  uint64_t end = atomic_load_explicit(&t->next, memory_order_acquire);
+  uint64_t size = (uint64_t)t->mask + 1;
+  uint64_t first = end > size ? end - size : 0;
+  uint64_t n;
+  uint64_t kept = 0;
+  CaptureWriter w;
+  char path[512];
+  char stamp[32];
+  time_t now = time(NULL);
+  struct tm tm;
+  bool opened = false;
+  int rc = 0;
+
+  if (NULL == t->slots)
+  {
+    return -1;
+  }
+  localtime_r(&now, &tm);
+  strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &tm);
+
+  pthread_mutex_lock(&t->dumpLock);
+  snprintf(path, sizeof(path), "%s-%s-%s-%" PRIu64 ".cap", t->prefix, stamp, reasonName(reason), t->dumps);
+  for (n = first; n < end && 0 == rc; n++)
+  {
+    TraceSlot *slot = &t->slots[n & t->mask];
+    uint8_t data[TRACE_SLOT_DATA];
+    uint64_t tsUs;
+    uint16_t len;
+    uint8_t dir;
+
+    /* Copy, then check the slot still holds frame n */
+    if (atomic_load_explicit(&slot->seq, memory_order_acquire) != 2 * n + 2)
+    {
+      continue;
+    }
+    tsUs = slot->tsUs;
+    len = slot->len;
+    dir = slot->dir;
+    memcpy(data, slot->data, len);
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&slot->seq, memory_order_relaxed) != 2 * n + 2)
+    {
+      continue;
+    }
+
+    if (!opened)
+    {
+      if (0 != captureOpenAt(&w, path, tsUs))
+      {
+        rc = -1;
+        break;
+      }
+      opened = true;
+    }
+    rc = captureWrite(&w, dir, tsUs, data, len);
+    kept++;
+  }
+  if (opened)
+  {
+    captureClose(&w);
+    t->dumps++;
+    fprintf(stderr, "Trace: %" PRIu64 " frames written to %s\n", kept, path);
+  }
+  pthread_mutex_unlock(&t->dumpLock);
+  return rc;
+}
@@ -0,0 +1,75 @@
+/**
+ * Always-on trace of reader serial traffic.
+ *
+ * The transport listener copies each message into a fixed ring of slots
+ * with a monotonic timestamp: one atomic increment and a memcpy, no locks
+ * and no I/O on the reader thread. Each slot carries a sequence number
+ * written before and after the copy, so a dump can run concurrently and
+ * skip slots that were being overwritten. Dumps are written by a
+ * background thread, in the capture format of capture.h, when requested
+ * from a signal handler or after an error, or synchronously from any
+ * thread with traceRingDump.
+ * @file trace_ring.h
+ */
+
+#ifndef _TRACE_RING_H
+#define _TRACE_RING_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define TRACE_RING_SLOTS (4096)
+/* Longest M6e serial frame is 7 bytes of framing plus 255 of data */
+#define TRACE_SLOT_DATA (264)
+
+#define TRACE_DUMP_NONE (0)
+#define TRACE_DUMP_SIGNAL (1)
+#define TRACE_DUMP_ERROR (2)
+
+typedef struct TraceSlot
+{
+  _Atomic uint64_t seq; /* 2n+1 while frame n is written, 2n+2 after */
+  uint64_t tsUs;
+  uint16_t len;         /* bytes kept */
+  uint16_t origLen;     /* bytes in the message */
+  uint8_t dir;
+  uint8_t data[TRACE_SLOT_DATA];
+} TraceSlot;
+
+typedef struct TraceRing
+{
+  TraceSlot *slots;
+  uint32_t mask;
+  _Atomic uint64_t next;          /* frames recorded so far */
+  _Atomic int pending;            /* TRACE_DUMP_* requested */
+  atomic_bool running;
+  bool started;
+  pthread_t thread;
+  pthread_mutex_t dumpLock;       /* one dump at a time */
+  const char *prefix;             /* dumps go to prefix-<time>-<reason>.cap */
+  uint64_t dumps;
+} TraceRing;
+
+/**
+ * Allocate the ring (slots rounded up to a power of two) and start the
+ * dump thread. Returns 0 or -1.
+ */
+int traceRingInit(TraceRing *t, uint32_t slots, const char *prefix);
+
+/** Stop the dump thread and free the ring. Safe to call twice. */
+void traceRingFree(TraceRing *t);
+
+void traceRingRecord(TraceRing *t, uint8_t dir, const uint8_t *data, uint32_t len);
+
+/** TMR_TransportListener that records each message; cookie is the ring. */
+void traceListener(bool tx, uint32_t dataLen, const uint8_t data[], uint32_t timeout, void *cookie);
+
+/** Ask the dump thread for a dump. Async-signal-safe. */
+void traceRingRequestDump(TraceRing *t, int reason);
+
+/** Write the ring to disk now. Returns 0 or -1. */
+int traceRingDump(TraceRing *t, int reason);
+
+#endif /* _TRACE_RING_H */